@@ -9,24 +9,36 @@
 
 #pragma once
 
+#include "V4L2DeviceSource.h"
+
+// ---------------------------------
+// Annex-B marker for the TS muxer
+//
+// The NAL unit is read in place after the 4 bytes of the marker, so the
+// frame is not copied again once the replica delivered it.
+// ---------------------------------
 class AddH26xMarkerFilter : public FramedFilter
 {
 public:
-	AddH26xMarkerFilter(UsageEnvironment &env, FramedSource *inputSource) : FramedFilter(env, inputSource)
-	{
-		m_bufferSize = OutPacketBuffer::maxSize;
-		m_buffer = new unsigned char[m_bufferSize];
-	}
-	virtual ~AddH26xMarkerFilter()
+	// called before a key frame, or the parameter sets ahead of it, is delivered
+	typedef void(KeyFrameHandler)(void *clientData);
+
+	AddH26xMarkerFilter(UsageEnvironment &env, FramedSource *inputSource, V4L2DeviceSource *deviceSource = NULL)
+		: FramedFilter(env, inputSource), m_deviceSource(deviceSource), m_keyFrameHandler(NULL), m_keyFrameHandlerData(NULL) {}
+
+	void setKeyFrameHandler(KeyFrameHandler *handler, void *clientData)
 	{
-		delete[] m_buffer;
+		m_keyFrameHandler = handler;
+		m_keyFrameHandlerData = clientData;
 	}
 
 private:
+	static const unsigned int MARKER_SIZE = 4;
+
 	static void afterGettingFrame(void *clientData, unsigned frameSize,
 								  unsigned numTruncatedBytes,
 								  struct timeval presentationTime,
-								  unsigned durationInMicroseconds)
+								  unsigned /*durationInMicroseconds*/)
 	{
 		AddH26xMarkerFilter *sink = (AddH26xMarkerFilter *)clientData;
 		sink->afterGettingFrame(frameSize, numTruncatedBytes, presentationTime);
@@ -36,29 +48,26 @@ private:
 	{
 		fPresentationTime = presentationTime;
 		fDurationInMicroseconds = 0;
-		if (numTruncatedBytes > 0)
+		if (fMaxSize < MARKER_SIZE)
 		{
-			envir() << "AddH26xMarkerFilter::afterGettingFrame(): The input frame data was too large for our buffer size truncated:" << numTruncatedBytes << " bufferSize:" << m_bufferSize << "\n";
-			m_bufferSize += numTruncatedBytes;
-			delete[] m_buffer;
-			m_buffer = new unsigned char[m_bufferSize];
+			// no room for the marker, so none for the NAL unit either
 			fFrameSize = 0;
+			fNumTruncatedBytes = frameSize + numTruncatedBytes + MARKER_SIZE;
+			envir() << "AddH26xMarkerFilter::afterGettingFrame(): buffer too small truncated:" << fNumTruncatedBytes << " bufferSize:" << fMaxSize << "\n";
+			afterGetting(this);
+			return;
 		}
-		else
+		fNumTruncatedBytes = numTruncatedBytes;
+		if (numTruncatedBytes > 0)
 		{
-			char marker[] = {0, 0, 0, 1};
-			fFrameSize = frameSize + sizeof(marker);
-			if (fFrameSize > fMaxSize)
-			{
-				fNumTruncatedBytes = fFrameSize - fMaxSize;
-				envir() << "AddH26xMarkerFilter::afterGettingFrame(): buffer too small truncated:" << fNumTruncatedBytes << " bufferSize:" << fFrameSize << "\n";
-			}
-			else
-			{
-				fNumTruncatedBytes = 0;
-				memcpy(fTo, marker, sizeof(marker));
-				memcpy(fTo + sizeof(marker), m_buffer, frameSize);
-			}
+			envir() << "AddH26xMarkerFilter::afterGettingFrame(): buffer too small truncated:" << numTruncatedBytes << " bufferSize:" << fMaxSize << "\n";
+		}
+		static const unsigned char marker[MARKER_SIZE] = {0, 0, 0, 1};
+		memcpy(fTo, marker, MARKER_SIZE);
+		fFrameSize = frameSize + MARKER_SIZE;
+		if ((m_keyFrameHandler != NULL) && (m_deviceSource != NULL) && (m_deviceSource->classifyFrame(fTo, fFrameSize) >= V4L2DeviceSource::FRAME_PARAMSET))
+		{
+			m_keyFrameHandler(m_keyFrameHandlerData);
 		}
 		afterGetting(this);
 	}
@@ -67,12 +76,14 @@ private:
 	{
 		if (fInputSource != NULL)
 		{
-			fInputSource->getNextFrame(m_buffer, m_bufferSize,
+			fInputSource->getNextFrame(fTo + MARKER_SIZE, (fMaxSize > MARKER_SIZE) ? fMaxSize - MARKER_SIZE : 0,
 									   afterGettingFrame, this,
 									   handleClosure, this);
 		}
 	}
 
-	unsigned char *m_buffer;
-	unsigned int m_bufferSize;
+private:
+	V4L2DeviceSource *m_deviceSource;
+	KeyFrameHandler *m_keyFrameHandler;
+	void *m_keyFrameHandlerData;
 };
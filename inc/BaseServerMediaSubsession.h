@@ -147,11 +147,27 @@ public:
     }
 
 public:
-    static FramedSource *createSource(UsageEnvironment &env, FramedSource *videoES, const std::string &format);
+    static FramedSource *createSource(UsageEnvironment &env, FramedSource *videoES, const std::string &format, V4L2DeviceSource *deviceSource);
     static RTPSink *createSink(UsageEnvironment &env, Groupsock *rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic, const std::string &format, V4L2DeviceSource *source);
+    // valid until the next call
     char const *getAuxLine(V4L2DeviceSource *source, RTPSink *rtpSink);
 
-    std::string getLastFrame() const
+    // version of the source parameters the SDP depends on
+    unsigned int getAuxLineVersion() const
+    {
+        V4L2DeviceSource *deviceSource = dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource());
+        if (deviceSource)
+        {
+            return deviceSource->getAuxLineVersion();
+        }
+        else
+        {
+            return 0;
+        }
+    }
+
+    // NULL until the source has a frame
+    std::shared_ptr<const std::string> getLastFrame() const
     {
         V4L2DeviceSource *deviceSource = dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource());
         if (deviceSource)
@@ -159,6 +175,43 @@ public:
             return deviceSource->getLastFrame();
         }
         else
+        {
+            return std::shared_ptr<const std::string>();
+        }
+    }
+
+    std::string getStats() const
+    {
+        V4L2DeviceSource *deviceSource = dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource());
+        if (deviceSource)
+        {
+            return deviceSource->getStats();
+        }
+        else
+        {
+            return "{}";
+        }
+    }
+
+    // key frame for a client joining or asking for it
+    void requestKeyFrame(KeyFrameBroker::Reason reason) const
+    {
+        V4L2DeviceSource *deviceSource = dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource());
+        if (deviceSource)
+        {
+            deviceSource->requestKeyFrame(reason);
+        }
+    }
+
+    // live encoder tuning of the capture device, empty if unsupported
+    std::string setEncoderParams(unsigned int bitrate, unsigned int fps, unsigned int gop) const
+    {
+        V4L2DeviceSource *deviceSource = dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource());
+        if (deviceSource)
+        {
+            return deviceSource->getDevice()->setEncoderParams(bitrate, fps, gop);
+        }
+        else
         {
             return "";
         }
@@ -169,4 +222,5 @@ public:
 protected:
     StreamReplicator *m_replicator;
     std::string m_format;
+    std::string m_auxSDPLine;
 };
@@ -0,0 +1,227 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** BatchGroupsock.h
+**
+** Unicast groupsock sending the packets of a frame with one system call
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+// live555
+#include <liveMedia.hh>
+
+#if LIVEMEDIA_LIBRARY_VERSION_INT >= 1611187200
+// ---------------------------------
+// live555 sends each packet to each destination with its own sendto. Here
+// the packets are held until the end of the frame (RTP marker bit), the
+// batch size or a short delay, and then sent to all the destinations of the
+// groupsock with a single sendmmsg. Kernels without sendmmsg get one sendto
+// per packet and destination, as live555 does.
+// With GSO, the packets of the same size that follow each other (FU-A
+// fragments of a frame, the last one may be shorter) go to a destination as
+// one UDP_SEGMENT message the kernel splits. A kernel or a device refusing
+// it gets the packets one by one from then on.
+// With SO_TXTIME, each packet carries the departure time the sink set for it
+// and the fq qdisc holds it until then; packets are not merged for GSO.
+// Without it the sink paces the packets itself and marks the last one of
+// each burst, which is sent right away like the end of a frame.
+// Unbatched, the packets go through live555 as they come and are only
+// counted.
+// Each client keeps its own send state: a client whose sends keep failing
+// is skipped for a while so that it does not cost a system call per packet,
+// and its RTCP receiver reports give how far behind it is.
+// ---------------------------------
+class BatchGroupsock : public Groupsock
+{
+public:
+	// ---------------------------------
+	// Send counters of the groupsocks of a subsession, live555 thread only
+	// ---------------------------------
+	struct Stats
+	{
+		// ---------------------------------
+		// Client address, the port is left out so that RTP and RTCP share it
+		// ---------------------------------
+		struct Address
+		{
+			explicit Address(const struct sockaddr_storage &address);
+			bool operator<(const Address &other) const
+			{
+				return (m_family != other.m_family) ? (m_family < other.m_family) : (memcmp(m_address, other.m_address, sizeof(m_address)) < 0);
+			}
+			std::string toString() const;
+
+			sa_family_t m_family;
+			unsigned char m_address[16];
+		};
+
+		// ---------------------------------
+		// Send state of a client
+		// ---------------------------------
+		struct Destination
+		{
+			Destination() : m_datagrams(0), m_errors(0), m_failures(0), m_suspensions(0), m_skipped(0), m_lastUsed(0), m_resumeAt(0), m_sequence(0), m_reports(0), m_fractionLost(0), m_lost(0), m_lag(0) {}
+
+			unsigned long m_datagrams;
+			unsigned long m_errors;
+			// errors in a row, reset by a datagram sent
+			unsigned int m_failures;
+			// times the destination was skipped, and the datagrams it missed
+			unsigned long m_suspensions;
+			unsigned long m_skipped;
+			unsigned long long m_lastUsed;
+			unsigned long long m_resumeAt;
+			// sequence number of the last RTP packet sent
+			unsigned short m_sequence;
+			// last RTCP receiver report from this address
+			unsigned long m_reports;
+			unsigned int m_fractionLost;
+			long m_lost;
+			// packets sent and not received yet
+			unsigned int m_lag;
+		};
+
+		Stats() : m_packets(0), m_datagrams(0), m_calls(0), m_batches(0), m_gsoMessages(0), m_gsoSegments(0), m_txTime(0), m_errors(0), m_pruneAt(0) {}
+		std::string toJSON() const;
+
+		// packets given by live555
+		unsigned long m_packets;
+		// packets times destinations
+		unsigned long m_datagrams;
+		// send system calls
+		unsigned long m_calls;
+		// flushes that used sendmmsg
+		unsigned long m_batches;
+		// UDP_SEGMENT messages and the datagrams they carried
+		unsigned long m_gsoMessages;
+		unsigned long m_gsoSegments;
+		// datagrams sent with a departure time
+		unsigned long m_txTime;
+		unsigned long m_errors;
+		std::map<Address, Destination> m_destinations;
+		// next look for clients gone
+		unsigned long long m_pruneAt;
+	};
+
+	// without stats (multicast) packets are sent right away by live555
+	BatchGroupsock(UsageEnvironment &env, struct sockaddr_storage const &groupAddr, Port port, u_int8_t ttl, Stats *stats = NULL);
+	virtual ~BatchGroupsock();
+
+	// packets held before a send, 0 or 1 sends each packet right away (default)
+	static void setBatchSize(unsigned int size)
+	{
+		s_batchSize = size;
+		if (s_batchSize > MAX_BATCH)
+		{
+			s_batchSize = MAX_BATCH;
+		}
+	}
+	static unsigned int getBatchSize() { return s_batchSize; }
+	// GSO needs packets held, the batch size is raised if it is too small
+	static void setGSO(bool gso)
+	{
+		s_gso = gso;
+		if (gso && (s_batchSize <= 1))
+		{
+			s_batchSize = MAX_BATCH;
+		}
+	}
+	static bool getGSO() { return s_gso; }
+	// departure times given to the kernel (fq qdisc), cleared if the kernel refuses SO_TXTIME
+	static void setTxTime(bool txTime) { s_txTime = txTime; }
+	static bool getTxTime() { return s_txTime; }
+
+	// departure time of the next packet (us, monotonic clock), 0 for now
+	void setDeparture(unsigned long long departure) { m_departure = departure; }
+	bool sendsAtDeparture() const { return s_txTime && (m_stats != NULL); }
+	// the next packet is the last one before the sink pauses, do not hold it
+	void endBurst() { m_endOfBurst = true; }
+
+	virtual Boolean output(UsageEnvironment &env, unsigned char *buffer, unsigned bufferSize);
+
+protected:
+	static const unsigned int MAX_BATCH = 64;
+	// longest wait of a packet with no marker bit behind it (us)
+	static const unsigned int FLUSH_DELAY = 2000;
+	// errors in a row before a destination is skipped, and for how long (us)
+	static const unsigned int MAX_FAILURES = 8;
+	static const unsigned int SUSPEND_DELAY = 1000000;
+	// destinations not used for that long are forgotten (us)
+	static const unsigned int DESTINATION_TIMEOUT = 60000000;
+	// kernel limits of a UDP_SEGMENT message
+	static const unsigned int MAX_GSO_SEGMENTS = 64;
+	static const unsigned int MAX_GSO_BYTES = 65000;
+
+	// packets sent to a destination with one message
+	struct Run
+	{
+		Run(const struct sockaddr_storage *address, Stats::Destination *destination, unsigned int first, unsigned int count) : m_address(address), m_destination(destination), m_first(first), m_count(count) {}
+		const struct sockaddr_storage *m_address;
+		Stats::Destination *m_destination;
+		unsigned int m_first;
+		unsigned int m_count;
+	};
+
+	// struct mmsghdr, missing from older C libraries
+	struct MultiMessage
+	{
+		struct msghdr msg_hdr;
+		unsigned int msg_len;
+	};
+
+	static void flushTask(void *clientData)
+	{
+		BatchGroupsock *groupsock = (BatchGroupsock *)clientData;
+		groupsock->m_flushTask = NULL;
+		groupsock->flush();
+	}
+	void flush();
+	// number of messages sent, -1 with errno set if none
+	static int sendMultiple(int fd, MultiMessage *messages, unsigned int count);
+	unsigned int gsoRun(unsigned int first) const;
+	size_t send(size_t first);
+	void countSent(const Run &run);
+	void countError(const Run &run, int error);
+	// send state of an address, NULL without stats
+	Stats::Destination *destination(const struct sockaddr_storage &address, unsigned long long now);
+	void prune(unsigned long long now);
+	// first report block of an RTCP SR or RR from a client
+	void countReport(const struct sockaddr_storage &from, unsigned int fractionLost, long lost, unsigned int extendedSequence);
+
+protected:
+	Stats *m_stats;
+	// packets back to back, and their offset and size
+	std::vector<unsigned char> m_buffer;
+	std::vector<std::pair<unsigned int, unsigned int>> m_packets;
+	std::vector<unsigned long long> m_departures;
+	// sequence number of the last RTP packet held, -1 for none
+	int m_sequence;
+	// kept from a flush to the next
+	std::vector<struct iovec> m_iovecs;
+	std::vector<Run> m_runs;
+	std::vector<MultiMessage> m_messages;
+	std::vector<char> m_controls;
+	unsigned long long m_departure;
+	bool m_endOfBurst;
+	TaskToken m_flushTask;
+
+	static unsigned int s_batchSize;
+	// cleared when the kernel does not know sendmmsg
+	static bool s_sendmmsg;
+	// cleared when a UDP_SEGMENT send is refused
+	static bool s_gso;
+	static bool s_txTime;
+};
+#endif
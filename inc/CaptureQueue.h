@@ -0,0 +1,171 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** CaptureQueue.h
+**
+** Bounded single-producer/single-consumer ring of frame descriptors
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+
+// ---------------------------------
+// Capture queue
+//
+// The capture thread pushes, the live555 thread pops. Items are stored inline
+// so no allocation happens per frame. To keep the drop-oldest behaviour the
+// producer may also evict the oldest item. Both sides retire the head slot
+// with a compare-and-swap, so each item is handed out exactly once.
+//
+// An eviction lets the producer write the next item while the consumer may
+// still be copying the evicted one out of its slot. There is at least one
+// slot more than the limit so that this does not happen on the first
+// eviction, and each slot carries the position of the item it holds, odd
+// while it is being written: a copy made while the slot changed is retried.
+//
+// peek()/at() give a consistent copy of an item that may be evicted right
+// after: what the item points to belongs to whoever takes it out of the
+// queue (pop(), evict() or a successful retire()), the others must not
+// dereference it.
+// ---------------------------------
+template <typename T>
+class CaptureQueue
+{
+public:
+	explicit CaptureQueue(unsigned int limit) : m_limit(limit ? limit : 1), m_slots(NULL), m_head(0), m_tail(0)
+	{
+		// power of two slots so that free-running indexes wrap cleanly
+		unsigned int slots = 1;
+		while (slots <= m_limit)
+		{
+			slots <<= 1;
+		}
+		m_mask = slots - 1;
+		m_slots = new Slot[slots];
+		for (unsigned int i = 0; i < slots; ++i)
+		{
+			m_slots[i].m_sequence.store(0, std::memory_order_relaxed);
+		}
+	}
+	~CaptureQueue() { delete[] m_slots; }
+
+	CaptureQueue(const CaptureQueue &) = delete;
+	CaptureQueue &operator=(const CaptureQueue &) = delete;
+
+	// producer side
+	bool push(const T &item)
+	{
+		unsigned int tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_head.load(std::memory_order_acquire) >= m_limit)
+		{
+			return false;
+		}
+		Slot &slot = m_slots[tail & m_mask];
+		slot.m_sequence.store(2 * tail + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		slot.m_item = item;
+		slot.m_sequence.store(2 * tail + 2, std::memory_order_release);
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool evict(T &item) { return claim(item); }
+
+	// consumer side
+	bool pop(T &item) { return claim(item); }
+	bool peek(T &item, unsigned int &ticket) const
+	{
+		ticket = m_head.load(std::memory_order_acquire);
+		while (ticket != m_tail.load(std::memory_order_acquire))
+		{
+			if (this->read(ticket, item))
+			{
+				return true;
+			}
+			// evicted and its slot reused, the head has moved
+			ticket = m_head.load(std::memory_order_acquire);
+		}
+		return false;
+	}
+	// look further into the queue; the item may be evicted meanwhile so
+	// only use it as a hint and go through peek()/retire() to take it
+	bool at(unsigned int ticket, T &item) const
+	{
+		unsigned int head = m_head.load(std::memory_order_acquire);
+		if ((ticket - head) >= (m_tail.load(std::memory_order_acquire) - head))
+		{
+			return false;
+		}
+		return this->read(ticket, item);
+	}
+	// the item is still the head: nothing evicted it
+	bool holds(unsigned int ticket) const
+	{
+		return m_head.load(std::memory_order_acquire) == ticket;
+	}
+	bool retire(unsigned int ticket)
+	{
+		return m_head.compare_exchange_strong(ticket, ticket + 1, std::memory_order_acq_rel);
+	}
+
+	bool full() const { return size() >= m_limit; }
+	bool empty() const { return size() == 0; }
+	unsigned int size() const
+	{
+		// head first: it never passes a tail read afterwards
+		unsigned int head = m_head.load(std::memory_order_acquire);
+		return m_tail.load(std::memory_order_acquire) - head;
+	}
+	unsigned int limit() const { return m_limit; }
+
+protected:
+	struct Slot
+	{
+		// 2 * position + 2 once the item at this position is written
+		std::atomic<unsigned int> m_sequence;
+		T m_item;
+	};
+
+	// copy of the item at this position, false if its slot was rewritten meanwhile
+	bool read(unsigned int position, T &item) const
+	{
+		const Slot &slot = m_slots[position & m_mask];
+		unsigned int sequence = 2 * position + 2;
+		if (slot.m_sequence.load(std::memory_order_acquire) != sequence)
+		{
+			return false;
+		}
+		item = slot.m_item;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return slot.m_sequence.load(std::memory_order_relaxed) == sequence;
+	}
+
+	bool claim(T &item)
+	{
+		unsigned int head = m_head.load(std::memory_order_acquire);
+		while (head != m_tail.load(std::memory_order_acquire))
+		{
+			if (!this->read(head, item))
+			{
+				head = m_head.load(std::memory_order_acquire);
+			}
+			else if (m_head.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+protected:
+	unsigned int m_limit;
+	unsigned int m_mask;
+	Slot *m_slots;
+	std::atomic<unsigned int> m_head;
+	std::atomic<unsigned int> m_tail;
+};
@@ -8,7 +8,9 @@
 ** -------------------------------------------------------------------------*/
 
 #pragma once
+#include <sys/time.h>
 #include <list>
+#include <string>
 
 // ---------------------------------
 // Device Interface
@@ -19,8 +21,23 @@ public:
 	virtual size_t read(char *buffer, size_t bufferSize) = 0;
 	virtual int getFd() = 0;
 	virtual unsigned long getBufferSize() = 0;
+	// Largest frame the device can actually produce; used to size capture buffers
+	virtual unsigned long getMaxFrameSize() { return getBufferSize(); }
+	// Frames read() had to cut to the buffer it was given
+	virtual unsigned long getTruncatedFrames() { return 0; }
+	// Optional zero-copy capture: lend the next frame instead of copying it in read().
+	// Returns its size, 0 if none is ready. The buffer stays valid until releaseFrame(),
+	// and no other frame is lent meanwhile.
+	virtual bool canBorrowFrames() { return false; }
+	virtual size_t borrowFrame(char *&buffer) { buffer = NULL; return 0; }
+	virtual void releaseFrame(char *) {}
+	// Optional live encoder tuning: bitrate (bit/s), fps and GOP, 0 keeps a value. Returns a
+	// JSON object with the resulting values and how each change was applied, empty if unsupported.
+	virtual std::string setEncoderParams(unsigned int, unsigned int, unsigned int) { return std::string(); }
 	// Optional hint to request a keyframe/IDR from the underlying encoder; default no-op
 	virtual bool requestKeyFrame() { return false; }
+	// Optional capture time (wall clock) of the last frame read or lent, false if unknown
+	virtual bool getCaptureTime(timeval &) { return false; }
 	virtual int getWidth() { return -1; }
 	virtual int getHeight() { return -1; }
 	virtual int getVideoFormat() { return -1; }
@@ -0,0 +1,112 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** FeedbackGroupsock.h
+**
+** RTCP groupsock that forwards key frame requests (PLI/FIR) to the source
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+// live555
+#include <liveMedia.hh>
+
+#include "V4L2DeviceSource.h"
+#include "BatchGroupsock.h"
+
+#if LIVEMEDIA_LIBRARY_VERSION_INT >= 1611187200
+// ---------------------------------
+// live555 handles SR/RR/BYE/APP and skips payload-specific feedback, so PLI
+// and FIR are looked for here as the RTCP packets are read. RTCP interleaved
+// in the RTSP connection does not go through a groupsock and is not seen.
+// The first report block of a SR or RR gives the losses and the lag of the
+// client it comes from.
+// ---------------------------------
+class FeedbackGroupsock : public BatchGroupsock
+{
+public:
+	FeedbackGroupsock(UsageEnvironment &env, struct sockaddr_storage const &groupAddr, Port port, u_int8_t ttl, BatchGroupsock::Stats *stats = NULL)
+		: BatchGroupsock(env, groupAddr, port, ttl, stats), m_source(NULL) {}
+
+	// only set on RTCP sockets
+	void setFeedbackSource(V4L2DeviceSource *source) { m_source = source; }
+
+	virtual Boolean handleRead(unsigned char *buffer, unsigned bufferMaxSize, unsigned &bytesRead, struct sockaddr_storage &fromAddressAndPort)
+	{
+		Boolean ret = Groupsock::handleRead(buffer, bufferMaxSize, bytesRead, fromAddressAndPort);
+		if (ret && m_source && hasKeyFrameRequest(buffer, bytesRead))
+		{
+			m_source->requestKeyFrame(KeyFrameBroker::REASON_FEEDBACK);
+		}
+		unsigned int fractionLost = 0;
+		long lost = 0;
+		unsigned int extendedSequence = 0;
+		if (ret && getReceptionReport(buffer, bytesRead, fractionLost, lost, extendedSequence))
+		{
+			this->countReport(fromAddressAndPort, fractionLost, lost, extendedSequence);
+		}
+		return ret;
+	}
+
+	// first report block of a compound RTCP packet (RFC 3550 6.4)
+	static bool getReceptionReport(const unsigned char *packet, unsigned size, unsigned int &fractionLost, long &lost, unsigned int &extendedSequence)
+	{
+		const unsigned char RTCP_PT_SR = 200;
+		const unsigned char RTCP_PT_RR = 201;
+		while (size >= 4)
+		{
+			unsigned length = ((packet[2] << 8 | packet[3]) + 1) * 4;
+			if (((packet[0] >> 6) != 2) || (length > size))
+			{
+				return false;
+			}
+			// header and SSRC, and the sender info of a SR
+			unsigned offset = (packet[1] == RTCP_PT_SR) ? 28 : 8;
+			if (((packet[1] == RTCP_PT_SR) || (packet[1] == RTCP_PT_RR)) && ((packet[0] & 0x1F) > 0) && (offset + 24 <= length))
+			{
+				const unsigned char *block = packet + offset;
+				fractionLost = block[4];
+				// 24 bits signed
+				lost = (block[5] << 16) | (block[6] << 8) | block[7];
+				if (lost & 0x800000)
+				{
+					lost -= 0x1000000;
+				}
+				extendedSequence = ((unsigned int)block[8] << 24) | (block[9] << 16) | (block[10] << 8) | block[11];
+				return true;
+			}
+			packet += length;
+			size -= length;
+		}
+		return false;
+	}
+
+	// compound RTCP packet holding a PLI (RFC 4585) or a FIR (RFC 5104)
+	static bool hasKeyFrameRequest(const unsigned char *packet, unsigned size)
+	{
+		const unsigned char RTCP_PT_PSFB = 206;
+		while (size >= 4)
+		{
+			unsigned length = ((packet[2] << 8 | packet[3]) + 1) * 4;
+			if (((packet[0] >> 6) != 2) || (length > size))
+			{
+				return false;
+			}
+			unsigned fmt = packet[0] & 0x1F;
+			if ((packet[1] == RTCP_PT_PSFB) && ((fmt == 1) || (fmt == 4)))
+			{
+				return true;
+			}
+			packet += length;
+			size -= length;
+		}
+		return false;
+	}
+
+protected:
+	V4L2DeviceSource *m_source;
+};
+#endif
@@ -0,0 +1,63 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** FramePool.h
+**
+** Fixed-size pool of preallocated capture buffers
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <vector>
+#include <mutex>
+
+// ---------------------------------
+// Owner of capture buffers: queued frames hand their buffer back to it
+// ---------------------------------
+class FrameReleaser
+{
+public:
+	virtual ~FrameReleaser() {}
+	virtual void release(char *buffer) = 0;
+};
+
+// ---------------------------------
+// Frame buffer pool
+//
+// All buffers live in one arena allocated up front. When the pool runs dry
+// acquire() falls back to a heap buffer of the same size (counted as a miss);
+// release() frees such buffers instead of returning them to the pool.
+// ---------------------------------
+class FramePool : public FrameReleaser
+{
+public:
+	FramePool(unsigned int count, unsigned long bufferSize);
+	virtual ~FramePool();
+
+	FramePool(const FramePool &) = delete;
+	FramePool &operator=(const FramePool &) = delete;
+
+	char *acquire();
+	virtual void release(char *buffer);
+
+	unsigned long getBufferSize() const { return m_bufferSize; }
+	unsigned int getCount() const { return m_count; }
+	unsigned int getAvailable();
+	unsigned long getHits();
+	unsigned long getMisses();
+
+protected:
+	bool owns(const char *buffer) const { return (buffer >= m_arena) && (buffer < m_arena + m_count * m_bufferSize); }
+
+protected:
+	unsigned int m_count;
+	unsigned long m_bufferSize;
+	char *m_arena;
+	std::vector<char *> m_free;
+	std::mutex m_mutex;
+	unsigned long m_hits;
+	unsigned long m_misses;
+};
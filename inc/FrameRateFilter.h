@@ -0,0 +1,205 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** FrameRateFilter.h
+**
+** Pass-through filter lowering the frame rate of a replica
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "V4L2DeviceSource.h"
+
+// ---------------------------------
+// Frame rate filter
+//
+// Sits between a stream replica and the framer. Only the disposable pictures
+// (nothing refers to them: nal_ref_idc 0, H265 sub-layer non-reference) can
+// be dropped without breaking the decoding of the following ones, so the
+// frame rate goes down to the requested one only as far as the encoder
+// produces them. Reference and key pictures always go through.
+//
+// The decision is taken once per access unit (NAL units sharing a
+// presentation time) and applies to all of its NAL units, so a kept picture
+// keeps its delimiter and SEI. A picture that is due is kept from its first
+// NAL unit on; otherwise the delimiter and SEI in front of its first slice are
+// held until that slice tells whether it is a reference. Parameter sets
+// always go through.
+// ---------------------------------
+class FrameRateFilter : public FramedFilter, public AccessUnitSource
+{
+public:
+	static FrameRateFilter *createNew(UsageEnvironment &env, FramedSource *inputSource, V4L2DeviceSource *source, unsigned int fps)
+	{
+		return new FrameRateFilter(env, inputSource, source, fps);
+	}
+
+protected:
+	FrameRateFilter(UsageEnvironment &env, FramedSource *inputSource, V4L2DeviceSource *source, unsigned int fps)
+		: FramedFilter(env, inputSource), m_source(source), m_interval(1000000ULL / (fps ? fps : 1)), m_frameInterval(0), m_lastTime(0), m_lastKept(0),
+		  m_decision(UNDECIDED), m_heldCount(0), m_heldNext(0), m_endsAccessUnit(false) {}
+
+public:
+	virtual bool lastFrameEndsAccessUnit() const { return m_endsAccessUnit; }
+	virtual unsigned int maxFrameSize() const { return m_source->maxFrameSize(); }
+
+private:
+	enum Decision
+	{
+		UNDECIDED,
+		KEEP,
+		DROP
+	};
+
+	// NAL unit of the current access unit waiting for the decision
+	struct Held
+	{
+		std::string m_data;
+		unsigned m_numTruncatedBytes;
+		struct timeval m_presentationTime;
+		unsigned m_durationInMicroseconds;
+		bool m_endsAccessUnit;
+	};
+
+	static void afterGettingFrame(void *clientData, unsigned frameSize,
+								  unsigned numTruncatedBytes,
+								  struct timeval presentationTime,
+								  unsigned durationInMicroseconds)
+	{
+		FrameRateFilter *filter = (FrameRateFilter *)clientData;
+		filter->afterGettingFrame(frameSize, numTruncatedBytes, presentationTime, durationInMicroseconds);
+	}
+
+	void afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime, unsigned durationInMicroseconds)
+	{
+		unsigned long long time = presentationTime.tv_sec * 1000000ULL + presentationTime.tv_usec;
+		if (time != m_lastTime)
+		{
+			// first NAL unit of an access unit
+			if ((time > m_lastTime) && (m_lastTime != 0))
+			{
+				m_frameInterval = time - m_lastTime;
+			}
+			m_lastTime = time;
+			// delimiter or SEI of an access unit that had no picture
+			m_heldCount = 0;
+			m_heldNext = 0;
+			// a picture is kept when it is due, half a source frame early is close enough
+			m_decision = UNDECIDED;
+			if (time + m_frameInterval / 2 >= m_lastKept + m_interval)
+			{
+				m_decision = KEEP;
+				m_lastKept = time;
+			}
+		}
+
+		V4L2DeviceSource::FrameClass frameClass = m_source->classifyFrame(fTo, frameSize);
+		if (m_decision == UNDECIDED)
+		{
+			if (m_source->isPicture(fTo, frameSize))
+			{
+				// the first slice tells for the whole picture
+				m_decision = (frameClass == V4L2DeviceSource::FRAME_DISPOSABLE) ? DROP : KEEP;
+				if (m_decision == KEEP)
+				{
+					m_lastKept = time;
+				}
+				if ((m_decision == KEEP) && (m_heldCount != 0))
+				{
+					// the held NAL units go first
+					this->hold(frameSize, numTruncatedBytes, presentationTime, durationInMicroseconds);
+					this->deliverHeld();
+					return;
+				}
+				m_heldCount = 0;
+			}
+			else if (frameClass == V4L2DeviceSource::FRAME_DISPOSABLE)
+			{
+				this->hold(frameSize, numTruncatedBytes, presentationTime, durationInMicroseconds);
+				this->doGetNextFrame();
+				return;
+			}
+		}
+		if ((m_decision == DROP) && (frameClass == V4L2DeviceSource::FRAME_DISPOSABLE))
+		{
+			this->doGetNextFrame();
+			return;
+		}
+
+		fFrameSize = frameSize;
+		fNumTruncatedBytes = numTruncatedBytes;
+		fPresentationTime = presentationTime;
+		fDurationInMicroseconds = durationInMicroseconds;
+		m_endsAccessUnit = m_source->lastFrameEndsAccessUnit();
+		afterGetting(this);
+	}
+
+	// copy the NAL unit out of fTo, the held strings are reused
+	void hold(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime, unsigned durationInMicroseconds)
+	{
+		if (m_heldCount == m_held.size())
+		{
+			m_held.push_back(Held());
+		}
+		Held &held = m_held[m_heldCount++];
+		held.m_data.assign((const char *)fTo, frameSize);
+		held.m_numTruncatedBytes = numTruncatedBytes;
+		held.m_presentationTime = presentationTime;
+		held.m_durationInMicroseconds = durationInMicroseconds;
+		held.m_endsAccessUnit = m_source->lastFrameEndsAccessUnit();
+	}
+
+	void deliverHeld()
+	{
+		const Held &held = m_held[m_heldNext++];
+		fFrameSize = held.m_data.size();
+		fNumTruncatedBytes = held.m_numTruncatedBytes;
+		if (fFrameSize > fMaxSize)
+		{
+			fNumTruncatedBytes += fFrameSize - fMaxSize;
+			fFrameSize = fMaxSize;
+		}
+		memcpy(fTo, held.m_data.data(), fFrameSize);
+		fPresentationTime = held.m_presentationTime;
+		fDurationInMicroseconds = held.m_durationInMicroseconds;
+		m_endsAccessUnit = held.m_endsAccessUnit;
+		if (m_heldNext >= m_heldCount)
+		{
+			m_heldCount = 0;
+			m_heldNext = 0;
+		}
+		afterGetting(this);
+	}
+
+	virtual void doGetNextFrame()
+	{
+		if ((m_decision == KEEP) && (m_heldNext < m_heldCount))
+		{
+			this->deliverHeld();
+			return;
+		}
+		fInputSource->getNextFrame(fTo, fMaxSize, afterGettingFrame, this, handleClosure, this);
+	}
+
+	V4L2DeviceSource *m_source;
+	// microseconds
+	unsigned long long m_interval;
+	unsigned long long m_frameInterval;
+	unsigned long long m_lastTime;
+	unsigned long long m_lastKept;
+	// for the access unit at m_lastTime
+	Decision m_decision;
+	std::vector<Held> m_held;
+	size_t m_heldCount;
+	size_t m_heldNext;
+	// for the last NAL unit delivered
+	bool m_endsAccessUnit;
+};
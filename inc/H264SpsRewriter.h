@@ -0,0 +1,34 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** H264SpsRewriter.h
+**
+** Rewrite the VUI of an H264 SPS
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stddef.h>
+
+#include <string>
+
+// ---------------------------------
+// H264 SPS rewriter
+//
+// Without bitstream_restriction in the VUI, decoders have to assume that
+// frames may be reordered and buffer up to the DPB size before output.
+// The rewriter adds it, or patches it, with max_num_reorder_frames = 0 and
+// max_dec_frame_buffering = max_num_ref_frames. It is only correct for
+// streams without B-frames, so an SPS that already announces reordering is
+// left unchanged. The other VUI fields are copied bit for bit.
+// ---------------------------------
+class H264SpsRewriter
+{
+public:
+	// nal is the SPS NAL unit without start code, out receives the rewritten NAL unit
+	// false if the SPS can not be parsed or needs no change
+	static bool setZeroReorder(const unsigned char *nal, size_t size, std::string &out);
+};
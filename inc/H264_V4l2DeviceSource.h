@@ -22,12 +22,32 @@ public:
 		return new H264_V4L2DeviceSource(env, device, outputFd, queueSize, captureMode, repeatConfig, keepMarker);
 	}
 
+	// Rewrite the SPS VUI so that decoders output each frame without reorder delay (streams without B-frames)
+	void setZeroReorder(bool zeroReorder) { m_zeroReorder.store(zeroReorder); }
+
 protected:
 	H264_V4L2DeviceSource(UsageEnvironment &env, DeviceInterface *device, int outputFd, unsigned int queueSize, CaptureMode captureMode, bool repeatConfig, bool keepMarker)
-		: H26X_V4L2DeviceSource(env, device, outputFd, queueSize, captureMode, repeatConfig, keepMarker) {}
+		: H26X_V4L2DeviceSource(env, device, outputFd, queueSize, captureMode, repeatConfig, keepMarker)
+	{
+		m_zeroReorder.store(false);
+	}
 
 	// overide V4L2DeviceSource
 	virtual std::list<std::pair<unsigned char *, size_t>> splitFrames(unsigned char *frame, unsigned frameSize);
 	virtual std::list<std::string> getInitFrames();
 	virtual bool isKeyFrame(const char *, int);
+	virtual FrameClass classifyFrame(const unsigned char *, size_t);
+	virtual bool isPicture(const unsigned char *, size_t);
+	virtual std::list<std::pair<unsigned char *, size_t>> getParameterSets();
+	// overide H26X_V4L2DeviceSource
+	virtual std::string getSeiHeader() { return std::string(1, (char)6); }
+	virtual bool precedesSei(const unsigned char *, size_t);
+
+	const std::string &rewriteSps(const unsigned char *sps, size_t size);
+
+protected:
+	std::atomic<bool> m_zeroReorder;
+	// last SPS from the encoder and its rewritten version, capture thread only
+	std::string m_encoderSps;
+	std::string m_rewrittenSps;
 };
@@ -30,7 +30,10 @@ protected:
 	virtual std::list<std::pair<unsigned char *, size_t>> splitFrames(unsigned char *frame, unsigned frameSize);
 	virtual std::list<std::string> getInitFrames();
 	virtual bool isKeyFrame(const char *, int);
-
-protected:
-	std::string m_vps;
+	virtual FrameClass classifyFrame(const unsigned char *, size_t);
+	virtual bool isPicture(const unsigned char *, size_t);
+	virtual std::list<std::pair<unsigned char *, size_t>> getParameterSets();
+	// overide H26X_V4L2DeviceSource
+	virtual std::string getSeiHeader() { return std::string("\x4e\x01", 2); }
+	virtual bool precedesSei(const unsigned char *, size_t);
 };
@@ -0,0 +1,191 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** H26xRTPSink.h
+**
+** H264/H265 RTP sink aggregating small NAL units
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <vector>
+
+#include "liveMedia.hh"
+
+class AccessUnitSource;
+
+// ---------------------------------
+// Source of RTP payloads, one per packet
+//
+// An H26xRTPSink reading such a source sends its payloads as they are
+// instead of packetizing the source itself.
+// ---------------------------------
+class H26xPayloadSource
+{
+public:
+	virtual ~H26xPayloadSource() {}
+
+	// the last payload delivered completes an access unit
+	virtual bool lastPayloadEndsAccessUnit() const = 0;
+	// departure time of the last payload delivered (us, monotonic clock), 0 for now
+	virtual unsigned long long lastPayloadDeparture() const = 0;
+	// the payloads after the last one delivered are held back by the pacing
+	virtual bool lastPayloadEndsBurst() const = 0;
+	// set by the sink before it reads: the largest payload it sends, and
+	// whether its groupsock keeps the departure times (payloads delivered right away)
+	virtual void configure(unsigned int maxPayloadSize, bool txTime) = 0;
+	// the packet of the last payload could not be sent
+	virtual void sendFailed() {}
+};
+
+// ---------------------------------
+// H264/H265 RTP payloader
+//
+// Turns the NAL units of the framer into RTP payloads, one per packet:
+// - parameter sets, SEI and other non-VCL NAL units are held back and
+//   aggregated with the following NAL units of the same access unit
+//   (STAP-A for H264, RFC 6184 / AP for H265, RFC 7798)
+// - a VCL NAL unit ends the access unit, it is never held back, and so does
+//   the last NAL unit of an access unit when the source tells it
+//   (AccessUnitSource)
+// - a single NAL unit is sent as it is, a large one in fragments (FU-A / FU)
+// The duration of a NAL unit read from the framer is the window its payloads
+// are spread over (pacing): a token bucket filled at the rate of the NAL unit
+// holds back the payloads once a burst is sent, or only stamps their
+// departure time when the groupsock leaves the wait to the kernel (SO_TXTIME).
+// ---------------------------------
+class H26xPacketizer : public FramedFilter, public H26xPayloadSource
+{
+public:
+	static H26xPacketizer *createNew(UsageEnvironment &env, FramedSource *inputSource, int hNumber, unsigned int maxPayloadSize)
+	{
+		return new H26xPacketizer(env, inputSource, hNumber, maxPayloadSize);
+	}
+
+	virtual bool lastPayloadEndsAccessUnit() const { return m_endsAccessUnit; }
+	virtual unsigned long long lastPayloadDeparture() const { return m_departure; }
+	virtual bool lastPayloadEndsBurst() const { return m_endsBurst; }
+	// the payload size is the one given at creation
+	virtual void configure(unsigned int /*maxPayloadSize*/, bool txTime) { m_txTime = txTime; }
+
+	// bytes sent back to back before pacing holds the payloads
+	static void setPacingBurst(unsigned int bytes) { s_pacingBurst = bytes; }
+	static unsigned int getPacingBurst() { return s_pacingBurst; }
+
+protected:
+	H26xPacketizer(UsageEnvironment &env, FramedSource *inputSource, int hNumber, unsigned int maxPayloadSize);
+	virtual ~H26xPacketizer();
+
+	virtual void doGetNextFrame();
+	virtual void doStopGettingFrames();
+
+	static void afterGettingFrame(void *clientData, unsigned frameSize,
+								  unsigned numTruncatedBytes,
+								  struct timeval presentationTime,
+								  unsigned durationInMicroseconds)
+	{
+		H26xPacketizer *packetizer = (H26xPacketizer *)clientData;
+		packetizer->afterGettingFrame(frameSize, numTruncatedBytes, presentationTime, durationInMicroseconds);
+	}
+	void afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime, unsigned durationInMicroseconds);
+
+	void getNextNalUnit();
+	void findAccessUnitSource();
+	bool isVCL(const unsigned char *nal) const;
+	bool canAggregate(unsigned int size) const;
+	void aggregate(const unsigned char *nal, unsigned int size);
+	void processNalUnit();
+	void deliverAggregate(bool endsAccessUnit);
+	void deliverNalUnit();
+	void sendPayload();
+
+	static void pacingTask(void *clientData)
+	{
+		H26xPacketizer *packetizer = (H26xPacketizer *)clientData;
+		packetizer->m_pacingTask = NULL;
+		afterGetting(packetizer);
+	}
+
+private:
+	int m_hNumber;
+	unsigned int m_headerSize;
+	unsigned int m_maxPayloadSize;
+
+	// source the NAL unit buffer is sized for, and the one telling where its access units end
+	FramedSource *m_input;
+	AccessUnitSource *m_auSource;
+
+	// NAL unit read from the framer, delivered single or in fragments
+	unsigned char *m_nal;
+	unsigned int m_nalBufferSize;
+	unsigned int m_nalSize;
+	unsigned int m_nalOffset;
+	bool m_nalEndsAccessUnit;
+	struct timeval m_nalTime;
+	unsigned int m_nalDuration;
+
+	// aggregation units, 16 bits size followed by the NAL unit
+	std::vector<unsigned char> m_aggregate;
+	unsigned int m_aggregateCount;
+	struct timeval m_aggregateTime;
+
+	bool m_endsAccessUnit;
+
+	// token bucket, the rate (bytes/s) is the one of the current NAL unit
+	unsigned long long m_rate;
+	long long m_tokens;
+	unsigned long long m_tokenTime;
+	unsigned long long m_departure;
+	bool m_endsBurst;
+	bool m_txTime;
+	TaskToken m_pacingTask;
+
+	static unsigned int s_pacingBurst;
+};
+
+// ---------------------------------
+// H264/H265 RTP sink using the payloader
+//
+// The source is packetized by a payloader of the sink, unless it already
+// gives payloads (H26xPayloadSource).
+// The SDP fmtp line is left to the device source.
+// ---------------------------------
+class H26xRTPSink : public VideoRTPSink
+{
+public:
+	static H26xRTPSink *createNew(UsageEnvironment &env, Groupsock *rtpGroupsock, unsigned char rtpPayloadFormat, int hNumber)
+	{
+		return new H26xRTPSink(env, rtpGroupsock, rtpPayloadFormat, hNumber);
+	}
+
+protected:
+	H26xRTPSink(UsageEnvironment &env, Groupsock *rtpGroupsock, unsigned char rtpPayloadFormat, int hNumber)
+		: VideoRTPSink(env, rtpGroupsock, rtpPayloadFormat, 90000, (hNumber == 264) ? "H264" : "H265"), m_hNumber(hNumber), m_packetizer(NULL), m_payloadSource(NULL)
+	{
+		setOnSendErrorFunc(onSendError, this);
+	}
+	virtual ~H26xRTPSink();
+
+	bool groupsockTxTime();
+	static void onSendError(void *clientData)
+	{
+		H26xRTPSink *sink = (H26xRTPSink *)clientData;
+		if (sink->m_payloadSource != NULL)
+		{
+			sink->m_payloadSource->sendFailed();
+		}
+	}
+
+	virtual Boolean continuePlaying();
+	virtual void doSpecialFrameHandling(unsigned fragmentationOffset, unsigned char *frameStart, unsigned numBytesInFrame, struct timeval framePresentationTime, unsigned numRemainingBytes);
+	virtual Boolean frameCanAppearAfterPacketStart(unsigned char const *frameStart, unsigned numBytesInFrame) const;
+
+private:
+	int m_hNumber;
+	H26xPacketizer *m_packetizer;
+	// the payloader or the source itself
+	H26xPayloadSource *m_payloadSource;
+};
@@ -13,6 +13,8 @@
 
 // project
 #include "V4L2DeviceSource.h"
+#include "StartCodeScanner.h"
+#include "ParameterSetCache.h"
 
 // ---------------------------------
 // H264 V4L2 FramedSource
@@ -20,20 +22,50 @@
 const char H264marker[] = {0, 0, 0, 1};
 const char H264shortmarker[] = {0, 0, 1};
 
+// user_data_unregistered SEI of the capture time: this UUID, then the
+// microseconds since the Unix epoch on 64 bits, big endian
+const unsigned char CaptureTimeUUID[16] = {0x9a, 0x21, 0xf3, 0xbe, 0x31, 0xf0, 0x4b, 0x78, 0xb0, 0xbe, 0xc7, 0xf7, 0xdb, 0xb9, 0x72, 0x36};
+
 class H26X_V4L2DeviceSource : public V4L2DeviceSource
 {
+public:
+	// Put a SEI with the capture time in each access unit
+	void setCaptureTimeSei(bool captureTimeSei) { m_captureTimeSei.store(captureTimeSei); }
+
 protected:
 	H26X_V4L2DeviceSource(UsageEnvironment &env, DeviceInterface *device, int outputFd, unsigned int queueSize, CaptureMode captureMode, bool repeatConfig, bool keepMarker)
-		: V4L2DeviceSource(env, device, outputFd, queueSize, captureMode), m_repeatConfig(repeatConfig), m_keepMarker(keepMarker) {}
+		: V4L2DeviceSource(env, device, outputFd, queueSize, captureMode), m_repeatConfig(repeatConfig), m_keepMarker(keepMarker), m_captureSeiIndex(0)
+	{
+		m_captureTimeSei.store(false);
+	}
 
 	virtual ~H26X_V4L2DeviceSource() {}
 
-	unsigned char *extractFrame(unsigned char *frame, size_t &size, size_t &outsize, int &frameType);
+	// overide V4L2DeviceSource
+	virtual void addCaptureTime(std::list<std::pair<unsigned char *, size_t>> &frameList, const timeval &ref);
+	virtual std::shared_ptr<const void> holdParameterSets() { return m_paramSets.hold(); }
+	// SEI NAL unit header of the codec
+	virtual std::string getSeiHeader() = 0;
+	// NAL units that have to stay in front of a SEI (delimiter, parameter sets)
+	virtual bool precedesSei(const unsigned char *frame, size_t size) = 0;
+
+	// m_markerSize is 0 when start codes are stripped, the result is reused by the next call
+	const std::vector<StartCodeScanner::NalUnit> &extractFrames(unsigned char *frame, size_t size);
 	std::string getFrameWithMarker(const std::string &frame);
+	// NAL header of a frame from splitFrames, with or without start code
+	const unsigned char *getNalHeader(const unsigned char *frame, size_t size, size_t headerSize);
+	// cached parameter set without its start code, base64 encoded
+	std::string getBase64(ParameterSetCache::Slot slot);
 
 protected:
-	std::string m_sps;
-	std::string m_pps;
+	// capture thread only
+	ParameterSetCache m_paramSets;
 	bool m_repeatConfig;
 	bool m_keepMarker;
+	// capture thread only
+	std::vector<StartCodeScanner::NalUnit> m_nalUnits;
+	std::atomic<bool> m_captureTimeSei;
+	// capture time SEI of the queued access units, capture thread only
+	std::vector<std::string> m_captureSei;
+	unsigned int m_captureSeiIndex;
 };
@@ -14,6 +14,7 @@
 #pragma once
 
 #include <list>
+#include <memory>
 
 // hacking private members RTSPServer::fWeServeSRTP & RTSPServer::fWeEncryptSRTP
 #define private protected
@@ -159,9 +160,10 @@ class HTTPServer : public RTSPServer
 		virtual ~HTTPClientConnection();
 
 	private:
-		void sendHeader(const char *contentType, unsigned int contentLength);
+		void sendHeader(const char *contentType, unsigned int contentLength, const char *status = "200 OK");
 		void streamSource(FramedSource *source);
 		void streamSource(const std::string &content);
+		void streamSource(const std::shared_ptr<const std::string> &content);
 		ServerMediaSubsession *getSubsesion(const char *urlSuffix);
 		bool sendFile(char const *urlSuffix);
 		bool sendM3u8PlayList(char const *urlSuffix);
@@ -176,6 +178,8 @@ class HTTPServer : public RTSPServer
 		void *m_StreamToken;
 		ServerMediaSubsession *m_Subsession;
 		FramedSource *m_Source;
+		// shared content read in place by m_Source
+		std::shared_ptr<const std::string> m_Content;
 	};
 
 	class HTTPClientSession : public RTSPServer::RTSPClientSession
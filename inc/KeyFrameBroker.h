@@ -0,0 +1,69 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** KeyFrameBroker.h
+**
+** Coalesce and rate-limit key frame requests of one stream
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <string>
+#include <mutex>
+
+#include "DeviceInterface.h"
+
+// ---------------------------------
+// Key frame broker
+//
+// Requests come from the live555 thread (PLAY, RTCP feedback, HLS segments)
+// and from the capture thread (queue recovery). The device is asked at most
+// once per interval: requests made while a key frame is on its way are served
+// by it, those made after it went out are deferred to the end of the interval
+// unless the encoder produces a key frame meanwhile.
+// ---------------------------------
+class KeyFrameBroker
+{
+public:
+	enum Reason
+	{
+		REASON_JOIN = 0, // new PLAY session
+		REASON_FEEDBACK, // RTCP PLI/FIR
+		REASON_SEGMENT,  // HLS segment boundary
+		REASON_RECOVERY, // frames dropped from the capture queue
+		REASON_SNAPSHOT, // snapshot read while key frames were not kept
+		REASON_COUNT
+	};
+
+	KeyFrameBroker(DeviceInterface *device, unsigned int intervalMs = 1000);
+
+	KeyFrameBroker(const KeyFrameBroker &) = delete;
+	KeyFrameBroker &operator=(const KeyFrameBroker &) = delete;
+
+	// true if the device was asked for a key frame
+	bool request(Reason reason);
+	// capture thread, once per access unit: issues deferred requests
+	void notifyFrame(bool keyFrame);
+
+	void setInterval(unsigned int ms);
+	std::string toJSON();
+
+protected:
+	bool send(unsigned long long now);
+
+protected:
+	DeviceInterface *m_device;
+	std::mutex m_mutex;
+	unsigned long long m_interval;
+	unsigned long long m_lastSent;
+	// a key frame came out since the last request sent
+	bool m_served;
+	bool m_deferred;
+	unsigned long m_requests[REASON_COUNT];
+	unsigned long m_sent;
+	unsigned long m_coalesced;
+	unsigned long m_keyFrames;
+};
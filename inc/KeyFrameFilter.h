@@ -0,0 +1,72 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** KeyFrameFilter.h
+**
+** Pass-through filter keeping only the key frames of a replica
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "V4L2DeviceSource.h"
+
+// ---------------------------------
+// Key frame filter
+//
+// Sits between a stream replica and the framer. Parameter sets and key frame
+// NAL units go through with their presentation time, anything else is
+// dropped, so the RTP timestamps stay those of the full stream.
+// ---------------------------------
+class KeyFrameFilter : public FramedFilter, public AccessUnitSource
+{
+public:
+	static KeyFrameFilter *createNew(UsageEnvironment &env, FramedSource *inputSource, V4L2DeviceSource *source)
+	{
+		return new KeyFrameFilter(env, inputSource, source);
+	}
+
+protected:
+	KeyFrameFilter(UsageEnvironment &env, FramedSource *inputSource, V4L2DeviceSource *source)
+		: FramedFilter(env, inputSource), m_source(source), m_endsAccessUnit(false) {}
+
+public:
+	virtual bool lastFrameEndsAccessUnit() const { return m_endsAccessUnit; }
+	virtual unsigned int maxFrameSize() const { return m_source->maxFrameSize(); }
+
+private:
+	static void afterGettingFrame(void *clientData, unsigned frameSize,
+								  unsigned numTruncatedBytes,
+								  struct timeval presentationTime,
+								  unsigned durationInMicroseconds)
+	{
+		KeyFrameFilter *filter = (KeyFrameFilter *)clientData;
+		filter->afterGettingFrame(frameSize, numTruncatedBytes, presentationTime, durationInMicroseconds);
+	}
+
+	void afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime, unsigned durationInMicroseconds)
+	{
+		V4L2DeviceSource::FrameClass frameClass = m_source->classifyFrame(fTo, frameSize);
+		if ((frameClass != V4L2DeviceSource::FRAME_KEY) && (frameClass != V4L2DeviceSource::FRAME_PARAMSET))
+		{
+			this->doGetNextFrame();
+			return;
+		}
+		fFrameSize = frameSize;
+		fNumTruncatedBytes = numTruncatedBytes;
+		fPresentationTime = presentationTime;
+		fDurationInMicroseconds = durationInMicroseconds;
+		m_endsAccessUnit = m_source->lastFrameEndsAccessUnit();
+		afterGetting(this);
+	}
+
+	virtual void doGetNextFrame()
+	{
+		fInputSource->getNextFrame(fTo, fMaxSize, afterGettingFrame, this, handleClosure, this);
+	}
+
+	V4L2DeviceSource *m_source;
+	bool m_endsAccessUnit;
+};
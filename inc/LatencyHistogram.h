@@ -0,0 +1,121 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** LatencyHistogram.h
+**
+** Log2 latency histogram
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <time.h>
+
+#include <atomic>
+#include <string>
+#include <sstream>
+
+// ---------------------------------
+// Latency histogram
+//
+// Bucket i counts durations in [2^(i-1), 2^i) microseconds, so percentiles
+// are reported as the upper bound of their bucket. There is a single writer
+// per histogram: plain atomic loads and stores are enough and stay cheap on
+// ARMv5, which has no native read-modify-write. Readers may run on any thread.
+// ---------------------------------
+class LatencyHistogram
+{
+public:
+	static const unsigned int BUCKETS = 26;
+
+	LatencyHistogram() : m_count(0), m_max(0)
+	{
+		for (unsigned int i = 0; i < BUCKETS; ++i)
+		{
+			m_buckets[i].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	LatencyHistogram(const LatencyHistogram &) = delete;
+	LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+	// monotonic time in microseconds
+	static unsigned long long now()
+	{
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+	}
+
+	// writer side
+	void add(unsigned long us)
+	{
+		unsigned int bucket = 0;
+		while ((bucket < BUCKETS - 1) && (us >> bucket))
+		{
+			bucket++;
+		}
+		m_buckets[bucket].store(m_buckets[bucket].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		m_count.store(m_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		if (us > m_max.load(std::memory_order_relaxed))
+		{
+			m_max.store(us, std::memory_order_relaxed);
+		}
+	}
+	void addSince(unsigned long long start)
+	{
+		unsigned long long end = now();
+		add((end > start) ? (unsigned long)(end - start) : 0);
+	}
+
+	// reader side
+	unsigned long getCount() const { return m_count.load(std::memory_order_relaxed); }
+	unsigned long getMax() const { return m_max.load(std::memory_order_relaxed); }
+	unsigned long getPercentile(unsigned int percent) const
+	{
+		unsigned long counts[BUCKETS];
+		unsigned long total = 0;
+		for (unsigned int i = 0; i < BUCKETS; ++i)
+		{
+			counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+			total += counts[i];
+		}
+		unsigned long value = 0;
+		if (total > 0)
+		{
+			unsigned long rank = (total * percent + 99) / 100;
+			unsigned long seen = 0;
+			unsigned int bucket = 0;
+			for (; bucket < BUCKETS - 1; ++bucket)
+			{
+				seen += counts[bucket];
+				if (seen >= rank)
+				{
+					break;
+				}
+			}
+			value = bucket ? ((1UL << bucket) - 1) : 0;
+			unsigned long max = getMax();
+			if ((value > max) || (bucket == BUCKETS - 1))
+			{
+				value = max;
+			}
+		}
+		return value;
+	}
+
+	// {"count":N,"p50":us,"p99":us,"max":us}
+	std::string toJSON() const
+	{
+		std::ostringstream os;
+		os << "{\"count\":" << getCount() << ",\"p50\":" << getPercentile(50) << ",\"p99\":" << getPercentile(99) << ",\"max\":" << getMax() << "}";
+		return os.str();
+	}
+
+protected:
+	std::atomic<unsigned long> m_buckets[BUCKETS];
+	std::atomic<unsigned long> m_count;
+	std::atomic<unsigned long> m_max;
+};
@@ -0,0 +1,77 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** LatencyProbe.h
+**
+** Pass-through filter timing the stages downstream of a replica
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "V4L2DeviceSource.h"
+#include "LatencyHistogram.h"
+
+// ---------------------------------
+// Latency probe
+//
+// Sits between a stream replica and the framer. Delivering a frame runs the
+// framer, the RTP packetizer and the first packet send synchronously: that
+// is the "framer" stage. The sink asks for the next frame once the remaining
+// packets have gone out from the event loop: that is the "send" stage.
+// ---------------------------------
+class LatencyProbe : public FramedFilter
+{
+public:
+	static LatencyProbe *createNew(UsageEnvironment &env, FramedSource *inputSource, V4L2DeviceSource *source)
+	{
+		return new LatencyProbe(env, inputSource, source);
+	}
+
+protected:
+	LatencyProbe(UsageEnvironment &env, FramedSource *inputSource, V4L2DeviceSource *source)
+		: FramedFilter(env, inputSource), m_source(source), m_delivered(0), m_requested(false) {}
+
+private:
+	static void afterGettingFrame(void *clientData, unsigned frameSize,
+								  unsigned numTruncatedBytes,
+								  struct timeval presentationTime,
+								  unsigned durationInMicroseconds)
+	{
+		LatencyProbe *probe = (LatencyProbe *)clientData;
+		probe->afterGettingFrame(frameSize, numTruncatedBytes, presentationTime, durationInMicroseconds);
+	}
+
+	void afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime, unsigned durationInMicroseconds)
+	{
+		fFrameSize = frameSize;
+		fNumTruncatedBytes = numTruncatedBytes;
+		fPresentationTime = presentationTime;
+		fDurationInMicroseconds = durationInMicroseconds;
+
+		unsigned long long start = LatencyHistogram::now();
+		m_requested = false;
+		afterGetting(this);
+		unsigned long long end = LatencyHistogram::now();
+		m_source->getLatency(V4L2DeviceSource::STAGE_FRAMER).add((unsigned long)(end - start));
+		// when the next frame was already requested nothing is left to send
+		m_delivered = m_requested ? 0 : end;
+	}
+
+	virtual void doGetNextFrame()
+	{
+		if (m_delivered != 0)
+		{
+			m_source->getLatency(V4L2DeviceSource::STAGE_SEND).addSince(m_delivered);
+		}
+		m_delivered = 0;
+		m_requested = true;
+		fInputSource->getNextFrame(fTo, fMaxSize, afterGettingFrame, this, handleClosure, this);
+	}
+
+	V4L2DeviceSource *m_source;
+	unsigned long long m_delivered;
+	bool m_requested;
+};
@@ -19,6 +19,9 @@
 class MemoryBufferSink : public MediaSink
 {
 public:
+	// called once a slice is due and no key frame came to start it, so that one comes soon
+	typedef void(SliceHandler)(void *clientData, unsigned int slice);
+
 	static MemoryBufferSink *createNew(UsageEnvironment &env, unsigned int bufferSize, unsigned int sliceDuration, unsigned int nbSlices = 5)
 	{
 		return new MemoryBufferSink(env, bufferSize, sliceDuration, nbSlices);
@@ -47,12 +50,31 @@ public:
 	unsigned int firstTime();
 	unsigned int duration();
 	unsigned int getSliceDuration() { return m_sliceDuration; }
+	void setSliceHandler(SliceHandler *handler, void *clientData)
+	{
+		m_sliceHandler = handler;
+		m_sliceHandlerData = clientData;
+	}
+	// a slice starts with the first key frame at or after its time, keyFrameHandler()
+	// is told before the data of each key frame comes
+	void setKeyFrameCut(bool keyFrameCut) { m_keyFrameCut = keyFrameCut; }
+	static void keyFrameHandler(void *clientData)
+	{
+		((MemoryBufferSink *)clientData)->m_keyFrame = true;
+	}
 
 private:
 	unsigned char *m_buffer;
 	unsigned int m_bufferSize;
 	std::map<unsigned int, std::string> m_outputBuffers;
-	unsigned int m_refTime;
 	unsigned int m_sliceDuration;
 	unsigned int m_nbSlices;
+	SliceHandler *m_sliceHandler;
+	void *m_sliceHandlerData;
+	// slice being filled and the time of its first data (us)
+	unsigned int m_slice;
+	unsigned long long m_sliceStart;
+	bool m_keyFrameCut;
+	bool m_keyFrame;
+	bool m_sliceRequested;
 };
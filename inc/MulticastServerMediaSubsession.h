@@ -32,10 +32,13 @@ protected:
 	virtual char const *sdpLines(int addressFamily);
 #endif
 	virtual char const *getAuxSDPLine(RTPSink *rtpSink, FramedSource *inputSource);
+	virtual void startStream(unsigned clientSessionId, void *streamToken, TaskFunc *rtcpRRHandler, void *rtcpRRHandlerClientData, unsigned short &rtpSeqNum, unsigned &rtpTimestamp, ServerRequestAlternativeByteHandler *serverRequestAlternativeByteHandler, void *serverRequestAlternativeByteHandlerClientData);
 	RTPSink *createRtpSink(UsageEnvironment &env, struct in_addr destinationAddress, Port rtpPortNum, Port rtcpPortNum, int ttl, StreamReplicator *replicator);
 
 protected:
 	RTPSink *m_rtpSink;
 	RTCPInstance *m_rtcpInstance;
 	std::map<int, std::string> m_SDPLines;
+	// aux line version each SDP was built from
+	std::map<int, unsigned int> m_SDPVersions;
 };
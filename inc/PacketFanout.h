@@ -0,0 +1,198 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** PacketFanout.h
+**
+** H264/H265 payloads packetized once and queued for each unicast client
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <sys/time.h>
+
+#include <deque>
+#include <list>
+#include <memory>
+#include <string>
+
+#include "V4L2DeviceSource.h"
+#include "H26xRTPSink.h"
+
+class PacketQueue;
+
+// ---------------------------------
+// Payloads shared by the unicast clients of a subsession
+//
+// The frames of the stream are framed and packetized once (H26xPacketizer,
+// with its pacing), each payload is kept once and handed to the queue of
+// every client. A client has its own RTP sink, so its own SSRC, sequence
+// numbers and timestamps, and takes the payloads from its queue at its own
+// pace.
+// The payloads are read as long as a client plays, the source is closed
+// with the last client.
+// ---------------------------------
+class PacketFanout
+{
+public:
+	struct Payload
+	{
+		std::string m_data;
+		struct timeval m_presentationTime;
+		unsigned long long m_departure;
+		bool m_endsAccessUnit;
+		bool m_endsBurst;
+		// key frame (or its first fragment), parameter set...
+		V4L2DeviceSource::FrameClass m_class;
+		// monotonic time it was packetized (us)
+		unsigned long long m_queued;
+	};
+
+	PacketFanout(UsageEnvironment &env, int hNumber, V4L2DeviceSource *deviceSource);
+	~PacketFanout();
+
+	// framed NAL units of the stream, owned from then on
+	void setSource(FramedSource *source);
+	bool hasSource() const { return m_source != NULL; }
+
+	// the payloader is built for the first sink
+	void configure(unsigned int maxPayloadSize, bool txTime);
+
+	void addClient(PacketQueue *client);
+	void removeClient(PacketQueue *client);
+	// a client waits for payloads
+	void start();
+
+protected:
+	static void readTask(void *clientData)
+	{
+		PacketFanout *fanout = (PacketFanout *)clientData;
+		fanout->m_readTask = NULL;
+		fanout->readNext();
+	}
+	void readNext();
+
+	static void afterGettingPayload(void *clientData, unsigned frameSize,
+									unsigned numTruncatedBytes,
+									struct timeval presentationTime,
+									unsigned durationInMicroseconds)
+	{
+		PacketFanout *fanout = (PacketFanout *)clientData;
+		fanout->afterGettingPayload(frameSize, presentationTime);
+	}
+	void afterGettingPayload(unsigned frameSize, struct timeval presentationTime);
+	static void onClosure(void *clientData);
+
+	bool playing() const;
+	V4L2DeviceSource::FrameClass classify(const unsigned char *payload, unsigned int size) const;
+	std::shared_ptr<Payload> newPayload();
+	void closeSource();
+
+private:
+	UsageEnvironment &m_env;
+	int m_hNumber;
+	V4L2DeviceSource *m_deviceSource;
+	FramedSource *m_source;
+	H26xPacketizer *m_packetizer;
+	std::list<PacketQueue *> m_clients;
+
+	std::string m_buffer;
+	bool m_reading;
+	TaskToken m_readTask;
+
+	// payloads recently handed out, reused once no client holds them
+	static const unsigned int MAX_SPARE = 256;
+	std::deque<std::shared_ptr<Payload>> m_payloads;
+};
+
+// ---------------------------------
+// Payloads waiting for the RTP sink of a client
+//
+// A client joins, and restarts after its queue overflowed, on a key frame;
+// the other payloads are dropped up to it.
+// A client interleaving RTP in its RTSP connection gets no payload while the
+// socket has no room for it: live555 would block the event loop, and so
+// every client, on a full TCP connection. The payloads wait here instead,
+// and a TCP send failing drops them up to the next key frame.
+// ---------------------------------
+class PacketQueue : public FramedSource, public H26xPayloadSource, public V4L2DeviceSource::Consumer
+{
+public:
+	static const unsigned int DEFAULT_MAX_BYTES = 1024 * 1024;
+
+	static PacketQueue *createNew(UsageEnvironment &env, PacketFanout *fanout, V4L2DeviceSource *source, const std::string &name, unsigned int maxBytes = DEFAULT_MAX_BYTES)
+	{
+		return new PacketQueue(env, fanout, source, name, maxBytes);
+	}
+
+	// a payload of the stream, dropped when the client does not play
+	void push(const std::shared_ptr<PacketFanout::Payload> &payload);
+	bool isPlaying() const { return m_active; }
+	// RTSP connection the packets are interleaved in, -1 for UDP
+	void setTcpSocket(int socket) { m_tcpSocket = socket; }
+
+	virtual bool lastPayloadEndsAccessUnit() const { return m_endsAccessUnit; }
+	virtual unsigned long long lastPayloadDeparture() const { return m_departure; }
+	virtual bool lastPayloadEndsBurst() const { return m_endsBurst; }
+	virtual void configure(unsigned int maxPayloadSize, bool txTime) { m_fanout->configure(maxPayloadSize, txTime); }
+	virtual void sendFailed();
+
+	// JSON object with the lag counters of this client
+	virtual std::string toJSON();
+
+protected:
+	PacketQueue(UsageEnvironment &env, PacketFanout *fanout, V4L2DeviceSource *source, const std::string &name, unsigned int maxBytes);
+	virtual ~PacketQueue();
+
+	virtual void doGetNextFrame();
+	virtual void doStopGettingFrames();
+
+	bool accept(const PacketFanout::Payload &payload);
+	// the TCP connection cannot take a payload without blocking
+	bool congested(unsigned int size);
+	void tryDeliver();
+	void deliver();
+	void clear();
+
+	static void retryTask(void *clientData)
+	{
+		PacketQueue *queue = (PacketQueue *)clientData;
+		queue->m_retryTask = NULL;
+		if (queue->isCurrentlyAwaitingData() && !queue->m_queue.empty())
+		{
+			queue->tryDeliver();
+		}
+	}
+
+private:
+	PacketFanout *m_fanout;
+	V4L2DeviceSource *m_source;
+	std::string m_name;
+	unsigned int m_maxBytes;
+
+	std::deque<std::shared_ptr<PacketFanout::Payload>> m_queue;
+	unsigned int m_queuedBytes;
+	bool m_active;
+	bool m_waitKeyFrame;
+	int m_tcpSocket;
+	TaskToken m_retryTask;
+
+	// flags of the last payload delivered
+	bool m_endsAccessUnit;
+	unsigned long long m_departure;
+	bool m_endsBurst;
+
+	unsigned long m_delivered;
+	unsigned long m_dropped;
+	unsigned long m_overflows;
+	// deliveries put off by a full TCP connection, failed sends
+	unsigned long m_congested;
+	unsigned long m_sendErrors;
+	unsigned int m_maxQueued;
+	unsigned long long m_maxLag;
+
+	// wait for room in the TCP connection (us)
+	static const unsigned int RETRY_DELAY = 5000;
+};
@@ -0,0 +1,58 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** ParameterSetCache.h
+**
+** H264/H265 parameter sets seen on the stream
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stddef.h>
+
+#include <memory>
+#include <string>
+
+// ---------------------------------
+// Parameter set cache
+//
+// Written by the capture thread only. A parameter set that repeats with the
+// same bytes, as in front of every IDR, is not copied and does not count as a
+// change. On change a new generation is started and the previous one is left
+// untouched. Generations are reference counted: frames still queued that point
+// into one keep it alive with hold(), however many changes came since.
+// ---------------------------------
+class ParameterSetCache
+{
+public:
+	enum Slot
+	{
+		SLOT_VPS = 0,
+		SLOT_SPS,
+		SLOT_PPS,
+		SLOT_COUNT
+	};
+
+	ParameterSetCache() : m_current(std::make_shared<Generation>()), m_changed(false) {}
+
+	// true if the bytes differ from the cached ones
+	bool update(Slot slot, const unsigned char *data, size_t size);
+	const std::string &get(Slot slot) const { return m_current->m_sets[slot]; }
+	bool has(Slot slot) const { return !m_current->m_sets[slot].empty(); }
+	// keeps the current generation, and the strings get() returns, alive
+	std::shared_ptr<const void> hold() const { return m_current; }
+	// true once after one or more updates changed the cache
+	bool takeChange();
+
+protected:
+	struct Generation
+	{
+		std::string m_sets[SLOT_COUNT];
+	};
+
+	std::shared_ptr<Generation> m_current;
+	bool m_changed;
+};
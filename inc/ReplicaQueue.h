@@ -0,0 +1,108 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** ReplicaQueue.h
+**
+** Bounded queue decoupling a consumer from the stream replicator
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <string>
+#include <deque>
+
+#include "V4L2DeviceSource.h"
+
+// ---------------------------------
+// Replica queue
+//
+// The live555 replicator reads the next frame only once every replica took
+// the current one, so the slowest consumer paces all the others. This filter
+// sits right after a replica (or its key frame / frame rate filter) and asks
+// for the next frame as soon as one arrives: frames the consumer is not
+// ready for wait here. When the queue is full it is emptied and the frames
+// are dropped up to the next key frame, so only this consumer loses them.
+// A frame arriving while the consumer waits on an empty queue is read
+// straight into its buffer.
+// ---------------------------------
+class ReplicaQueue : public FramedFilter, public AccessUnitSource, public V4L2DeviceSource::Consumer
+{
+public:
+	static const unsigned int DEFAULT_MAX_BYTES = 1024 * 1024;
+
+	static ReplicaQueue *createNew(UsageEnvironment &env, FramedSource *inputSource, V4L2DeviceSource *source, const std::string &name, unsigned int maxBytes = DEFAULT_MAX_BYTES)
+	{
+		return new ReplicaQueue(env, inputSource, source, name, maxBytes);
+	}
+
+	// JSON object with the lag counters of this consumer
+	virtual std::string toJSON();
+	virtual bool lastFrameEndsAccessUnit() const { return m_endsAccessUnit; }
+	virtual unsigned int maxFrameSize() const { return m_auSource ? m_auSource->maxFrameSize() : 0; }
+
+protected:
+	ReplicaQueue(UsageEnvironment &env, FramedSource *inputSource, V4L2DeviceSource *source, const std::string &name, unsigned int maxBytes);
+	virtual ~ReplicaQueue();
+
+	virtual void doGetNextFrame();
+	virtual void doStopGettingFrames();
+
+	static void afterGettingFrame(void *clientData, unsigned frameSize,
+								  unsigned numTruncatedBytes,
+								  struct timeval presentationTime,
+								  unsigned durationInMicroseconds)
+	{
+		ReplicaQueue *queue = (ReplicaQueue *)clientData;
+		queue->afterGettingFrame(frameSize, numTruncatedBytes, presentationTime, durationInMicroseconds);
+	}
+	void afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime, unsigned durationInMicroseconds);
+
+	void readNext();
+	bool accept(const unsigned char *frame, unsigned int frameSize);
+	void deliverQueued();
+	void recycle(std::string &data);
+
+private:
+	struct Frame
+	{
+		std::string m_data;
+		struct timeval m_presentationTime;
+		unsigned int m_duration;
+		unsigned int m_truncated;
+		bool m_endsAccessUnit;
+		// monotonic time it was queued (us)
+		unsigned long long m_queued;
+	};
+
+	V4L2DeviceSource *m_source;
+	// tells where the access units of the input end, the device source or a filter
+	AccessUnitSource *m_auSource;
+	std::string m_name;
+	unsigned int m_maxBytes;
+
+	std::deque<Frame> m_queue;
+	unsigned int m_queuedBytes;
+	// frame buffers of the delivered frames, reused for the next ones
+	static const unsigned int MAX_SPARE = 8;
+	std::deque<std::string> m_spare;
+
+	// frames read while the consumer is busy, allocated on first use
+	unsigned char *m_readBuffer;
+	unsigned int m_readBufferSize;
+	bool m_active;
+	bool m_reading;
+	bool m_readingDirect;
+	// overflowed, frames are dropped up to the next key frame
+	bool m_waitKeyFrame;
+	// for the last frame delivered
+	bool m_endsAccessUnit;
+
+	unsigned long m_delivered;
+	unsigned long m_dropped;
+	unsigned long m_overflows;
+	unsigned int m_maxQueued;
+	unsigned long long m_maxLag;
+};
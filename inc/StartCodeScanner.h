@@ -0,0 +1,45 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** StartCodeScanner.h
+**
+** Annex-B start code scanner
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stddef.h>
+
+#include <vector>
+
+// ---------------------------------
+// Annex-B start code scanner
+//
+// Finds every 00 00 01 / 00 00 00 01 of an access unit in a single forward
+// pass. The search uses AVX2 or SSE2 when the compiler targets them and a
+// word-at-a-time loop otherwise, which is what the ARMv5 SoC runs.
+// ---------------------------------
+class StartCodeScanner
+{
+public:
+	struct NalUnit
+	{
+		NalUnit(unsigned char *buffer, size_t size, unsigned int markerSize) : m_buffer(buffer), m_size(size), m_markerSize(markerSize) {};
+
+		// start code included
+		unsigned char *m_buffer;
+		size_t m_size;
+		// 3 or 4, the NAL header is at m_buffer[m_markerSize]
+		unsigned int m_markerSize;
+	};
+
+	// offset of the first 00 00 01 of the buffer, size if there is none
+	static size_t find(const unsigned char *data, size_t size);
+	// NAL units of the buffer, bytes before the first start code and empty units are skipped
+	static void scan(unsigned char *data, size_t size, std::vector<NalUnit> &nalUnits);
+	// name of the search loop compiled in
+	static const char *implementation();
+};
@@ -33,6 +33,8 @@ protected:
 	virtual void seekStream(unsigned clientSessionId, void *streamToken, double &seekNPT, double streamDuration, u_int64_t &numBytes);
 	virtual FramedSource *getStreamSource(void *streamToken);
 
+	static void sliceHandler(void *clientData, unsigned int /*slice*/) { ((TSServerMediaSubsession *)clientData)->requestKeyFrame(KeyFrameBroker::REASON_SEGMENT); }
+
 protected:
 	unsigned int m_slice;
 	MemoryBufferSink *m_hlsSink;
@@ -10,6 +10,8 @@
 #pragma once
 
 #include "BaseServerMediaSubsession.h"
+#include "BatchGroupsock.h"
+#include "PacketFanout.h"
 
 // -----------------------------------------
 //    ServerMediaSubsession for Unicast
@@ -17,13 +19,55 @@
 class UnicastServerMediaSubsession : public BaseServerMediaSubsession, public OnDemandServerMediaSubsession
 {
 public:
-	static UnicastServerMediaSubsession *createNew(UsageEnvironment &env, StreamReplicator *replicator);
+	// keyFramesOnly: parameter sets and key frames of the replica only
+	// fps: disposable pictures of the replica dropped down to this rate (0 keeps all)
+	// Each client has its own RTP sink. H264/H265 frames are packetized once
+	// for all the clients (PacketFanout), each client takes the payloads from
+	// its own queue; other formats get a source per client.
+	static UnicastServerMediaSubsession *createNew(UsageEnvironment &env, StreamReplicator *replicator, bool keyFramesOnly = false, unsigned int fps = 0);
+
+#if LIVEMEDIA_LIBRARY_VERSION_INT >= 1642723200
+	// JSON object with the UDP send counters of the subsession
+	std::string getSendStats() const { return m_sendStats.toJSON(); }
+#endif
 
 protected:
-	UnicastServerMediaSubsession(UsageEnvironment &env, StreamReplicator *replicator)
-		: BaseServerMediaSubsession(replicator), OnDemandServerMediaSubsession(env, False) {}
+	UnicastServerMediaSubsession(UsageEnvironment &env, StreamReplicator *replicator, bool keyFramesOnly = false, unsigned int fps = 0, bool reuseFirstSource = false)
+		: BaseServerMediaSubsession(replicator), OnDemandServerMediaSubsession(env, reuseFirstSource), m_SDPVersion(0), m_keyFramesOnly(keyFramesOnly), m_fps(fps), m_fanout(NULL), m_clients(0), m_tcpSocket(-1) {}
+	virtual ~UnicastServerMediaSubsession();
+
+	// name of the queues in the stats
+	std::string getName() const;
+	// replica of the stream up to the framer
+	FramedSource *createReplicaSource();
+
+#if LIVEMEDIA_LIBRARY_VERSION_INT < 1610928000
+	virtual char const *sdpLines();
+#else
+	virtual char const *sdpLines(int addressFamily);
+#endif
 
 	virtual FramedSource *createNewStreamSource(unsigned clientSessionId, unsigned &estBitrate);
 	virtual RTPSink *createNewRTPSink(Groupsock *rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic, FramedSource *inputSource);
 	virtual char const *getAuxSDPLine(RTPSink *rtpSink, FramedSource *inputSource);
+	virtual void startStream(unsigned clientSessionId, void *streamToken, TaskFunc *rtcpRRHandler, void *rtcpRRHandlerClientData, unsigned short &rtpSeqNum, unsigned &rtpTimestamp, ServerRequestAlternativeByteHandler *serverRequestAlternativeByteHandler, void *serverRequestAlternativeByteHandlerClientData);
+#if LIVEMEDIA_LIBRARY_VERSION_INT >= 1642723200
+	virtual void getStreamParameters(unsigned clientSessionId, struct sockaddr_storage const &clientAddress, Port const &clientRTPPort, Port const &clientRTCPPort, int tcpSocketNum, unsigned char rtpChannelId, unsigned char rtcpChannelId, TLSState *tlsState, struct sockaddr_storage &destinationAddress, u_int8_t &destinationTTL, Boolean &isMulticast, Port &serverRTPPort, Port &serverRTCPPort, void *&streamToken);
+	virtual Groupsock *createGroupsock(struct sockaddr_storage const &addr, Port port);
+	virtual RTCPInstance *createRTCP(Groupsock *RTCPgs, unsigned totSessionBW, unsigned char const *cname, RTPSink *sink);
+#endif
+
+protected:
+	// aux line version the SDP was built from
+	unsigned int m_SDPVersion;
+	bool m_keyFramesOnly;
+	unsigned int m_fps;
+	// H264/H265 payloads of the clients
+	PacketFanout *m_fanout;
+	unsigned int m_clients;
+	// RTSP connection of the client being set up, -1 for UDP
+	int m_tcpSocket;
+#if LIVEMEDIA_LIBRARY_VERSION_INT >= 1642723200
+	BatchGroupsock::Stats m_sendStats;
+#endif
 };
@@ -13,37 +13,194 @@
 
 #include <string>
 #include <list>
+#include <vector>
 #include <iostream>
 #include <iomanip>
 #include <mutex>
 #include <atomic>
 #include <thread>
+#include <memory>
 
 // live555
 #include <liveMedia.hh>
 
 #include "DeviceInterface.h"
+#include "FramePool.h"
+#include "CaptureQueue.h"
+#include "LatencyHistogram.h"
+#include "KeyFrameBroker.h"
+
+// ---------------------------------
+// Source telling where the access units end
+//
+// A NAL unit source does not say which NAL unit is the last of a frame,
+// the payloader would have to wait for the next one to know. The capture
+// knows it, and each filter holding or reordering NAL units tells it for
+// the ones it delivers.
+// ---------------------------------
+class AccessUnitSource
+{
+public:
+	virtual ~AccessUnitSource() {}
+	// the last NAL unit delivered is the last one of its access unit
+	virtual bool lastFrameEndsAccessUnit() const = 0;
+	// size of the largest NAL unit it delivers, 0 if not known
+	virtual unsigned int maxFrameSize() const = 0;
+
+	// first source of a chain of filters telling it, NULL if none
+	static AccessUnitSource *find(FramedSource *source)
+	{
+		while (source != NULL)
+		{
+			AccessUnitSource *auSource = dynamic_cast<AccessUnitSource *>(source);
+			if (auSource != NULL)
+			{
+				return auSource;
+			}
+			FramedFilter *filter = dynamic_cast<FramedFilter *>(source);
+			source = (filter != NULL) ? filter->inputSource() : NULL;
+		}
+		return NULL;
+	}
+};
 
 // -----------------------------------------
 //    Video Device Source
 // -----------------------------------------
-class V4L2DeviceSource : public FramedSource
+class V4L2DeviceSource : public FramedSource, public AccessUnitSource
 {
 public:
 	// ---------------------------------
-	// Captured frame
+	// Frame dependency class, ordered so that the class of an access unit
+	// is the highest class of its NAL units
 	// ---------------------------------
-	struct Frame
+	enum FrameClass
 	{
-		Frame(char *buffer, int size, timeval timestamp, char *allocatedBuffer = NULL) : m_buffer(buffer), m_size(size), m_timestamp(timestamp), m_allocatedBuffer(allocatedBuffer) {};
-		Frame(const Frame &);
-		Frame &operator=(const Frame &);
-		~Frame() { delete[] m_allocatedBuffer; };
+		FRAME_INDEPENDENT = 0, // no inter-frame dependency (MJPEG, raw...)
+		FRAME_DISPOSABLE,      // nothing refers to it (non-reference slice, SEI...)
+		FRAME_REFERENCE,       // referenced by following frames
+		FRAME_PARAMSET,        // SPS/PPS/VPS
+		FRAME_KEY              // IDR/IRAP, starts a new chain
+	};
 
-		char *m_buffer;
+	// ---------------------------------
+	// Latency stages from capture to socket
+	// ---------------------------------
+	enum LatencyStage
+	{
+		STAGE_READ = 0, // device read
+		STAGE_QUEUE,    // capture queue wait
+		STAGE_COPY,     // copy to the sink buffer in deliverFrame
+		STAGE_FRAMER,   // framer, packetizer and first packet (see LatencyProbe)
+		STAGE_SEND,     // remaining packets of the frame
+		STAGE_COUNT
+	};
+
+	// ---------------------------------
+	// Captured access unit
+	//
+	// One capture buffer and the NAL units split from it, which point into it
+	// or into the cached parameter sets. Plain descriptor stored by value in
+	// the capture queue; whoever takes it out of the queue calls release()
+	// once, which gives the buffer back for all its NAL units together. The
+	// capture thread hands the ones it drops to the live555 thread instead,
+	// which may still be copying from them.
+	// ---------------------------------
+	struct AccessUnit
+	{
+		// NAL unit table held inline; an access unit with more NAL units is
+		// queued as several entries and only the last one owns the buffer
+		static const unsigned int MAX_NALS = 16;
+
+		struct Nal
+		{
+			char *m_buffer;
+			unsigned int m_size;
+		};
+
+		AccessUnit() : m_count(0), m_size(0), m_allocatedBuffer(NULL), m_owner(NULL), m_hold(NULL), m_class(FRAME_INDEPENDENT), m_continued(false), m_followed(false), m_queued(0) { m_timestamp.tv_sec = 0; m_timestamp.tv_usec = 0; };
+		AccessUnit(timeval timestamp, FrameClass auClass) : m_count(0), m_size(0), m_timestamp(timestamp), m_allocatedBuffer(NULL), m_owner(NULL), m_hold(NULL), m_class(auClass), m_continued(false), m_followed(false), m_queued(0) {};
+		bool append(char *buffer, unsigned int size)
+		{
+			if (m_count >= MAX_NALS)
+				return false;
+			m_nals[m_count].m_buffer = buffer;
+			m_nals[m_count].m_size = size;
+			m_count++;
+			m_size += size;
+			return true;
+		};
+		// decodable without the access units before it
+		bool isKeyFrame() const { return !m_continued && ((m_class == FRAME_KEY) || (m_class == FRAME_INDEPENDENT)); };
+		void release()
+		{
+			if (m_owner)
+				m_owner->release(m_allocatedBuffer);
+			else
+				delete[] m_allocatedBuffer;
+			m_allocatedBuffer = NULL;
+			delete m_hold;
+			m_hold = NULL;
+		};
+
+		Nal m_nals[MAX_NALS];
+		unsigned int m_count;
+		// bytes of all NAL units
 		unsigned int m_size;
 		timeval m_timestamp;
 		char *m_allocatedBuffer;
+		// pool or device the buffer goes back to, heap if NULL
+		FrameReleaser *m_owner;
+		// what else its NAL units point into (parameter sets, or the key frame
+		// keeping the buffer), released with it; a plain pointer so that the
+		// entry stays a flat copy in the queue
+		std::shared_ptr<const void> *m_hold;
+		// highest class of its NAL units
+		FrameClass m_class;
+		// rest of the previous entry
+		bool m_continued;
+		// the rest is in the next entry
+		bool m_followed;
+		// monotonic time it was queued (us)
+		unsigned long long m_queued;
+	};
+
+	// ---------------------------------
+	// Last key frame, for snapshots
+	//
+	// The parts of the image in order: start codes, cached parameter sets and
+	// the NAL units of the key frame in its capture buffer. The buffer and the
+	// parameter set generation are held, not copied; a buffer lent by the
+	// device has to go back to it, so those parts are copied instead. The
+	// image is built on the first read, by the live555 thread.
+	// ---------------------------------
+	class KeyFrame
+	{
+	public:
+		KeyFrame() : m_buffer(NULL), m_owner(NULL) {}
+		~KeyFrame()
+		{
+			if (m_owner)
+				m_owner->release(m_buffer);
+		}
+
+		KeyFrame(const KeyFrame &) = delete;
+		KeyFrame &operator=(const KeyFrame &) = delete;
+
+		void add(const void *data, size_t size) { m_parts.push_back(std::pair<const char *, size_t>((const char *)data, size)); }
+		// take over the capture buffer the parts point into
+		void keep(char *buffer, FrameReleaser *owner, const std::shared_ptr<const void> &paramSets);
+		// copy the parts that point into the capture buffer
+		void copy(const char *buffer, size_t size, const std::shared_ptr<const void> &paramSets);
+		std::shared_ptr<const std::string> image();
+
+	protected:
+		std::vector<std::pair<const char *, size_t>> m_parts;
+		char *m_buffer;
+		FrameReleaser *m_owner;
+		std::shared_ptr<const void> m_paramSets;
+		std::string m_copy;
+		std::shared_ptr<const std::string> m_image;
 	};
 
 	// ---------------------------------
@@ -64,6 +221,29 @@ public:
 		const std::string m_msg;
 	};
 
+	// ---------------------------------
+	// Gives frames borrowed from the device back to it
+	// ---------------------------------
+	class DeviceReleaser : public FrameReleaser
+	{
+	public:
+		DeviceReleaser(V4L2DeviceSource &source) : m_source(source) {};
+		virtual void release(char *buffer);
+
+	protected:
+		V4L2DeviceSource &m_source;
+	};
+
+	// ---------------------------------
+	// Consumer of the stream reporting its counters in the stats
+	// ---------------------------------
+	class Consumer
+	{
+	public:
+		virtual ~Consumer() {};
+		virtual std::string toJSON() = 0;
+	};
+
 	// ---------------------------------
 	// Capture Mode
 	// ---------------------------------
@@ -81,18 +261,38 @@ public:
 		std::lock_guard<std::mutex> lock(m_auxMutex);
 		return m_auxLine;
 	}
-	std::string getLastFrame()
-	{
-		std::lock_guard<std::mutex> lock(m_lastFrameMutex);
-		std::string frame(m_lastFrame);
-		return frame;
-	}
+	// bumped each time the aux SDP line changes, SDP built with an older version is stale
+	unsigned int getAuxLineVersion() { return m_auxVersion.load(); }
+	// last key frame, with its parameter sets for H264/H265, shared with the readers; live555 thread
+	std::shared_ptr<const std::string> getLastFrame();
 	DeviceInterface *getDevice() { return m_device; }
-	void postFrame(char *frame, int frameSize, const timeval &ref);
+	void postFrame(char *frame, int frameSize, const timeval &ref, FrameReleaser *owner = NULL);
 	virtual std::list<std::string> getInitFrames() { return std::list<std::string>(); }
 	virtual bool isKeyFrame(const char *, int) { return false; }
+	// dependency class of one frame as returned by splitFrames
+	virtual FrameClass classifyFrame(const unsigned char *, size_t) { return FRAME_INDEPENDENT; }
+	// frame carrying picture data (a VCL NAL unit), not SEI, delimiter or parameter set
+	virtual bool isPicture(const unsigned char *, size_t) { return true; }
 	// Ask the capture thread (if any) to stop; used on shutdown to exit promptly
 	void requestStop() { m_stop.store(true); }
+	// JSON object with runtime counters of this source
+	virtual std::string getStats();
+	// Skip frames older than this many ms, up to the newest key frame (0 disables)
+	void setLatencyBudget(unsigned int ms) { m_latencyBudget.store(ms); }
+	unsigned int getLatencyBudget() { return m_latencyBudget.load(); }
+	// Spread the packets of a frame over this share of the frame interval (0 disables).
+	// The window of each NAL unit is given as its duration, which only the H264/H265
+	// RTP sink understands: other sinks would take it as the frame duration.
+	void setPacing(unsigned int percent) { m_pacing.store(percent > 100 ? 100 : percent); }
+	LatencyHistogram &getLatency(LatencyStage stage) { return m_latency[stage]; }
+	// Ask the encoder for a key frame, coalesced with the other requests of the stream
+	bool requestKeyFrame(KeyFrameBroker::Reason reason) { return m_keyFrames.request(reason); }
+	// live555 thread only, like getStats
+	void addConsumer(Consumer *consumer) { m_consumers.push_back(consumer); }
+	void removeConsumer(Consumer *consumer) { m_consumers.remove(consumer); }
+	// live555 thread, after a delivery
+	virtual bool lastFrameEndsAccessUnit() const { return m_lastEndsAccessUnit; }
+	virtual unsigned int maxFrameSize() const { return m_device->getMaxFrameSize(); }
 
 protected:
 	V4L2DeviceSource(UsageEnvironment &env, DeviceInterface *device, int outputFd, unsigned int queueSize, CaptureMode captureMode);
@@ -100,37 +300,99 @@ protected:
 
 protected:
 	virtual void *thread();
-	static void deliverFrameStub(void *clientData) { ((V4L2DeviceSource *)clientData)->deliverFrame(); };
+	static void deliverFrameStub(void *clientData) { ((V4L2DeviceSource *)clientData)->releaseDropped(); ((V4L2DeviceSource *)clientData)->deliverFrame(); };
 	void deliverFrame();
 	static void incomingPacketHandlerStub(void *clientData, int /*mask*/) { ((V4L2DeviceSource *)clientData)->incomingPacketHandler(); };
 	void incomingPacketHandler();
 	int getNextFrame();
-	void processFrame(char *frame, int frameSize, const timeval &ref);
-	void queueFrame(char *frame, int frameSize, const timeval &tv, char *allocatedBuffer = NULL);
+	void processFrame(char *frame, int frameSize, const timeval &ref, FrameReleaser *owner);
+	void queueAccessUnit(const AccessUnit &au);
+	void evictAccessUnit();
+	void flushQueue();
+	// dropped by the capture thread, released by the live555 thread
+	void deferRelease(AccessUnit &au);
+	void releaseDropped();
+	void skipStaleFrames();
+	void setAuxLine(const std::string &auxLine);
+	// key frame of the access unit being split, splitFrames() adds its parts; capture thread
+	KeyFrame &startKeyFrame();
+	// publish it once the access unit is queued, which then holds it instead of the buffer
+	std::shared_ptr<const void> keepKeyFrame(AccessUnit &au, char *frame, int frameSize, FrameReleaser *owner);
 
 	// split packet in frames
 	virtual std::list<std::pair<unsigned char *, size_t>> splitFrames(unsigned char *frame, unsigned frameSize);
+	// optional NAL units carrying the capture time, added to an access unit about to be queued
+	virtual void addCaptureTime(std::list<std::pair<unsigned char *, size_t>> &, const timeval &) {}
+	// cached parameter sets to put in front of a key frame that has none
+	virtual std::list<std::pair<unsigned char *, size_t>> getParameterSets() { return std::list<std::pair<unsigned char *, size_t>>(); }
+	// keeps the cached parameter sets the NAL units of a queued frame point to
+	virtual std::shared_ptr<const void> holdParameterSets() { return std::shared_ptr<const void>(); }
 
 	// overide FramedSource
 	virtual void doGetNextFrame();
 
 protected:
-	std::list<Frame *> m_captureQueue;
+	CaptureQueue<AccessUnit> m_captureQueue;
 	Stats m_in;
 	Stats m_out;
 	EventTriggerId m_eventTriggerId;
 	int m_outfd;
 	DeviceInterface *m_device;
 	unsigned int m_queueSize;
+	// Capture buffers, sized from the queue depth and the device frame size
+	FramePool *m_pool;
+	// Frames lent by the device (zero-copy capture); at most one is out at a time
+	DeviceReleaser m_deviceReleaser;
+	std::atomic<bool> m_borrowed;
+	// last NAL unit delivered (monotonic us): frames are borrowed only while it is recent
+	std::atomic<unsigned long long> m_lastDelivery;
+	// frames lent by the device, and the ones copied since the queue was not empty
+	std::atomic<unsigned long> m_borrowedFrames;
+	std::atomic<unsigned long> m_copiedFrames;
 	std::thread m_thread;
-	std::mutex m_mutex;
 	// Aux SDP data (e.g., H264 sprop-parameter-sets). Guarded by m_auxMutex.
 	std::string m_auxLine;
 	std::mutex m_auxMutex;
+	std::atomic<unsigned int> m_auxVersion;
 	std::mutex m_lastFrameMutex;
-	std::string m_lastFrame;
+	std::shared_ptr<KeyFrame> m_lastKeyFrame;
+	// capture thread only
+	std::shared_ptr<KeyFrame> m_pendingKeyFrame;
+	// last snapshot read (monotonic us): lent buffers are copied only for recent readers
+	std::atomic<unsigned long long> m_snapshotRead;
 	std::atomic<bool> m_stop;
+	// access units dropped on the capture side, waiting for the live555 thread
+	std::mutex m_droppedMutex;
+	std::vector<AccessUnit> m_droppedUnits;
+	// the list being released, kept for its capacity, live555 thread only
+	std::vector<AccessUnit> m_releasing;
+	// Drop policy state, capture side only
+	bool m_waitKeyFrame;
+	std::atomic<unsigned long> m_dropped;
+	std::atomic<unsigned long> m_flushes;
+	KeyFrameBroker m_keyFrames;
+	// Latency budget, checked on delivery
+	std::atomic<unsigned int> m_latencyBudget;
+	// Pacing window, percent of the frame interval
+	std::atomic<unsigned int> m_pacing;
+	std::atomic<bool> m_keyFrameWanted;
+	unsigned long m_skipped;
+	unsigned long m_skips;
+	int m_lastLatency;
+	LatencyHistogram m_latency[STAGE_COUNT];
+	// access unit being delivered and its next NAL unit, live555 thread only
+	unsigned int m_deliveryTicket;
+	unsigned int m_deliveryIndex;
+	bool m_lastEndsAccessUnit;
+	// Capture thread wakeups, and those that found no frame
+	std::atomic<unsigned long> m_wakeups;
+	std::atomic<unsigned long> m_idleWakeups;
+	std::atomic<unsigned long> m_timeouts;
+	// Replica queues of the stream, live555 thread only
+	std::list<Consumer *> m_consumers;
 	// For proper frame rate timing with presentation timestamps
 	timeval m_lastPresentationTime;
+	// last interval between two access units (us)
+	unsigned long m_frameInterval;
 	bool m_firstFrame;
 };
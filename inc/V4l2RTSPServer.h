@@ -121,6 +121,22 @@ public:
         return this->addSession(url, subSession);
     }
 
+    // -----------------------------------------
+    //    Add key frame only Session (H264/H265)
+    // -----------------------------------------
+    ServerMediaSession *AddKeyFrameSession(const std::string &url, StreamReplicator *videoReplicator)
+    {
+        return this->addVariantSession(url, videoReplicator, true, 0);
+    }
+
+    // -----------------------------------------
+    //    Add reduced frame rate Session (H264/H265)
+    // -----------------------------------------
+    ServerMediaSession *AddFrameRateSession(const std::string &url, StreamReplicator *videoReplicator, unsigned int fps)
+    {
+        return this->addVariantSession(url, videoReplicator, false, fps);
+    }
+
     // -----------------------------------------
     //    Add HLS & MPEG# Session
     // -----------------------------------------
@@ -268,6 +284,26 @@ public:
     }
 
 protected:
+    // session filtering the NAL units of a replicator, only for formats where they can be classified
+    ServerMediaSession *addVariantSession(const std::string &url, StreamReplicator *videoReplicator, bool keyFramesOnly, unsigned int fps)
+    {
+        ServerMediaSession *sms = NULL;
+        if (videoReplicator)
+        {
+            UnicastServerMediaSubsession *subSession = UnicastServerMediaSubsession::createNew(*this->env(), videoReplicator, keyFramesOnly, fps);
+            std::string format = subSession->getFormat();
+            if ((format == "video/H264") || (format == "video/H265"))
+            {
+                sms = this->addSession(url, subSession);
+            }
+            else
+            {
+                Medium::close(subSession);
+            }
+        }
+        return sms;
+    }
+
     ServerMediaSession *addSession(const std::string &sessionName, ServerMediaSubsession *subSession)
     {
         std::list<ServerMediaSubsession *> subSessionList;
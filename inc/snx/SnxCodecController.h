@@ -29,6 +29,23 @@ public:
         DeviceConfig() : powerLineFreq(60) {}
     };
 
+    // How a reconfigure() changed each parameter
+    enum ChangeResult { Unchanged, Live, Restart, Failed };
+    struct ChangeReport {
+        ChangeResult bitrate;
+        ChangeResult fps;
+        ChangeResult gop;
+        ChangeReport() : bitrate(Unchanged), fps(Unchanged), gop(Unchanged) {}
+    };
+    // Last request queued by reconfigure() and the outcome of the last one applied
+    struct ChangeStatus {
+        bool pending;
+        bool applied;
+        StreamParams requested;
+        ChangeReport report;
+        ChangeStatus() : pending(false), applied(false) {}
+    };
+
     SnxCodecController();
     ~SnxCodecController();
 
@@ -40,11 +57,30 @@ public:
 
     bool isRunning() const;
 
+    // Lend the next access unit read by the pump thread, false if none is ready.
+    // data points into the codec buffer, which the encoder gets back (and the
+    // stream reads on) only after releaseFrame(). Safe to call from one
+    // consumer thread per stream; releaseFrame() may come from another one.
+    bool borrowFrame(StreamKind stream, const unsigned char *&data, std::size_t &size, timeval &presentation, bool &isKeyFrame);
+    void releaseFrame(StreamKind stream);
+    // Copying variant of borrowFrame()
     bool readFrame(StreamKind stream, std::vector<unsigned char> &buffer, timeval &presentation, bool &isKeyFrame);
+    // Readable while borrowFrame() has an access unit for the stream
     int getPollFd(StreamKind stream) const;
     std::size_t getMaxFrameSize(StreamKind stream) const;
 
-    // Best-effort request for an IDR picture on the given stream. Returns true if the request was issued.
+    // Queue a retune of bitrate, fps and GOP of a running stream (0 keeps a value)
+    // and return without waiting: the pump thread applies it on its next wakeup, a
+    // request it has not taken yet is merged with the new one. Bitrate and GOP change
+    // in place. The codec fps is fixed at init: the session restarts once its lent
+    // frame is released, and the low stream with the high one since it is attached
+    // to it. getChangeStatus() tells when it is applied and how.
+    bool reconfigure(StreamKind stream, const StreamParams &params);
+    ChangeStatus getChangeStatus(StreamKind stream) const;
+    StreamParams getParams(StreamKind stream) const;
+
+    // Best-effort request for an IDR picture on the given stream. Returns true if the request was issued
+    // (or queued to the pump thread).
     bool requestIDR(StreamKind stream);
 
 private:
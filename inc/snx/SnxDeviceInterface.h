@@ -1,10 +1,15 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <vector>
 #include <string>
 #include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <sstream>
 #include <linux/videodev2.h>
+#include <time.h>
 
 #include "DeviceInterface.h"
 #include "snx/SnxCodecController.h"
@@ -22,8 +27,12 @@ public:
           m_stream(stream),
           m_width(width),
           m_height(height),
-          m_bufferSize(bufferSize)
+          m_bufferSize(bufferSize),
+          m_borrowedKey(false),
+          m_truncated(0)
     {
+        m_pts.tv_sec = 0;
+        m_pts.tv_usec = 0;
     }
 
     virtual ~SnxDeviceInterface() {}
@@ -31,98 +40,204 @@ public:
     // Read a complete access unit from the controller into the provided buffer.
     virtual size_t read(char *buffer, size_t bufferSize)
     {
-        if (!m_controller || !m_controller->isRunning())
-            return 0;
-        std::vector<unsigned char> data;
-        timeval pts; pts.tv_sec = 0; pts.tv_usec = 0;
-        bool key = false;
-        if (!m_controller->readFrame(m_stream, data, pts, key))
-        {
-            // no frame currently available
+        char *data = NULL;
+        size_t size = borrowFrame(data);
+        if (size == 0)
             return 0;
-        }
+        const unsigned char *au = reinterpret_cast<const unsigned char *>(data);
 
         // Parse Annex-B NALs to cache SPS/PPS
-        cacheParameterSetsIfAny(data);
-        // If keyframe but missing SPS/PPS prefix, prepend cached sets
-        if (key && !startsWithSpsPps(data))
+        cacheParameterSetsIfAny(au, size);
+        // If keyframe but missing SPS/PPS prefix, write cached sets in front of it
+        size_t n = 0;
+        static const unsigned char sc4[4] = {0x00,0x00,0x00,0x01};
+        if (m_borrowedKey && !startsWithSpsPps(au, size) && !m_sps.empty() && !m_pps.empty())
         {
-            if (!m_sps.empty() && !m_pps.empty())
+            const size_t prefix = 2 * sizeof(sc4) + m_sps.size() + m_pps.size();
+            if (prefix < bufferSize)
             {
-                std::vector<unsigned char> fused;
-                static const unsigned char sc4[4] = {0x00,0x00,0x00,0x01};
-                // SPS
-                fused.insert(fused.end(), sc4, sc4 + 4);
-                fused.insert(fused.end(), m_sps.begin(), m_sps.end());
-                // PPS
-                fused.insert(fused.end(), sc4, sc4 + 4);
-                fused.insert(fused.end(), m_pps.begin(), m_pps.end());
-                // Original AU
-                fused.insert(fused.end(), data.begin(), data.end());
-                LOG(DEBUG) << "SNX: injected cached SPS(" << m_sps.size() << ")/PPS(" << m_pps.size() << ") before IDR (total " << fused.size() << ")";
-                data.swap(fused);
+                n = append(buffer, n, sc4, sizeof(sc4));
+                n = append(buffer, n, m_sps.data(), m_sps.size());
+                n = append(buffer, n, sc4, sizeof(sc4));
+                n = append(buffer, n, m_pps.data(), m_pps.size());
+                LOG(DEBUG) << "SNX: injected cached SPS(" << m_sps.size() << ")/PPS(" << m_pps.size() << ") before IDR (total " << (prefix + size) << ")";
             }
         }
+        size_t room = bufferSize - n;
+        if (size > room)
+        {
+            unsigned long truncated = ++m_truncated;
+            LOG(WARN) << "SNX: access unit of " << size << " bytes truncated to " << room << " (buffer " << bufferSize << ", truncated:" << truncated << ")";
+        }
+        n = append(buffer, n, au, std::min(size, room));
+        releaseFrame(data);
+        return n;
+    }
 
-        size_t n = data.size();
-        if (n > bufferSize) n = bufferSize;
-        if (n > 0) std::memcpy(buffer, data.data(), n);
+    // Lend the codec buffer itself. SPS/PPS are not injected here: the source
+    // puts its cached ones in front of the IDR (repeatConfig) without copying.
+    virtual bool canBorrowFrames() { return true; }
+    virtual size_t borrowFrame(char *&buffer)
+    {
+        // 0 with EAGAIN tells the capture thread to wait for the next readiness
+        errno = EAGAIN;
+        buffer = NULL;
+        if (!m_controller || !m_controller->isRunning())
+            return 0;
+        const unsigned char *data = NULL;
+        size_t size = 0;
+        timeval pts; pts.tv_sec = 0; pts.tv_usec = 0;
+        m_borrowedKey = false;
+        if (!m_controller->borrowFrame(m_stream, data, size, pts, m_borrowedKey))
+        {
+            // no frame currently available
+            return 0;
+        }
+        m_pts = pts;
+        buffer = const_cast<char *>(reinterpret_cast<const char *>(data));
 
         // Debug: log first few read sizes
         static int s_readCount = 0;
         if (s_readCount < 10)
         {
-            LOG(DEBUG) << "SNX read(" << (m_stream==SnxCodecController::High?"high":"low")
-                       << ") size=" << data.size() << " copied=" << n << (key?" key":"");
+            LOG(DEBUG) << "SNX borrow(" << (m_stream==SnxCodecController::High?"high":"low")
+                       << ") size=" << size << (m_borrowedKey?" key":"");
             s_readCount++;
         }
-        return n;
+        return size;
     }
 
-    // Return -1 so V4L2DeviceSource uses its internal capture thread rather than
-    // Live555 background read handling on a non-POSIX-readable fd.
-    virtual int getFd() { return -1; }
+    virtual void releaseFrame(char *)
+    {
+        if (m_controller)
+            m_controller->releaseFrame(m_stream);
+    }
+
+    // Readable when the controller pump has an access unit for this stream:
+    // the capture thread waits on it instead of polling.
+    virtual int getFd()
+    {
+        if (!m_controller || !m_controller->isRunning())
+            return -1;
+        return m_controller->getPollFd(m_stream);
+    }
 
     virtual unsigned long getBufferSize()
     {
         return (unsigned long)m_bufferSize;
     }
 
+    // Codec capture buffer length rather than the 2 MB read cap, so capture buffers
+    // stay small, plus room for the parameter sets read() puts in front of an IDR
+    virtual unsigned long getMaxFrameSize()
+    {
+        if (!m_controller) return getBufferSize();
+        return (unsigned long)std::min(m_bufferSize, m_controller->getMaxFrameSize(m_stream) + kParamSetRoom);
+    }
+
+    virtual unsigned long getTruncatedFrames() { return m_truncated.load(); }
+
     virtual bool requestKeyFrame()
     {
         if (!m_controller) return false;
         return m_controller->requestIDR(m_stream);
     }
 
+    virtual std::string setEncoderParams(unsigned int bitrate, unsigned int fps, unsigned int gop)
+    {
+        if (!m_controller) return std::string();
+        SnxCodecController::StreamParams params;
+        params.bitrate = bitrate;
+        params.fps = fps;
+        params.gop = gop;
+        // queued for the pump thread, the reply only tells what is known now
+        bool queued = (bitrate || fps || gop) && m_controller->reconfigure(m_stream, params);
+        SnxCodecController::ChangeStatus status = m_controller->getChangeStatus(m_stream);
+        SnxCodecController::StreamParams current = m_controller->getParams(m_stream);
+
+        std::ostringstream os;
+        os << "{\"queued\":" << (queued ? "true" : "false");
+        os << ",\"pending\":" << (status.pending ? "true" : "false");
+        os << ",\"applied\":" << (status.applied ? "true" : "false");
+        os << ",\"requested\":{\"bitrate\":" << status.requested.bitrate << ",\"fps\":" << status.requested.fps << ",\"gop\":" << status.requested.gop << "}";
+        os << ",\"bitrate\":{\"value\":" << current.bitrate << ",\"change\":\"" << changeName(status.report.bitrate) << "\"}";
+        os << ",\"fps\":{\"value\":" << current.fps << ",\"change\":\"" << changeName(status.report.fps) << "\"}";
+        os << ",\"gop\":{\"value\":" << current.gop << ",\"change\":\"" << changeName(status.report.gop) << "\"}}";
+        return os.str();
+    }
+
+    // Codec buffer timestamp, taken on the wall clock or on the monotonic one
+    // depending on the driver: a monotonic one is moved to the wall clock.
+    virtual bool getCaptureTime(timeval &captureTime)
+    {
+        const long long maxAge = 10 * 1000000LL;
+        long long pts = m_pts.tv_sec * 1000000LL + m_pts.tv_usec;
+        if (pts == 0)
+            return false;
+        timeval now;
+        gettimeofday(&now, NULL);
+        long long wall = now.tv_sec * 1000000LL + now.tv_usec;
+        long long age = wall - pts;
+        if ((age < 0) || (age > maxAge))
+        {
+            timespec mono;
+            clock_gettime(CLOCK_MONOTONIC, &mono);
+            age = (mono.tv_sec * 1000000LL + mono.tv_nsec / 1000) - pts;
+            if ((age < 0) || (age > maxAge))
+                return false;
+        }
+        captureTime.tv_sec = (wall - age) / 1000000;
+        captureTime.tv_usec = (wall - age) % 1000000;
+        return true;
+    }
+
     virtual int getWidth() { return m_width; }
     virtual int getHeight() { return m_height; }
     virtual int getVideoFormat() { return V4L2_PIX_FMT_H264; }
 
 private:
+    static const size_t kParamSetRoom = 512;
+
+    static const char *changeName(SnxCodecController::ChangeResult change)
+    {
+        switch (change)
+        {
+        case SnxCodecController::Live: return "live";
+        case SnxCodecController::Restart: return "restart";
+        case SnxCodecController::Failed: return "failed";
+        default: return "unchanged";
+        }
+    }
+
     // Very small Annex-B parser helpers
     static inline int nalUnitType(unsigned char b) { return b & 0x1F; }
     static bool isStartCode3(const unsigned char *p) { return p[0]==0x00 && p[1]==0x00 && p[2]==0x01; }
     static bool isStartCode4(const unsigned char *p) { return p[0]==0x00 && p[1]==0x00 && p[2]==0x00 && p[3]==0x01; }
-    static size_t findStartCode(const std::vector<unsigned char> &buf, size_t off)
+    static size_t findStartCode(const unsigned char *buf, size_t size, size_t off)
     {
-        for (size_t i = off; i + 3 < buf.size(); ++i)
+        for (size_t i = off; i + 3 < size; ++i)
         {
             if (isStartCode4(&buf[i])) return i + 4;
-            if (i + 2 < buf.size() && isStartCode3(&buf[i])) return i + 3;
+            if (i + 2 < size && isStartCode3(&buf[i])) return i + 3;
         }
         return std::string::npos;
     }
+    static size_t append(char *dest, size_t offset, const unsigned char *src, size_t size)
+    {
+        std::memcpy(dest + offset, src, size);
+        return offset + size;
+    }
 
-    void cacheParameterSetsIfAny(const std::vector<unsigned char> &buf)
+    void cacheParameterSetsIfAny(const unsigned char *buf, size_t size)
     {
         // Iterate over NAL units and cache SPS/PPS payloads without start codes
-        size_t pos = findStartCode(buf, 0);
-        while (pos != std::string::npos && pos < buf.size())
+        size_t pos = findStartCode(buf, size, 0);
+        while (pos != std::string::npos && pos < size)
         {
             // next start
-            size_t next = findStartCode(buf, pos);
+            size_t next = findStartCode(buf, size, pos);
             size_t nalStart = pos;
-            size_t nalEnd = buf.size();
+            size_t nalEnd = size;
             if (next != std::string::npos)
             {
                 // 'next' points AFTER a start code; explicitly find where it began
@@ -141,25 +256,25 @@ private:
             int type = nalUnitType(header);
             if (type == 7)
             {
-                m_sps.assign(buf.begin() + nalStart, buf.begin() + nalEnd);
+                m_sps.assign(buf + nalStart, buf + nalEnd);
             }
             else if (type == 8)
             {
-                m_pps.assign(buf.begin() + nalStart, buf.begin() + nalEnd);
+                m_pps.assign(buf + nalStart, buf + nalEnd);
             }
             pos = next;
         }
     }
 
-    bool startsWithSpsPps(const std::vector<unsigned char> &buf) const
+    bool startsWithSpsPps(const unsigned char *buf, size_t size) const
     {
         // Check if AU begins with SPS then PPS before slices
-        size_t pos = findStartCode(buf, 0);
-        if (pos == std::string::npos || pos >= buf.size()) return false;
+        size_t pos = findStartCode(buf, size, 0);
+        if (pos == std::string::npos || pos >= size) return false;
         int t1 = nalUnitType(buf[pos]);
         if (t1 != 7) return false;
-        size_t next = findStartCode(buf, pos);
-        if (next == std::string::npos || next >= buf.size()) return false;
+        size_t next = findStartCode(buf, size, pos);
+        if (next == std::string::npos || next >= size) return false;
         int t2 = nalUnitType(buf[next]);
         return t2 == 8;
     }
@@ -169,6 +284,11 @@ private:
     int m_width;
     int m_height;
     size_t m_bufferSize;
+    bool m_borrowedKey;
+    // access units cut to the read buffer, capture thread
+    std::atomic<unsigned long> m_truncated;
+    // timestamp of the last frame lent
+    timeval m_pts;
     std::vector<unsigned char> m_sps;
     std::vector<unsigned char> m_pps;
 };
@@ -41,6 +41,7 @@
 #include "V4l2RTSPServer.h"
 #include "DeviceSourceFactory.h"
 #include "H264_V4l2DeviceSource.h"
+#include "H26xRTPSink.h"
 #include "V4L2DeviceSource.h"
 #include "snx/SnxCodecController.h"
 #include "snx/SnxDeviceInterface.h"
@@ -123,6 +124,7 @@ int main(int argc, char **argv)
 	int width = 0;
 	int height = 0;
 	int queueSize = 5;
+	unsigned int latencyBudget = 0;
 	int fps = 25;
 	unsigned short rtspPort = 8554;
 	unsigned short rtspOverHTTPPort = 0;
@@ -138,6 +140,14 @@ int main(int argc, char **argv)
 	V4L2DeviceSource::CaptureMode captureMode = V4L2DeviceSource::CAPTURE_INTERNAL_THREAD;
 	std::string maddr;
 	bool repeatConfig = true;
+	bool zeroReorder = false;
+	std::list<unsigned int> fpsVariants;
+	bool captureTimeSei = false;
+	unsigned int udpBatch = 0;
+	bool udpGSO = false;
+	unsigned int pacing = 0;
+	unsigned int pacingBurst = H26xPacketizer::getPacingBurst();
+	bool pacingTxTime = false;
 	int timeout = 65;
 	int defaultHlsSegment = 2;
 	unsigned int hlsSegment = 0;
@@ -208,7 +218,15 @@ int main(int argc, char **argv)
 		OPT_SNX_POWER_FREQ,
 		OPT_AUDIO_DEVICE,
 		OPT_AUDIO_RTP,
-		OPT_SNX_NO_AUDIO
+		OPT_SNX_NO_AUDIO,
+		OPT_ZERO_REORDER,
+		OPT_FPS_VARIANT,
+		OPT_CAPTURE_TIME,
+		OPT_UDP_BATCH,
+		OPT_UDP_GSO,
+		OPT_PACING,
+		OPT_PACING_BURST,
+		OPT_PACING_TXTIME
 	};
 
 	static const struct option longOptions[] = {
@@ -227,12 +245,20 @@ int main(int argc, char **argv)
 		{"snx-no-audio", no_argument, NULL, OPT_SNX_NO_AUDIO},
 		{"audio-dev", required_argument, NULL, OPT_AUDIO_DEVICE},
 		{"audio-rtp", required_argument, NULL, OPT_AUDIO_RTP},
+		{"zero-reorder", no_argument, NULL, OPT_ZERO_REORDER},
+		{"fps-variant", required_argument, NULL, OPT_FPS_VARIANT},
+		{"capture-time", no_argument, NULL, OPT_CAPTURE_TIME},
+		{"udp-batch", required_argument, NULL, OPT_UDP_BATCH},
+		{"udp-gso", no_argument, NULL, OPT_UDP_GSO},
+		{"pacing", required_argument, NULL, OPT_PACING},
+		{"pacing-burst", required_argument, NULL, OPT_PACING_BURST},
+		{"pacing-txtime", no_argument, NULL, OPT_PACING_TXTIME},
 		{NULL, 0, NULL, 0}};
 
 	// decode parameters
 	int c = 0;
 	while ((c = getopt_long(argc, argv,
-					  "v::Q:O:b:"
+					  "v::Q:L:O:b:"
 								   "I:P:p:m::u:M::ct:S::x:X"
 								   "R:U:"
 								   "rwBsf::F:W:H:G:"
@@ -308,6 +334,33 @@ int main(int argc, char **argv)
 		case OPT_SNX_NO_AUDIO:
 			snxOptions.audioEnabled = false;
 			break;
+		case OPT_ZERO_REORDER:
+			zeroReorder = true;
+			break;
+		case OPT_CAPTURE_TIME:
+			captureTimeSei = true;
+			break;
+		case OPT_UDP_BATCH:
+			udpBatch = atoi(optarg);
+			break;
+		case OPT_UDP_GSO:
+			udpGSO = true;
+			break;
+		case OPT_PACING:
+			pacing = atoi(optarg);
+			break;
+		case OPT_PACING_BURST:
+			pacingBurst = atoi(optarg);
+			break;
+		case OPT_PACING_TXTIME:
+			pacingTxTime = true;
+			break;
+		case OPT_FPS_VARIANT:
+			if (atoi(optarg) > 0)
+			{
+				fpsVariants.push_back(atoi(optarg));
+			}
+			break;
 		case 'v':
 			verbose = 1;
 			if (optarg && *optarg == 'v')
@@ -316,6 +369,9 @@ int main(int argc, char **argv)
 		case 'Q':
 			queueSize = atoi(optarg);
 			break;
+		case 'L':
+			latencyBudget = atoi(optarg);
+			break;
 		case 'O':
 			outputFile = optarg;
 			break;
@@ -430,12 +486,13 @@ int main(int argc, char **argv)
 		case 'h':
 		default:
 		{
-			std::cout << argv[0] << " [-v[v]] [-Q queueSize] [-O file]" << std::endl;
+			std::cout << argv[0] << " [-v[v]] [-Q queueSize] [-L latency] [-O file]" << std::endl;
 			std::cout << "\t          [-I interface] [-P RTSP port] [-p RTSP/HTTP port] [-m multicast url] [-u unicast url] [-M multicast addr] [-c] [-t timeout] [-T] [-S[duration]]" << std::endl;
 			std::cout << "\t          [-r] [-w] [-s] [-f[format] [-W width] [-H height] [-F fps] [device] [device]" << std::endl;
 			std::cout << "\t -v               : verbose" << std::endl;
 			std::cout << "\t -vv              : very verbose" << std::endl;
 			std::cout << "\t -Q <length>      : Number of frame queue  (default " << queueSize << ")" << std::endl;
+			std::cout << "\t -L <ms>          : Latency budget, older frames are skipped up to the next key frame (default " << latencyBudget << " disabled)" << std::endl;
 			std::cout << "\t -O <output>      : Copy captured frame to a file or a V4L2 device" << std::endl;
 			std::cout << "\t -b <webroot>     : path to webroot" << std::endl;
 
@@ -449,6 +506,14 @@ int main(int argc, char **argv)
 			std::cout << "\t -m <url>         : multicast url (default " << murl << ")" << std::endl;
 			std::cout << "\t -M <addr>        : multicast group:port (default is random_address:20000)" << std::endl;
 			std::cout << "\t -c               : don't repeat config (default repeat config before IDR frame)" << std::endl;
+			std::cout << "\t --zero-reorder   : rewrite the H264 SPS so that players do not buffer frames (no B-frames only)" << std::endl;
+			std::cout << "\t --fps-variant <n>: add a <url>@<n>fps session dropping disposable frames (repeatable, not on SNX)" << std::endl;
+			std::cout << "\t --capture-time   : add a SEI with the capture time to each H264/H265 frame" << std::endl;
+			std::cout << "\t --udp-batch <n>  : send up to n RTP packets to all unicast UDP clients with one sendmmsg" << std::endl;
+			std::cout << "\t --udp-gso        : send the fragments of a frame as one UDP GSO message per client" << std::endl;
+			std::cout << "\t --pacing <pct>   : spread the RTP packets of a frame over pct % of the frame interval (H264/H265)" << std::endl;
+			std::cout << "\t --pacing-burst <bytes> : bytes sent back to back before pacing waits (default " << pacingBurst << ")" << std::endl;
+			std::cout << "\t --pacing-txtime  : leave the pacing wait of UDP packets to the kernel (SO_TXTIME, needs the fq qdisc)" << std::endl;
 			std::cout << "\t -t <timeout>     : RTCP expiration timeout in seconds (default " << timeout << ")" << std::endl;
 			std::cout << "\t -S[<duration>]   : enable HLS & MPEG-DASH with segment duration  in seconds (default " << defaultHlsSegment << ")" << std::endl;
 #ifndef NO_OPENSSL
@@ -666,6 +731,13 @@ int main(int argc, char **argv)
 	}
 #endif
 
+#if LIVEMEDIA_LIBRARY_VERSION_INT >= 1642723200
+	BatchGroupsock::setBatchSize(udpBatch);
+	BatchGroupsock::setGSO(udpGSO);
+	BatchGroupsock::setTxTime(pacing && pacingTxTime);
+#endif
+	H26xPacketizer::setPacingBurst(pacingBurst);
+
 	// create RTSP server
 	V4l2RTSPServer rtspServer(rtspPort, rtspOverHTTPPort, timeout, hlsSegment, userPasswordList, realm, webroot, sslKeyCert, enableRTSPS);
 	if (!rtspServer.available())
@@ -714,13 +786,17 @@ int main(int argc, char **argv)
 				// Create a V4L2DeviceSource using our SNX adapter; repeatConfig=true, keepMarker=true for H264
 				DeviceInterface *hiDev = new SnxDeviceInterface(controller, SnxCodecController::High, snxOptions.hi.width, snxOptions.hi.height);
 				// Do not keep Annex-B start codes when feeding H264VideoStreamDiscreteFramer
-				V4L2DeviceSource *hiV4L2 = H264_V4L2DeviceSource::createNew(env, hiDev, -1, queueSize, V4L2DeviceSource::CAPTURE_INTERNAL_THREAD, /*repeatConfig*/true, /*keepMarker*/false);
+				H264_V4L2DeviceSource *hiV4L2 = H264_V4L2DeviceSource::createNew(env, hiDev, -1, queueSize, V4L2DeviceSource::CAPTURE_INTERNAL_THREAD, /*repeatConfig*/true, /*keepMarker*/false);
 				if (hiV4L2 == NULL)
 				{
 					LOG(ERROR) << "Failed to create SNX high V4L2DeviceSource.";
 					controller->stop();
 					return 1;
 				}
+				hiV4L2->setLatencyBudget(latencyBudget);
+				hiV4L2->setZeroReorder(zeroReorder);
+				hiV4L2->setCaptureTimeSei(captureTimeSei);
+				hiV4L2->setPacing(pacing);
 				// Prime aux-SDP (SPS/PPS) before SDP generation to help VLC/FFmpeg at startup
 				{
 					const int kMaxIters = 50; // ~500ms
@@ -752,22 +828,36 @@ int main(int argc, char **argv)
 				std::string urlHigh = rtspServer.getRtspUrl(smsHigh);
 				LOG(NOTICE) << "RTSP High URL: " << (urlHigh.empty() ? std::string("(unavailable)") : urlHigh);
 			}
+			// thumbnails and timelapse, fed by the same replicator
+			ServerMediaSession *smsHighKey = rtspServer.AddKeyFrameSession("high/keyframes", hiReplForSub);
+			// every P frame of the SNX encoder is a reference and the SDK does not
+			// change that: a reduced frame rate session would be the full stream
+			if (!fpsVariants.empty())
+			{
+				LOG(WARN) << "--fps-variant is ignored on SNX streams, the encoder produces no disposable frames";
+			}
 
 			ServerMediaSession *smsLow = NULL;
+			ServerMediaSession *smsLowKey = NULL;
 			if (!snxOptions.single)
 			{
 				DeviceInterface *loDev = new SnxDeviceInterface(controller, SnxCodecController::Low, snxOptions.lo.width, snxOptions.lo.height);
 				// Do not keep Annex-B start codes when feeding H264VideoStreamDiscreteFramer
-				V4L2DeviceSource *loV4L2 = H264_V4L2DeviceSource::createNew(env, loDev, -1, queueSize, V4L2DeviceSource::CAPTURE_INTERNAL_THREAD, /*repeatConfig*/true, /*keepMarker*/false);
+				H264_V4L2DeviceSource *loV4L2 = H264_V4L2DeviceSource::createNew(env, loDev, -1, queueSize, V4L2DeviceSource::CAPTURE_INTERNAL_THREAD, /*repeatConfig*/true, /*keepMarker*/false);
 				if (loV4L2 == NULL)
 				{
 					LOG(ERROR) << "Failed to create SNX low V4L2DeviceSource.";
 					controller->stop();
 					// Also cleanup high branch
+					Medium::close(smsHighKey);
 					Medium::close(smsHigh);
 					Medium::close(hiReplForSub);
 					return 1;
 				}
+				loV4L2->setLatencyBudget(latencyBudget);
+				loV4L2->setZeroReorder(zeroReorder);
+				loV4L2->setCaptureTimeSei(captureTimeSei);
+				loV4L2->setPacing(pacing);
 				// Prime aux-SDP for low stream as well
 				{
 					const int kMaxIters = 50;
@@ -790,12 +880,14 @@ int main(int argc, char **argv)
 					controller->stop();
 					Medium::close(loV4L2);
 					// Also cleanup high branch
+					Medium::close(smsHighKey);
 					Medium::close(smsHigh);
 					Medium::close(hiReplForSub);
 					return 1;
 				}
 
 				smsLow = rtspServer.AddUnicastSession("low", loReplForSub, snxOptions.audioEnabled ? audioReplicator : NULL);
+				smsLowKey = rtspServer.AddKeyFrameSession("low/keyframes", loReplForSub);
 				if (smsLow)
 				{
 				std::string urlLow = rtspServer.getRtspUrl(smsLow);
@@ -849,6 +941,14 @@ int main(int argc, char **argv)
 			smsLow = NULL;
 			LOG(DEBUG) << "Low session closed.";
 		}
+		if (smsHighKey) {
+			rtspServer.RemoveSession(smsHighKey);
+			smsHighKey = NULL;
+		}
+		if (smsLowKey) {
+			rtspServer.RemoveSession(smsLowKey);
+			smsLowKey = NULL;
+		}
 		
 		// Step 4: Close replicators (joins threads - should be quick since they're stopping)
 		LOG(DEBUG) << "Closing video replicators...";
@@ -908,6 +1008,25 @@ int main(int argc, char **argv)
 			{
 				outList.push_back(out);
 			}
+			if (videoReplicator != NULL)
+			{
+				V4L2DeviceSource *videoSource = dynamic_cast<V4L2DeviceSource *>(videoReplicator->inputSource());
+				if (videoSource != NULL)
+				{
+					videoSource->setLatencyBudget(latencyBudget);
+				}
+				H264_V4L2DeviceSource *h264Source = dynamic_cast<H264_V4L2DeviceSource *>(videoSource);
+				if (h264Source != NULL)
+				{
+					h264Source->setZeroReorder(zeroReorder);
+				}
+				H26X_V4L2DeviceSource *h26xSource = dynamic_cast<H26X_V4L2DeviceSource *>(videoSource);
+				if (h26xSource != NULL)
+				{
+					h26xSource->setCaptureTimeSei(captureTimeSei);
+					h26xSource->setPacing(pacing);
+				}
+			}
 
 			// Init Audio Capture
 			StreamReplicator *audioReplicator = NULL;
@@ -943,6 +1062,17 @@ int main(int argc, char **argv)
 			{
 				nbSource += sms->numSubsessions();
 			}
+
+			// Create key frame only Session
+			rtspServer.AddKeyFrameSession(baseUrl + url + "/keyframes", videoReplicator);
+
+			// Create reduced frame rate Sessions
+			for (std::list<unsigned int>::iterator fpsIt = fpsVariants.begin(); fpsIt != fpsVariants.end(); ++fpsIt)
+			{
+				std::ostringstream os;
+				os << baseUrl << url << "@" << *fpsIt << "fps";
+				rtspServer.AddFrameRateSession(os.str(), videoReplicator, *fpsIt);
+			}
 		}
 
 		if (nbSource > 0)
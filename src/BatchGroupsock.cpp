@@ -0,0 +1,509 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** BatchGroupsock.cpp
+**
+** Unicast groupsock sending the packets of a frame with one system call
+**
+** -------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+
+#include <sstream>
+
+#include "logger.h"
+#include "LatencyHistogram.h"
+#include "BatchGroupsock.h"
+
+#if LIVEMEDIA_LIBRARY_VERSION_INT >= 1611187200
+
+// Linux 4.18, missing from older headers
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+// Linux 4.19
+#ifndef SO_TXTIME
+#define SO_TXTIME 61
+#define SCM_TXTIME SO_TXTIME
+#endif
+
+// struct sock_txtime
+struct TxTimeConfig
+{
+	clockid_t clockid;
+	uint32_t flags;
+};
+
+unsigned int BatchGroupsock::s_batchSize = 0;
+bool BatchGroupsock::s_sendmmsg = true;
+bool BatchGroupsock::s_gso = false;
+bool BatchGroupsock::s_txTime = false;
+
+int BatchGroupsock::sendMultiple(int fd, MultiMessage *messages, unsigned int count)
+{
+#ifdef __NR_sendmmsg
+	return syscall(__NR_sendmmsg, fd, messages, count, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+std::string BatchGroupsock::Stats::toJSON() const
+{
+	std::ostringstream os;
+	os << "{\"batch\":" << BatchGroupsock::getBatchSize() << ",\"packets\":" << m_packets << ",\"datagrams\":" << m_datagrams;
+	os << ",\"calls\":" << m_calls << ",\"batches\":" << m_batches;
+	os << ",\"gso\":{\"enabled\":" << (BatchGroupsock::getGSO() ? "true" : "false") << ",\"messages\":" << m_gsoMessages << ",\"segments\":" << m_gsoSegments << "}";
+	os << ",\"txtime\":{\"enabled\":" << (BatchGroupsock::getTxTime() ? "true" : "false") << ",\"datagrams\":" << m_txTime << "}";
+	os << ",\"errors\":" << m_errors;
+	unsigned long long now = LatencyHistogram::now();
+	os << ",\"destinations\":[";
+	for (std::map<Address, Destination>::const_iterator it = m_destinations.begin(); it != m_destinations.end(); ++it)
+	{
+		const Destination &destination = it->second;
+		if (it != m_destinations.begin())
+		{
+			os << ",";
+		}
+		os << "{\"address\":\"" << it->first.toString() << "\",\"datagrams\":" << destination.m_datagrams << ",\"errors\":" << destination.m_errors;
+		os << ",\"suspended\":" << ((destination.m_resumeAt > now) ? "true" : "false") << ",\"suspensions\":" << destination.m_suspensions << ",\"skipped\":" << destination.m_skipped;
+		os << ",\"reports\":" << destination.m_reports << ",\"lost\":" << destination.m_lost << ",\"fractionlost\":" << destination.m_fractionLost * 100 / 256 << ",\"lag\":" << destination.m_lag << "}";
+	}
+	os << "]}";
+	return os.str();
+}
+
+BatchGroupsock::Stats::Address::Address(const struct sockaddr_storage &address) : m_family(address.ss_family)
+{
+	memset(m_address, 0, sizeof(m_address));
+	if (address.ss_family == AF_INET6)
+	{
+		memcpy(m_address, &((const struct sockaddr_in6 *)&address)->sin6_addr, 16);
+	}
+	else
+	{
+		memcpy(m_address, &((const struct sockaddr_in *)&address)->sin_addr, 4);
+	}
+}
+
+std::string BatchGroupsock::Stats::Address::toString() const
+{
+	char host[INET6_ADDRSTRLEN] = "";
+	inet_ntop((m_family == AF_INET6) ? AF_INET6 : AF_INET, m_address, host, sizeof(host));
+	return host;
+}
+
+BatchGroupsock::BatchGroupsock(UsageEnvironment &env, struct sockaddr_storage const &groupAddr, Port port, u_int8_t ttl, Stats *stats)
+	: Groupsock(env, groupAddr, port, ttl), m_stats(stats), m_sequence(-1), m_departure(0), m_endOfBurst(false), m_flushTask(NULL)
+{
+	if (m_stats && s_txTime)
+	{
+		// departure times on the clock of LatencyHistogram::now()
+		TxTimeConfig config;
+		config.clockid = CLOCK_MONOTONIC;
+		config.flags = 0;
+		if (setsockopt(socketNum(), SOL_SOCKET, SO_TXTIME, &config, sizeof(config)) != 0)
+		{
+			LOG(NOTICE) << "SO_TXTIME not supported, pacing done by the RTP sink errno:" << errno << " " << strerror(errno);
+			s_txTime = false;
+		}
+	}
+}
+
+BatchGroupsock::~BatchGroupsock()
+{
+	this->flush();
+}
+
+Boolean BatchGroupsock::output(UsageEnvironment &env, unsigned char *buffer, unsigned bufferSize)
+{
+	bool endOfBurst = m_endOfBurst;
+	m_endOfBurst = false;
+	if (m_stats == NULL)
+	{
+		return Groupsock::output(env, buffer, bufferSize);
+	}
+	if (fDests == NULL)
+	{
+		// RTP over the RTSP connection
+		return True;
+	}
+	m_stats->m_packets++;
+	// RTP, not RTCP (payload types 200 to 204)
+	if ((bufferSize >= 12) && ((buffer[0] >> 6) == 2) && ((buffer[1] < 200) || (buffer[1] > 204)))
+	{
+		m_sequence = (buffer[2] << 8) | buffer[3];
+	}
+
+	if ((s_batchSize <= 1) && !s_txTime)
+	{
+		// sent by live555, a single client (unicast) is skipped while it fails
+		unsigned long long now = LatencyHistogram::now();
+		Stats::Destination *destination = NULL;
+		if ((fDests != NULL) && (fDests->fNext == NULL))
+		{
+			destination = this->destination(fDests->fGroupEId.groupAddress(), now);
+			if (destination->m_resumeAt > now)
+			{
+				destination->m_skipped++;
+				m_sequence = -1;
+				return True;
+			}
+		}
+		unsigned int count = 0;
+		for (destRecord *dest = fDests; dest != NULL; dest = dest->fNext)
+		{
+			count++;
+		}
+		Boolean ret = Groupsock::output(env, buffer, bufferSize);
+		int error = errno;
+		m_stats->m_calls += count;
+		Run run(NULL, destination, 0, 1);
+		if (ret)
+		{
+			m_stats->m_datagrams += count;
+			if (destination)
+			{
+				destination->m_datagrams++;
+				destination->m_failures = 0;
+			}
+		}
+		else
+		{
+			this->countError(run, error);
+		}
+		if (destination && (m_sequence >= 0))
+		{
+			destination->m_sequence = m_sequence;
+		}
+		m_sequence = -1;
+		this->prune(now);
+		return ret;
+	}
+
+	m_packets.push_back(std::pair<unsigned int, unsigned int>(m_buffer.size(), bufferSize));
+	m_buffer.insert(m_buffer.end(), buffer, buffer + bufferSize);
+	m_departures.push_back(s_txTime ? m_departure : 0);
+	m_departure = 0;
+
+	// the RTP marker bit ends a frame, RTCP packet types all have this bit set
+	bool endOfFrame = (bufferSize >= 2) && (buffer[1] & 0x80);
+	if (endOfFrame || endOfBurst || (m_packets.size() >= s_batchSize))
+	{
+		this->flush();
+	}
+	else if (m_flushTask == NULL)
+	{
+		m_flushTask = env.taskScheduler().scheduleDelayedTask(FLUSH_DELAY, flushTask, this);
+	}
+	return True;
+}
+
+void BatchGroupsock::flush()
+{
+	env().taskScheduler().unscheduleDelayedTask(m_flushTask);
+	if (m_packets.empty())
+	{
+		return;
+	}
+
+	m_iovecs.resize(m_packets.size());
+	for (unsigned int i = 0; i < m_packets.size(); ++i)
+	{
+		m_iovecs[i].iov_base = &m_buffer[m_packets[i].first];
+		m_iovecs[i].iov_len = m_packets[i].second;
+	}
+	// one message per packet and destination, or per run of packets with GSO
+	unsigned long long now = LatencyHistogram::now();
+	m_runs.clear();
+	for (destRecord *dest = fDests; dest != NULL; dest = dest->fNext)
+	{
+		Stats::Destination *destination = this->destination(dest->fGroupEId.groupAddress(), now);
+		if (destination && (m_sequence >= 0))
+		{
+			destination->m_sequence = m_sequence;
+		}
+		if (destination && (destination->m_resumeAt > now))
+		{
+			destination->m_skipped += m_packets.size();
+			continue;
+		}
+		unsigned int i = 0;
+		while (i < m_packets.size())
+		{
+			unsigned int count = (s_gso && !s_txTime) ? this->gsoRun(i) : 1;
+			m_runs.push_back(Run(&dest->fGroupEId.groupAddress(), destination, i, count));
+			i += count;
+		}
+	}
+	this->prune(now);
+
+	size_t next = 0;
+	while (next < m_runs.size())
+	{
+		next = this->send(next);
+		if (next < m_runs.size())
+		{
+			// GSO refused, the runs left go one packet per message
+			LOG(NOTICE) << "UDP GSO not supported, sending packets one by one errno:" << errno << " " << strerror(errno);
+			s_gso = false;
+			std::vector<Run> single(m_runs.begin(), m_runs.begin() + next);
+			for (size_t i = next; i < m_runs.size(); ++i)
+			{
+				for (unsigned int j = 0; j < m_runs[i].m_count; ++j)
+				{
+					single.push_back(Run(m_runs[i].m_address, m_runs[i].m_destination, m_runs[i].m_first + j, 1));
+				}
+			}
+			m_runs.swap(single);
+		}
+	}
+	m_packets.clear();
+	m_departures.clear();
+	m_buffer.clear();
+	m_sequence = -1;
+}
+
+// packets from first on with the same size, the last one may be shorter
+unsigned int BatchGroupsock::gsoRun(unsigned int first) const
+{
+	unsigned int segmentSize = m_packets[first].second;
+	unsigned int count = 1;
+	unsigned int bytes = segmentSize;
+	while ((first + count < m_packets.size()) && (count < MAX_GSO_SEGMENTS))
+	{
+		unsigned int size = m_packets[first + count].second;
+		if ((size > segmentSize) || (bytes + size > MAX_GSO_BYTES))
+		{
+			break;
+		}
+		count++;
+		bytes += size;
+		if (size < segmentSize)
+		{
+			break;
+		}
+	}
+	return count;
+}
+
+// index of the first run not sent, it was refused as a GSO message
+size_t BatchGroupsock::send(size_t first)
+{
+	const std::vector<Run> &runs = m_runs;
+	size_t count = runs.size() - first;
+	const size_t controlSize = CMSG_SPACE(sizeof(uint64_t));
+	if (m_messages.size() < count)
+	{
+		m_messages.resize(count);
+		m_controls.resize(count * controlSize);
+	}
+	for (size_t i = 0; i < count; ++i)
+	{
+		const Run &run = runs[first + i];
+		MultiMessage &message = m_messages[i];
+		memset(&message, 0, sizeof(message));
+		message.msg_hdr.msg_name = (void *)run.m_address;
+		message.msg_hdr.msg_namelen = (run.m_address->ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+		message.msg_hdr.msg_iov = &m_iovecs[run.m_first];
+		message.msg_hdr.msg_iovlen = run.m_count;
+		if (run.m_count > 1)
+		{
+			// the kernel cuts the payload every segment size
+			message.msg_hdr.msg_control = &m_controls[i * controlSize];
+			message.msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+			struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message.msg_hdr);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			uint16_t segmentSize = m_packets[run.m_first].second;
+			memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof(segmentSize));
+		}
+		else if (m_departures[run.m_first] != 0)
+		{
+			// nanoseconds, held by the fq qdisc until then
+			message.msg_hdr.msg_control = &m_controls[i * controlSize];
+			message.msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint64_t));
+			struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message.msg_hdr);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_TXTIME;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+			uint64_t departure = m_departures[run.m_first] * 1000;
+			memcpy(CMSG_DATA(cmsg), &departure, sizeof(departure));
+		}
+	}
+
+	size_t sent = 0;
+	bool batched = false;
+	while (sent < count)
+	{
+		int ret = 0;
+		// unbatched, one send per packet and destination as live555 does
+		if (s_sendmmsg && ((s_batchSize > 1) || s_txTime))
+		{
+			ret = sendMultiple(socketNum(), &m_messages[sent], count - sent);
+			if ((ret < 0) && (errno == ENOSYS))
+			{
+				LOG(NOTICE) << "sendmmsg not supported, sending packets one by one";
+				s_sendmmsg = false;
+				continue;
+			}
+			batched = batched || (ret > 0);
+		}
+		else
+		{
+			ret = (sendmsg(socketNum(), &m_messages[sent].msg_hdr, 0) < 0) ? -1 : 1;
+		}
+		if (m_stats)
+		{
+			m_stats->m_calls++;
+		}
+
+		if (ret > 0)
+		{
+			for (int i = 0; i < ret; ++i)
+			{
+				this->countSent(runs[first + sent + i]);
+			}
+			sent += ret;
+		}
+		else if ((runs[first + sent].m_count > 1) && ((errno == EIO) || (errno == EINVAL) || (errno == ENOPROTOOPT) || (errno == EOPNOTSUPP)))
+		{
+			break;
+		}
+		else
+		{
+			// socket buffer full or destination unreachable, the message is lost
+			const Run &run = runs[first + sent];
+			this->countError(run, errno);
+			sent++;
+			// the next messages to a destination just skipped are not tried
+			while ((run.m_destination != NULL) && (run.m_destination->m_failures >= MAX_FAILURES) && (sent < count) && (runs[first + sent].m_destination == run.m_destination))
+			{
+				run.m_destination->m_skipped += runs[first + sent].m_count;
+				sent++;
+			}
+		}
+	}
+	if (m_stats && batched)
+	{
+		m_stats->m_batches++;
+	}
+	return first + sent;
+}
+
+void BatchGroupsock::countSent(const Run &run)
+{
+	if (run.m_destination)
+	{
+		run.m_destination->m_datagrams += run.m_count;
+		run.m_destination->m_failures = 0;
+	}
+	if (m_stats)
+	{
+		m_stats->m_datagrams += run.m_count;
+		if (run.m_count > 1)
+		{
+			m_stats->m_gsoMessages++;
+			m_stats->m_gsoSegments += run.m_count;
+		}
+		else if (m_departures[run.m_first] != 0)
+		{
+			m_stats->m_txTime++;
+		}
+	}
+}
+void BatchGroupsock::countError(const Run &run, int error)
+{
+	if (m_stats)
+	{
+		m_stats->m_errors++;
+	}
+	Stats::Destination *destination = run.m_destination;
+	if (destination == NULL)
+	{
+		return;
+	}
+	destination->m_errors++;
+	// a full socket buffer is not the fault of the destination
+	if ((error == EAGAIN) || (error == EWOULDBLOCK) || (error == ENOBUFS) || (error == ENOMEM))
+	{
+		return;
+	}
+	// once skipped, one more error skips it again
+	destination->m_failures++;
+	if (destination->m_failures >= MAX_FAILURES)
+	{
+		if (destination->m_failures == MAX_FAILURES)
+		{
+			LOG(NOTICE) << "UDP client " << (run.m_address ? Stats::Address(*run.m_address).toString() : std::string("?")) << " failing, skipped for " << SUSPEND_DELAY / 1000 << " ms errno:" << error << " " << strerror(error);
+		}
+		destination->m_resumeAt = LatencyHistogram::now() + SUSPEND_DELAY;
+		destination->m_suspensions++;
+	}
+}
+
+BatchGroupsock::Stats::Destination *BatchGroupsock::destination(const struct sockaddr_storage &address, unsigned long long now)
+{
+	if (m_stats == NULL)
+	{
+		return NULL;
+	}
+	Stats::Destination &destination = m_stats->m_destinations[Stats::Address(address)];
+	destination.m_lastUsed = now;
+	return &destination;
+}
+
+// clients gone, looked for once in a while
+void BatchGroupsock::prune(unsigned long long now)
+{
+	if ((m_stats == NULL) || (m_stats->m_pruneAt > now))
+	{
+		return;
+	}
+	m_stats->m_pruneAt = now + SUSPEND_DELAY;
+	std::map<Stats::Address, Stats::Destination>::iterator it = m_stats->m_destinations.begin();
+	while (it != m_stats->m_destinations.end())
+	{
+		if (it->second.m_lastUsed + DESTINATION_TIMEOUT < now)
+		{
+			m_stats->m_destinations.erase(it++);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+void BatchGroupsock::countReport(const struct sockaddr_storage &from, unsigned int fractionLost, long lost, unsigned int extendedSequence)
+{
+	Stats::Destination *destination = this->destination(from, LatencyHistogram::now());
+	if (destination == NULL)
+	{
+		return;
+	}
+	destination->m_reports++;
+	destination->m_fractionLost = fractionLost;
+	destination->m_lost = lost;
+	// a report racing the packets sent since counts as no lag
+	unsigned short lag = destination->m_sequence - (unsigned short)extendedSequence;
+	destination->m_lag = (lag < 0x8000) ? lag : 0;
+}
+#endif
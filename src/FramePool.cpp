@@ -0,0 +1,89 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** FramePool.cpp
+**
+** Fixed-size pool of preallocated capture buffers
+**
+** -------------------------------------------------------------------------*/
+
+#include "logger.h"
+#include "FramePool.h"
+
+FramePool::FramePool(unsigned int count, unsigned long bufferSize)
+	: m_count(count), m_bufferSize(bufferSize), m_arena(NULL), m_hits(0), m_misses(0)
+{
+	if ((m_count > 0) && (m_bufferSize > 0))
+	{
+		m_arena = new char[m_count * m_bufferSize];
+		m_free.reserve(m_count);
+		for (unsigned int i = 0; i < m_count; ++i)
+		{
+			m_free.push_back(m_arena + i * m_bufferSize);
+		}
+	}
+	else
+	{
+		m_count = 0;
+	}
+	LOG(NOTICE) << "FramePool count:" << m_count << " bufferSize:" << m_bufferSize;
+}
+
+FramePool::~FramePool()
+{
+	delete[] m_arena;
+}
+
+char *FramePool::acquire()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_free.empty())
+		{
+			char *buffer = m_free.back();
+			m_free.pop_back();
+			m_hits++;
+			return buffer;
+		}
+		m_misses++;
+	}
+	LOG(DEBUG) << "FramePool empty, allocating " << m_bufferSize << " bytes";
+	return new char[m_bufferSize];
+}
+
+void FramePool::release(char *buffer)
+{
+	if (buffer == NULL)
+	{
+		return;
+	}
+	if (owns(buffer))
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_free.push_back(buffer);
+	}
+	else
+	{
+		delete[] buffer;
+	}
+}
+
+unsigned int FramePool::getAvailable()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_free.size();
+}
+
+unsigned long FramePool::getHits()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_hits;
+}
+
+unsigned long FramePool::getMisses()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_misses;
+}
@@ -0,0 +1,369 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** H264SpsRewriter.cpp
+**
+** Rewrite the VUI of an H264 SPS
+**
+** -------------------------------------------------------------------------*/
+
+#include <vector>
+
+#include "H264SpsRewriter.h"
+
+// ---------------------------------
+// Bit reader over the RBSP, emulation prevention bytes already removed
+// ---------------------------------
+class RbspReader
+{
+public:
+	RbspReader(const std::vector<unsigned char> &rbsp) : m_rbsp(rbsp), m_pos(0), m_error(false) {}
+
+	unsigned int bits(unsigned int count)
+	{
+		unsigned int value = 0;
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			if (m_pos >= m_rbsp.size() * 8)
+			{
+				m_error = true;
+				return 0;
+			}
+			value = (value << 1) | ((m_rbsp[m_pos / 8] >> (7 - (m_pos % 8))) & 1);
+			m_pos++;
+		}
+		return value;
+	}
+
+	unsigned int ue()
+	{
+		unsigned int zeros = 0;
+		while (!m_error && (this->bits(1) == 0))
+		{
+			if (++zeros > 31)
+			{
+				m_error = true;
+			}
+		}
+		return m_error ? 0 : ((1U << zeros) - 1 + this->bits(zeros));
+	}
+
+	bool error() const { return m_error; }
+
+protected:
+	const std::vector<unsigned char> &m_rbsp;
+	size_t m_pos;
+	bool m_error;
+};
+
+// ---------------------------------
+// Bit writer, emulation prevention bytes added on output
+// ---------------------------------
+class RbspWriter
+{
+public:
+	RbspWriter() : m_current(0), m_count(0) {}
+
+	void bits(unsigned int count, unsigned int value)
+	{
+		while (count > 0)
+		{
+			count--;
+			m_current = (m_current << 1) | ((value >> count) & 1);
+			if (++m_count == 8)
+			{
+				m_rbsp.push_back(m_current);
+				m_current = 0;
+				m_count = 0;
+			}
+		}
+	}
+
+	void ue(unsigned int value)
+	{
+		unsigned int coded = value + 1;
+		unsigned int length = 0;
+		while ((coded >> length) > 1)
+		{
+			length++;
+		}
+		this->bits(length, 0);
+		this->bits(length + 1, coded);
+	}
+
+	// rbsp_trailing_bits and conversion to a NAL payload
+	void finish(std::string &out)
+	{
+		this->bits(1, 1);
+		while (m_count != 0)
+		{
+			this->bits(1, 0);
+		}
+		int zeros = 0;
+		for (size_t i = 0; i < m_rbsp.size(); ++i)
+		{
+			if ((zeros >= 2) && (m_rbsp[i] <= 3))
+			{
+				out.push_back(3);
+				zeros = 0;
+			}
+			out.push_back(m_rbsp[i]);
+			zeros = (m_rbsp[i] == 0) ? zeros + 1 : 0;
+		}
+	}
+
+protected:
+	std::vector<unsigned char> m_rbsp;
+	unsigned char m_current;
+	unsigned int m_count;
+};
+
+// read from one, write the same to the other
+class RbspCopier
+{
+public:
+	RbspCopier(RbspReader &reader, RbspWriter &writer) : m_reader(reader), m_writer(writer) {}
+
+	unsigned int bits(unsigned int count)
+	{
+		unsigned int value = m_reader.bits(count);
+		m_writer.bits(count, value);
+		return value;
+	}
+
+	unsigned int ue()
+	{
+		unsigned int value = m_reader.ue();
+		m_writer.ue(value);
+		return value;
+	}
+
+	// se() has the same code length as ue(), the bits are copied as they are
+	void se() { this->ue(); }
+
+	void scalingList(unsigned int size)
+	{
+		int lastScale = 8;
+		int nextScale = 8;
+		for (unsigned int j = 0; (j < size) && !m_reader.error(); ++j)
+		{
+			if (nextScale != 0)
+			{
+				unsigned int code = this->ue();
+				int delta = (code & 1) ? (int)((code + 1) / 2) : -(int)(code / 2);
+				nextScale = (lastScale + delta + 256) % 256;
+			}
+			lastScale = (nextScale == 0) ? lastScale : nextScale;
+		}
+	}
+
+	void hrdParameters()
+	{
+		unsigned int cpbCount = this->ue() + 1;
+		this->bits(4); // bit_rate_scale
+		this->bits(4); // cpb_size_scale
+		for (unsigned int i = 0; (i < cpbCount) && (i < 32) && !m_reader.error(); ++i)
+		{
+			this->ue(); // bit_rate_value_minus1
+			this->ue(); // cpb_size_value_minus1
+			this->bits(1); // cbr_flag
+		}
+		this->bits(20); // delay lengths and time_offset_length
+	}
+
+protected:
+	RbspReader &m_reader;
+	RbspWriter &m_writer;
+};
+
+bool H264SpsRewriter::setZeroReorder(const unsigned char *nal, size_t size, std::string &out)
+{
+	if ((size < 4) || ((nal[0] & 0x1F) != 7))
+	{
+		return false;
+	}
+
+	std::vector<unsigned char> rbsp;
+	rbsp.reserve(size);
+	int zeros = 0;
+	for (size_t i = 1; i < size; ++i)
+	{
+		if ((zeros >= 2) && (nal[i] == 3))
+		{
+			zeros = 0;
+			continue;
+		}
+		rbsp.push_back(nal[i]);
+		zeros = (nal[i] == 0) ? zeros + 1 : 0;
+	}
+
+	RbspReader reader(rbsp);
+	RbspWriter writer;
+	RbspCopier copy(reader, writer);
+
+	unsigned int profile = copy.bits(8);
+	copy.bits(16); // constraint flags, level_idc
+	copy.ue();     // seq_parameter_set_id
+	switch (profile)
+	{
+	case 100: case 110: case 122: case 244: case 44: case 83: case 86: case 118: case 128: case 138: case 139: case 134: case 135:
+	{
+		unsigned int chromaFormat = copy.ue();
+		if (chromaFormat == 3)
+		{
+			copy.bits(1); // separate_colour_plane_flag
+		}
+		copy.ue();    // bit_depth_luma_minus8
+		copy.ue();    // bit_depth_chroma_minus8
+		copy.bits(1); // qpprime_y_zero_transform_bypass_flag
+		if (copy.bits(1)) // seq_scaling_matrix_present_flag
+		{
+			unsigned int lists = (chromaFormat != 3) ? 8 : 12;
+			for (unsigned int i = 0; i < lists; ++i)
+			{
+				if (copy.bits(1))
+				{
+					copy.scalingList((i < 6) ? 16 : 64);
+				}
+			}
+		}
+		break;
+	}
+	default:
+		break;
+	}
+	copy.ue(); // log2_max_frame_num_minus4
+	unsigned int pocType = copy.ue();
+	if (pocType == 0)
+	{
+		copy.ue(); // log2_max_pic_order_cnt_lsb_minus4
+	}
+	else if (pocType == 1)
+	{
+		copy.bits(1); // delta_pic_order_always_zero_flag
+		copy.se();    // offset_for_non_ref_pic
+		copy.se();    // offset_for_top_to_bottom_field
+		unsigned int cycle = copy.ue();
+		for (unsigned int i = 0; (i < cycle) && (i < 256) && !reader.error(); ++i)
+		{
+			copy.se(); // offset_for_ref_frame
+		}
+	}
+	unsigned int maxRefFrames = copy.ue();
+	copy.bits(1); // gaps_in_frame_num_value_allowed_flag
+	copy.ue();    // pic_width_in_mbs_minus1
+	copy.ue();    // pic_height_in_map_units_minus1
+	if (!copy.bits(1)) // frame_mbs_only_flag
+	{
+		copy.bits(1); // mb_adaptive_frame_field_flag
+	}
+	copy.bits(1); // direct_8x8_inference_flag
+	if (copy.bits(1)) // frame_cropping_flag
+	{
+		copy.ue();
+		copy.ue();
+		copy.ue();
+		copy.ue();
+	}
+
+	// the VUI up to bitstream_restriction_flag is kept
+	bool vui = reader.bits(1);
+	writer.bits(1, 1);
+	if (vui)
+	{
+		if (copy.bits(1)) // aspect_ratio_info_present_flag
+		{
+			if (copy.bits(8) == 255) // Extended_SAR
+			{
+				copy.bits(16);
+				copy.bits(16);
+			}
+		}
+		if (copy.bits(1)) // overscan_info_present_flag
+		{
+			copy.bits(1);
+		}
+		if (copy.bits(1)) // video_signal_type_present_flag
+		{
+			copy.bits(4);
+			if (copy.bits(1)) // colour_description_present_flag
+			{
+				copy.bits(24);
+			}
+		}
+		if (copy.bits(1)) // chroma_loc_info_present_flag
+		{
+			copy.ue();
+			copy.ue();
+		}
+		if (copy.bits(1)) // timing_info_present_flag
+		{
+			copy.bits(32);
+			copy.bits(32);
+			copy.bits(1);
+		}
+		bool nalHrd = copy.bits(1);
+		if (nalHrd)
+		{
+			copy.hrdParameters();
+		}
+		bool vclHrd = copy.bits(1);
+		if (vclHrd)
+		{
+			copy.hrdParameters();
+		}
+		if (nalHrd || vclHrd)
+		{
+			copy.bits(1); // low_delay_hrd_flag
+		}
+		copy.bits(1); // pic_struct_present_flag
+	}
+	else
+	{
+		// aspect ratio, overscan, video signal, chroma location, timing, NAL HRD, VCL HRD, pic_struct
+		writer.bits(8, 0);
+	}
+
+	writer.bits(1, 1); // bitstream_restriction_flag
+	if (vui && reader.bits(1))
+	{
+		copy.bits(1); // motion_vectors_over_pic_boundaries_flag
+		copy.ue();    // max_bytes_per_pic_denom
+		copy.ue();    // max_bits_per_mb_denom
+		copy.ue();    // log2_max_mv_length_horizontal
+		copy.ue();    // log2_max_mv_length_vertical
+		unsigned int reorder = reader.ue();
+		unsigned int buffering = reader.ue();
+		if (reorder != 0)
+		{
+			// B-frames, the encoder knows better
+			return false;
+		}
+		if (buffering == maxRefFrames)
+		{
+			return false;
+		}
+	}
+	else
+	{
+		// values inferred when bitstream_restriction_flag is 0
+		writer.bits(1, 1);
+		writer.ue(2);
+		writer.ue(1);
+		writer.ue(15);
+		writer.ue(15);
+	}
+	writer.ue(0); // max_num_reorder_frames
+	writer.ue(maxRefFrames);
+
+	if (reader.error())
+	{
+		return false;
+	}
+
+	out.assign(1, (char)nal[0]);
+	writer.finish(out);
+	return true;
+}
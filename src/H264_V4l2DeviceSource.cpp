@@ -9,14 +9,14 @@
 **
 ** -------------------------------------------------------------------------*/
 
-#include <sstream>
+#include <string.h>
 
-// live555
-#include <Base64.hh>
+#include <sstream>
 
 // project
 #include "logger.h"
 #include "H264_V4l2DeviceSource.h"
+#include "H264SpsRewriter.h"
 
 // ---------------------------------
 // H264 V4L2 FramedSource
@@ -27,74 +27,106 @@ std::list<std::pair<unsigned char *, size_t>> H264_V4L2DeviceSource::splitFrames
 {
 	std::list<std::pair<unsigned char *, size_t>> frameList;
 
-	size_t bufSize = frameSize;
-	size_t size = 0;
-	int frameType = 0;
-	unsigned char *buffer = this->extractFrame(frame, bufSize, size, frameType);
-	while (buffer != NULL)
+	const std::vector<StartCodeScanner::NalUnit> &nalUnits = this->extractFrames(frame, frameSize);
+	for (std::vector<StartCodeScanner::NalUnit>::const_iterator it = nalUnits.begin(); it != nalUnits.end(); ++it)
 	{
+		unsigned char *buffer = it->m_buffer;
+		size_t size = it->m_size;
+		int frameType = buffer[it->m_markerSize];
 		switch (frameType & 0x1F)
 		{
 		case 7:
-			LOG(INFO) << "SPS size:" << size << " bufSize:" << bufSize;
-			m_sps.assign((char *)buffer, size);
-			m_pps.clear();
+			LOG(INFO) << "SPS size:" << size;
+			if (m_zeroReorder.load())
+			{
+				// the rewritten copy goes to the stream in place of the encoder one
+				const std::string &rewritten = this->rewriteSps(buffer, size);
+				m_paramSets.update(ParameterSetCache::SLOT_SPS, (const unsigned char *)rewritten.data(), rewritten.size());
+				const std::string &sps = m_paramSets.get(ParameterSetCache::SLOT_SPS);
+				buffer = (unsigned char *)sps.c_str();
+				size = sps.size();
+			}
+			else
+			{
+				m_paramSets.update(ParameterSetCache::SLOT_SPS, buffer, size);
+			}
 			break;
 		case 8:
-			LOG(INFO) << "PPS size:" << size << " bufSize:" << bufSize;
-			m_pps.assign((char *)buffer, size);
+			LOG(INFO) << "PPS size:" << size;
+			m_paramSets.update(ParameterSetCache::SLOT_PPS, buffer, size);
 			break;
 		case 5:
-			LOG(INFO) << "IDR size:" << size << " bufSize:" << bufSize;
-			if (m_repeatConfig && !m_sps.empty() && !m_pps.empty())
-			{
-				frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)m_sps.c_str(), m_sps.size()));
-				frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)m_pps.c_str(), m_pps.size()));
-			}
-			if (!m_sps.empty() && !m_pps.empty())
+			LOG(INFO) << "IDR size:" << size;
+			if (m_paramSets.has(ParameterSetCache::SLOT_SPS) && m_paramSets.has(ParameterSetCache::SLOT_PPS))
 			{
-				std::lock_guard<std::mutex> lock(m_lastFrameMutex);
-				m_lastFrame.assign(H264marker, sizeof(H264marker));
-				m_lastFrame.append(m_sps.c_str(), m_sps.size());
-				m_lastFrame.append(H264marker, sizeof(H264marker));
-				m_lastFrame.append(m_pps.c_str(), m_pps.size());
-				m_lastFrame.append(H264marker, sizeof(H264marker));
-				m_lastFrame.append((char *)buffer, size);
+				const std::string &sps = m_paramSets.get(ParameterSetCache::SLOT_SPS);
+				const std::string &pps = m_paramSets.get(ParameterSetCache::SLOT_PPS);
+				if (m_repeatConfig)
+				{
+					frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)sps.c_str(), sps.size()));
+					frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)pps.c_str(), pps.size()));
+				}
+				// referenced, not copied: the image is built when a snapshot is read
+				if (!m_pendingKeyFrame)
+				{
+					KeyFrame &keyFrame = this->startKeyFrame();
+					keyFrame.add(H264marker, sizeof(H264marker));
+					keyFrame.add(sps.c_str(), sps.size());
+					keyFrame.add(H264marker, sizeof(H264marker));
+					keyFrame.add(pps.c_str(), pps.size());
+				}
+				m_pendingKeyFrame->add(H264marker, sizeof(H264marker));
+				m_pendingKeyFrame->add(buffer, size);
 			}
 			break;
 		default:
 			break;
 		}
+		frameList.push_back(std::pair<unsigned char *, size_t>(buffer, size));
+	}
 
-		if (!m_sps.empty() && !m_pps.empty())
-		{
-			u_int32_t profile_level_id = 0;
-			if (m_sps.size() >= 4)
-				profile_level_id = (((unsigned char)m_sps[1]) << 16) | (((unsigned char)m_sps[2]) << 8) | ((unsigned char)m_sps[3]);
-
-			char *sps_base64 = base64Encode(m_sps.c_str(), m_sps.size());
-			char *pps_base64 = base64Encode(m_pps.c_str(), m_pps.size());
+	// the SDP only follows actual parameter set changes
+	if (m_paramSets.takeChange() && m_paramSets.has(ParameterSetCache::SLOT_SPS) && m_paramSets.has(ParameterSetCache::SLOT_PPS))
+	{
+		const std::string &sps = m_paramSets.get(ParameterSetCache::SLOT_SPS);
+		u_int32_t profile_level_id = 0;
+		const unsigned char *nal = this->getNalHeader((const unsigned char *)sps.data(), sps.size(), 4);
+		if (nal != NULL)
+			profile_level_id = (nal[1] << 16) | (nal[2] << 8) | nal[3];
 
-			std::ostringstream os;
-			os << "profile-level-id=" << std::hex << std::setw(6) << std::setfill('0') << profile_level_id;
-			os << ";sprop-parameter-sets=" << sps_base64 << "," << pps_base64;
-			m_auxLine.assign(os.str());
+		std::ostringstream os;
+		os << "packetization-mode=1;profile-level-id=" << std::hex << std::setw(6) << std::setfill('0') << profile_level_id;
+		os << ";sprop-parameter-sets=" << this->getBase64(ParameterSetCache::SLOT_SPS) << "," << this->getBase64(ParameterSetCache::SLOT_PPS);
+		this->setAuxLine(os.str());
+	}
+	return frameList;
+}
 
-			delete[] sps_base64;
-			delete[] pps_base64;
+// SPS with zero reorder frames, the encoder one is parsed again only when it changes
+const std::string &H264_V4L2DeviceSource::rewriteSps(const unsigned char *sps, size_t size)
+{
+	if ((m_encoderSps.size() != size) || (memcmp(m_encoderSps.data(), sps, size) != 0))
+	{
+		m_encoderSps.assign((const char *)sps, size);
+		m_rewrittenSps.assign(m_encoderSps);
+		const unsigned char *nal = this->getNalHeader(sps, size, 1);
+		std::string rewritten;
+		if ((nal != NULL) && H264SpsRewriter::setZeroReorder(nal, size - (nal - sps), rewritten))
+		{
+			// keep the start code if any
+			m_rewrittenSps.assign((const char *)sps, nal - sps);
+			m_rewrittenSps.append(rewritten);
+			LOG(NOTICE) << "SPS rewritten with zero reorder frames size:" << size << "->" << m_rewrittenSps.size();
 		}
-		frameList.push_back(std::pair<unsigned char *, size_t>(buffer, size));
-
-		buffer = this->extractFrame(&buffer[size], bufSize, size, frameType);
 	}
-	return frameList;
+	return m_rewrittenSps;
 }
 
 std::list<std::string> H264_V4L2DeviceSource::getInitFrames()
 {
 	std::list<std::string> frameList;
-	frameList.push_back(this->getFrameWithMarker(m_sps));
-	frameList.push_back(this->getFrameWithMarker(m_pps));
+	frameList.push_back(this->getFrameWithMarker(m_paramSets.get(ParameterSetCache::SLOT_SPS)));
+	frameList.push_back(this->getFrameWithMarker(m_paramSets.get(ParameterSetCache::SLOT_PPS)));
 	return frameList;
 }
 
@@ -107,4 +139,69 @@ bool H264_V4L2DeviceSource::isKeyFrame(const char *buffer, int size)
 		res = (frameType == 5);
 	}
 	return res;
-}
\ No newline at end of file
+}
+
+// access unit delimiter and parameter sets
+bool H264_V4L2DeviceSource::precedesSei(const unsigned char *frame, size_t size)
+{
+	const unsigned char *header = this->getNalHeader(frame, size, 1);
+	if (header == NULL)
+	{
+		return false;
+	}
+	int frameType = header[0] & 0x1F;
+	return (frameType == 7) || (frameType == 8) || (frameType == 9);
+}
+
+V4L2DeviceSource::FrameClass H264_V4L2DeviceSource::classifyFrame(const unsigned char *frame, size_t size)
+{
+	FrameClass frameClass = FRAME_DISPOSABLE;
+	const unsigned char *header = this->getNalHeader(frame, size, 1);
+	if (header != NULL)
+	{
+		switch (header[0] & 0x1F)
+		{
+		case 5:
+			frameClass = FRAME_KEY;
+			break;
+		case 7:
+		case 8:
+			frameClass = FRAME_PARAMSET;
+			break;
+		case 1:
+		case 2:
+		case 3:
+		case 4:
+			// nal_ref_idc == 0 : not used for reference
+			frameClass = (header[0] & 0x60) ? FRAME_REFERENCE : FRAME_DISPOSABLE;
+			break;
+		default:
+			break;
+		}
+	}
+	return frameClass;
+}
+
+bool H264_V4L2DeviceSource::isPicture(const unsigned char *frame, size_t size)
+{
+	const unsigned char *header = this->getNalHeader(frame, size, 1);
+	if (header == NULL)
+	{
+		return false;
+	}
+	int frameType = header[0] & 0x1F;
+	return (frameType >= 1) && (frameType <= 5);
+}
+
+std::list<std::pair<unsigned char *, size_t>> H264_V4L2DeviceSource::getParameterSets()
+{
+	std::list<std::pair<unsigned char *, size_t>> frameList;
+	if (m_paramSets.has(ParameterSetCache::SLOT_SPS) && m_paramSets.has(ParameterSetCache::SLOT_PPS))
+	{
+		const std::string &sps = m_paramSets.get(ParameterSetCache::SLOT_SPS);
+		const std::string &pps = m_paramSets.get(ParameterSetCache::SLOT_PPS);
+		frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)sps.c_str(), sps.size()));
+		frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)pps.c_str(), pps.size()));
+	}
+	return frameList;
+}
@@ -11,9 +11,6 @@
 
 #include <sstream>
 
-// live555
-#include <Base64.hh>
-
 // project
 #include "logger.h"
 #include "H265_V4l2DeviceSource.h"
@@ -23,73 +20,69 @@ std::list<std::pair<unsigned char *, size_t>> H265_V4L2DeviceSource::splitFrames
 {
 	std::list<std::pair<unsigned char *, size_t>> frameList;
 
-	size_t bufSize = frameSize;
-	size_t size = 0;
-	int frameType = 0;
-	unsigned char *buffer = this->extractFrame(frame, bufSize, size, frameType);
-	while (buffer != NULL)
+	const std::vector<StartCodeScanner::NalUnit> &nalUnits = this->extractFrames(frame, frameSize);
+	for (std::vector<StartCodeScanner::NalUnit>::const_iterator it = nalUnits.begin(); it != nalUnits.end(); ++it)
 	{
+		unsigned char *buffer = it->m_buffer;
+		size_t size = it->m_size;
+		int frameType = buffer[it->m_markerSize];
 		switch ((frameType & 0x7E) >> 1)
 		{
 		case 32:
-			LOG(INFO) << "VPS size:" << size << " bufSize:" << bufSize;
-			m_vps.assign((char *)buffer, size);
-			m_sps.clear();
-			m_pps.clear();
+			LOG(INFO) << "VPS size:" << size;
+			m_paramSets.update(ParameterSetCache::SLOT_VPS, buffer, size);
 			break;
 		case 33:
-			LOG(INFO) << "SPS size:" << size << " bufSize:" << bufSize;
-			m_sps.assign((char *)buffer, size);
+			LOG(INFO) << "SPS size:" << size;
+			m_paramSets.update(ParameterSetCache::SLOT_SPS, buffer, size);
 			break;
 		case 34:
-			LOG(INFO) << "PPS size:" << size << " bufSize:" << bufSize;
-			m_pps.assign((char *)buffer, size);
+			LOG(INFO) << "PPS size:" << size;
+			m_paramSets.update(ParameterSetCache::SLOT_PPS, buffer, size);
 			break;
 		case 19:
 		case 20:
-			LOG(INFO) << "IDR size:" << size << " bufSize:" << bufSize;
-			if (m_repeatConfig && !m_vps.empty() && !m_sps.empty() && !m_pps.empty())
-			{
-				frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)m_vps.c_str(), m_vps.size()));
-				frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)m_sps.c_str(), m_sps.size()));
-				frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)m_pps.c_str(), m_pps.size()));
-			}
-			if (!m_vps.empty() && !m_sps.empty() && !m_pps.empty())
+			LOG(INFO) << "IDR size:" << size;
+			if (m_paramSets.has(ParameterSetCache::SLOT_VPS) && m_paramSets.has(ParameterSetCache::SLOT_SPS) && m_paramSets.has(ParameterSetCache::SLOT_PPS))
 			{
-				std::lock_guard<std::mutex> lock(m_lastFrameMutex);
-				m_lastFrame.assign(H264marker, sizeof(H264marker));
-				m_lastFrame.append(m_vps.c_str(), m_vps.size());
-				m_lastFrame.append(H264marker, sizeof(H264marker));
-				m_lastFrame.append(m_sps.c_str(), m_sps.size());
-				m_lastFrame.append(H264marker, sizeof(H264marker));
-				m_lastFrame.append(m_pps.c_str(), m_pps.size());
-				m_lastFrame.append(H264marker, sizeof(H264marker));
-				m_lastFrame.append((char *)buffer, size);
+				const std::string &vps = m_paramSets.get(ParameterSetCache::SLOT_VPS);
+				const std::string &sps = m_paramSets.get(ParameterSetCache::SLOT_SPS);
+				const std::string &pps = m_paramSets.get(ParameterSetCache::SLOT_PPS);
+				if (m_repeatConfig)
+				{
+					frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)vps.c_str(), vps.size()));
+					frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)sps.c_str(), sps.size()));
+					frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)pps.c_str(), pps.size()));
+				}
+				// referenced, not copied: the image is built when a snapshot is read
+				if (!m_pendingKeyFrame)
+				{
+					KeyFrame &keyFrame = this->startKeyFrame();
+					keyFrame.add(H264marker, sizeof(H264marker));
+					keyFrame.add(vps.c_str(), vps.size());
+					keyFrame.add(H264marker, sizeof(H264marker));
+					keyFrame.add(sps.c_str(), sps.size());
+					keyFrame.add(H264marker, sizeof(H264marker));
+					keyFrame.add(pps.c_str(), pps.size());
+				}
+				m_pendingKeyFrame->add(H264marker, sizeof(H264marker));
+				m_pendingKeyFrame->add(buffer, size);
 			}
 			break;
 		default:
 			break;
 		}
-
-		if (!m_vps.empty() && !m_sps.empty() && !m_pps.empty())
-		{
-			char *vps_base64 = base64Encode(m_vps.c_str(), m_vps.size());
-			char *sps_base64 = base64Encode(m_sps.c_str(), m_sps.size());
-			char *pps_base64 = base64Encode(m_pps.c_str(), m_pps.size());
-
-			std::ostringstream os;
-			os << "sprop-vps=" << vps_base64;
-			os << ";sprop-sps=" << sps_base64;
-			os << ";sprop-pps=" << pps_base64;
-			m_auxLine.assign(os.str());
-
-			delete[] vps_base64;
-			delete[] sps_base64;
-			delete[] pps_base64;
-		}
 		frameList.push_back(std::pair<unsigned char *, size_t>(buffer, size));
+	}
 
-		buffer = this->extractFrame(&buffer[size], bufSize, size, frameType);
+	// the SDP only follows actual parameter set changes
+	if (m_paramSets.takeChange() && m_paramSets.has(ParameterSetCache::SLOT_VPS) && m_paramSets.has(ParameterSetCache::SLOT_SPS) && m_paramSets.has(ParameterSetCache::SLOT_PPS))
+	{
+		std::ostringstream os;
+		os << "sprop-vps=" << this->getBase64(ParameterSetCache::SLOT_VPS);
+		os << ";sprop-sps=" << this->getBase64(ParameterSetCache::SLOT_SPS);
+		os << ";sprop-pps=" << this->getBase64(ParameterSetCache::SLOT_PPS);
+		this->setAuxLine(os.str());
 	}
 	return frameList;
 }
@@ -97,9 +90,9 @@ std::list<std::pair<unsigned char *, size_t>> H265_V4L2DeviceSource::splitFrames
 std::list<std::string> H265_V4L2DeviceSource::getInitFrames()
 {
 	std::list<std::string> frameList;
-	frameList.push_back(this->getFrameWithMarker(m_vps));
-	frameList.push_back(this->getFrameWithMarker(m_sps));
-	frameList.push_back(this->getFrameWithMarker(m_pps));
+	frameList.push_back(this->getFrameWithMarker(m_paramSets.get(ParameterSetCache::SLOT_VPS)));
+	frameList.push_back(this->getFrameWithMarker(m_paramSets.get(ParameterSetCache::SLOT_SPS)));
+	frameList.push_back(this->getFrameWithMarker(m_paramSets.get(ParameterSetCache::SLOT_PPS)));
 	return frameList;
 }
 
@@ -112,4 +105,65 @@ bool H265_V4L2DeviceSource::isKeyFrame(const char *buffer, int size)
 		res = (frameType == 19 || frameType == 20);
 	}
 	return res;
-}
\ No newline at end of file
+}
+
+// parameter sets and access unit delimiter
+bool H265_V4L2DeviceSource::precedesSei(const unsigned char *frame, size_t size)
+{
+	const unsigned char *header = this->getNalHeader(frame, size, 2);
+	if (header == NULL)
+	{
+		return false;
+	}
+	int frameType = (header[0] & 0x7E) >> 1;
+	return (frameType >= 32) && (frameType <= 35);
+}
+
+V4L2DeviceSource::FrameClass H265_V4L2DeviceSource::classifyFrame(const unsigned char *frame, size_t size)
+{
+	FrameClass frameClass = FRAME_DISPOSABLE;
+	const unsigned char *header = this->getNalHeader(frame, size, 2);
+	if (header != NULL)
+	{
+		int frameType = (header[0] & 0x7E) >> 1;
+		if ((frameType >= 16) && (frameType <= 21))
+		{
+			frameClass = FRAME_KEY;
+		}
+		else if ((frameType >= 32) && (frameType <= 34))
+		{
+			frameClass = FRAME_PARAMSET;
+		}
+		else if (frameType < 16)
+		{
+			// even VCL types are sub-layer non-reference pictures
+			frameClass = (frameType & 1) ? FRAME_REFERENCE : FRAME_DISPOSABLE;
+		}
+	}
+	return frameClass;
+}
+
+bool H265_V4L2DeviceSource::isPicture(const unsigned char *frame, size_t size)
+{
+	const unsigned char *header = this->getNalHeader(frame, size, 2);
+	if (header == NULL)
+	{
+		return false;
+	}
+	int frameType = (header[0] & 0x7E) >> 1;
+	return (frameType < 32);
+}
+
+std::list<std::pair<unsigned char *, size_t>> H265_V4L2DeviceSource::getParameterSets()
+{
+	std::list<std::pair<unsigned char *, size_t>> frameList;
+	if (m_paramSets.has(ParameterSetCache::SLOT_VPS) && m_paramSets.has(ParameterSetCache::SLOT_SPS) && m_paramSets.has(ParameterSetCache::SLOT_PPS))
+	{
+		for (int slot = ParameterSetCache::SLOT_VPS; slot <= ParameterSetCache::SLOT_PPS; ++slot)
+		{
+			const std::string &paramSet = m_paramSets.get((ParameterSetCache::Slot)slot);
+			frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)paramSet.c_str(), paramSet.size()));
+		}
+	}
+	return frameList;
+}
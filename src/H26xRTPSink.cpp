@@ -0,0 +1,401 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** H26xRTPSink.cpp
+**
+** H264/H265 RTP sink aggregating small NAL units
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "logger.h"
+#include "LatencyHistogram.h"
+#include "BatchGroupsock.h"
+#include "V4L2DeviceSource.h"
+#include "H26xRTPSink.h"
+
+unsigned int H26xPacketizer::s_pacingBurst = 16 * 1024;
+
+// ---------------------------------
+//   H264/H265 RTP payloader
+// ---------------------------------
+H26xPacketizer::H26xPacketizer(UsageEnvironment &env, FramedSource *inputSource, int hNumber, unsigned int maxPayloadSize)
+	: FramedFilter(env, inputSource), m_hNumber(hNumber), m_headerSize((hNumber == 264) ? 1 : 2), m_maxPayloadSize(maxPayloadSize),
+	  m_input(NULL), m_auSource(NULL), m_nal(NULL), m_nalBufferSize(0), m_nalSize(0), m_nalOffset(0), m_nalEndsAccessUnit(false), m_nalDuration(0),
+	  m_aggregateCount(0), m_endsAccessUnit(false),
+	  m_rate(0), m_tokens(0), m_tokenTime(0), m_departure(0), m_endsBurst(false), m_txTime(false), m_pacingTask(NULL)
+{
+	m_aggregate.reserve(maxPayloadSize);
+	memset(&m_nalTime, 0, sizeof(m_nalTime));
+	memset(&m_aggregateTime, 0, sizeof(m_aggregateTime));
+}
+
+H26xPacketizer::~H26xPacketizer()
+{
+	envir().taskScheduler().unscheduleDelayedTask(m_pacingTask);
+	delete[] m_nal;
+	// the framer belongs to the subsession
+	detachInputSource();
+}
+
+void H26xPacketizer::doGetNextFrame()
+{
+	if (m_nalOffset != 0)
+	{
+		// next fragment
+		this->deliverNalUnit();
+	}
+	else if (m_nalSize != 0)
+	{
+		// NAL unit read while the aggregation was flushed
+		this->processNalUnit();
+	}
+	else
+	{
+		this->getNextNalUnit();
+	}
+}
+
+void H26xPacketizer::doStopGettingFrames()
+{
+	m_nalSize = 0;
+	m_nalOffset = 0;
+	m_aggregate.clear();
+	m_aggregateCount = 0;
+	envir().taskScheduler().unscheduleDelayedTask(m_pacingTask);
+	FramedFilter::doStopGettingFrames();
+}
+
+// the buffer takes the largest frame of the device rather than live555's 2 MB
+void H26xPacketizer::findAccessUnitSource()
+{
+	m_input = fInputSource;
+	m_auSource = AccessUnitSource::find(fInputSource);
+	unsigned int size = (m_auSource != NULL) ? m_auSource->maxFrameSize() : 0;
+	if (size == 0)
+	{
+		size = OutPacketBuffer::maxSize;
+	}
+	if (size != m_nalBufferSize)
+	{
+		delete[] m_nal;
+		m_nalBufferSize = size;
+		m_nal = new unsigned char[m_nalBufferSize];
+	}
+}
+
+void H26xPacketizer::getNextNalUnit()
+{
+	if (fInputSource != m_input)
+	{
+		this->findAccessUnitSource();
+	}
+	fInputSource->getNextFrame(m_nal, m_nalBufferSize, afterGettingFrame, this, FramedSource::handleClosure, this);
+}
+
+void H26xPacketizer::afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime, unsigned durationInMicroseconds)
+{
+	if (numTruncatedBytes > 0)
+	{
+		LOG(WARN) << "NAL unit truncated by " << numTruncatedBytes << " bytes, buffer size:" << m_nalBufferSize;
+	}
+	if (frameSize <= m_headerSize)
+	{
+		this->getNextNalUnit();
+		return;
+	}
+	m_nalSize = frameSize;
+	m_nalOffset = 0;
+	m_nalTime = presentationTime;
+	m_nalDuration = durationInMicroseconds;
+	m_rate = 0;
+	if (m_nalDuration != 0)
+	{
+		m_rate = (unsigned long long)m_nalSize * 1000000 / m_nalDuration;
+	}
+	m_nalEndsAccessUnit = this->isVCL(m_nal) || ((m_auSource != NULL) && m_auSource->lastFrameEndsAccessUnit());
+	this->processNalUnit();
+}
+
+// a slice ends the access unit, the same assumption as the live555 discrete framer
+bool H26xPacketizer::isVCL(const unsigned char *nal) const
+{
+	if (m_hNumber == 264)
+	{
+		int type = nal[0] & 0x1F;
+		return (type >= 1) && (type <= 5);
+	}
+	return ((nal[0] & 0x7E) >> 1) < 32;
+}
+
+bool H26xPacketizer::canAggregate(unsigned int size) const
+{
+	return m_headerSize + m_aggregate.size() + 2 + size <= m_maxPayloadSize;
+}
+
+void H26xPacketizer::aggregate(const unsigned char *nal, unsigned int size)
+{
+	if (m_aggregateCount == 0)
+	{
+		m_aggregateTime = m_nalTime;
+	}
+	m_aggregate.push_back((unsigned char)(size >> 8));
+	m_aggregate.push_back((unsigned char)(size & 0xFF));
+	m_aggregate.insert(m_aggregate.end(), nal, nal + size);
+	m_aggregateCount++;
+}
+
+void H26xPacketizer::processNalUnit()
+{
+	bool sameTime = (m_nalTime.tv_sec == m_aggregateTime.tv_sec) && (m_nalTime.tv_usec == m_aggregateTime.tv_usec);
+	if ((m_aggregateCount > 0) && (!sameTime || !this->canAggregate(m_nalSize)))
+	{
+		// the NAL unit waits for the next call; one of a later time tells the
+		// held access unit is over, when its source did not
+		this->deliverAggregate(!sameTime);
+	}
+	else if (this->canAggregate(m_nalSize) && (!m_nalEndsAccessUnit || (m_aggregateCount > 0)))
+	{
+		this->aggregate(m_nal, m_nalSize);
+		m_nalSize = 0;
+		if (m_nalEndsAccessUnit)
+		{
+			this->deliverAggregate(true);
+		}
+		else
+		{
+			// the rest of the access unit is normally already queued
+			this->getNextNalUnit();
+		}
+	}
+	else
+	{
+		this->deliverNalUnit();
+	}
+}
+
+void H26xPacketizer::deliverAggregate(bool endsAccessUnit)
+{
+	if (m_aggregateCount == 1)
+	{
+		// nothing to aggregate with, sent as a single NAL unit
+		fFrameSize = m_aggregate.size() - 2;
+		memcpy(fTo, &m_aggregate[2], fFrameSize);
+	}
+	else if (m_hNumber == 264)
+	{
+		// STAP-A: F is set if any unit has it, NRI is the highest one
+		unsigned char header = 24;
+		for (size_t pos = 0; pos < m_aggregate.size(); pos += 2 + ((m_aggregate[pos] << 8) | m_aggregate[pos + 1]))
+		{
+			unsigned char nal = m_aggregate[pos + 2];
+			header |= (nal & 0x80);
+			if ((nal & 0x60) > (header & 0x60))
+			{
+				header = (header & ~0x60) | (nal & 0x60);
+			}
+		}
+		fTo[0] = header;
+		memcpy(fTo + 1, &m_aggregate[0], m_aggregate.size());
+		fFrameSize = 1 + m_aggregate.size();
+	}
+	else
+	{
+		// AP: LayerId and TID are the lowest ones of the units
+		unsigned int layerId = 63;
+		unsigned int tid = 7;
+		unsigned char forbidden = 0;
+		for (size_t pos = 0; pos < m_aggregate.size(); pos += 2 + ((m_aggregate[pos] << 8) | m_aggregate[pos + 1]))
+		{
+			const unsigned char *nal = &m_aggregate[pos + 2];
+			forbidden |= (nal[0] & 0x80);
+			layerId = std::min(layerId, (unsigned int)(((nal[0] & 0x01) << 5) | (nal[1] >> 3)));
+			tid = std::min(tid, (unsigned int)(nal[1] & 0x07));
+		}
+		fTo[0] = forbidden | (48 << 1) | (layerId >> 5);
+		fTo[1] = ((layerId & 0x1F) << 3) | tid;
+		memcpy(fTo + 2, &m_aggregate[0], m_aggregate.size());
+		fFrameSize = 2 + m_aggregate.size();
+	}
+	fNumTruncatedBytes = 0;
+	fPresentationTime = m_aggregateTime;
+	fDurationInMicroseconds = 0;
+	m_endsAccessUnit = endsAccessUnit;
+
+	m_aggregate.clear();
+	m_aggregateCount = 0;
+	this->sendPayload();
+}
+
+void H26xPacketizer::deliverNalUnit()
+{
+	if ((m_nalOffset == 0) && (m_nalSize <= m_maxPayloadSize))
+	{
+		memcpy(fTo, m_nal, m_nalSize);
+		fFrameSize = m_nalSize;
+		m_endsAccessUnit = m_nalEndsAccessUnit;
+		m_nalSize = 0;
+	}
+	else
+	{
+		// FU-A / FU, the NAL header is rebuilt from the fragmentation headers
+		bool start = (m_nalOffset == 0);
+		if (start)
+		{
+			m_nalOffset = m_headerSize;
+		}
+		unsigned int size = std::min(m_maxPayloadSize - m_headerSize - 1, m_nalSize - m_nalOffset);
+		bool end = (m_nalOffset + size == m_nalSize);
+		unsigned char type;
+		if (m_hNumber == 264)
+		{
+			type = m_nal[0] & 0x1F;
+			fTo[0] = (m_nal[0] & 0xE0) | 28;
+		}
+		else
+		{
+			type = (m_nal[0] & 0x7E) >> 1;
+			fTo[0] = (m_nal[0] & 0x81) | (49 << 1);
+			fTo[1] = m_nal[1];
+		}
+		fTo[m_headerSize] = (start ? 0x80 : 0) | (end ? 0x40 : 0) | type;
+		memcpy(fTo + m_headerSize + 1, m_nal + m_nalOffset, size);
+		fFrameSize = m_headerSize + 1 + size;
+		m_nalOffset += size;
+
+		m_endsAccessUnit = end && m_nalEndsAccessUnit;
+		if (end)
+		{
+			m_nalSize = 0;
+			m_nalOffset = 0;
+		}
+	}
+	fNumTruncatedBytes = 0;
+	fPresentationTime = m_nalTime;
+	// the sink sends the next packet as soon as it gets it, the pacing is done here
+	fDurationInMicroseconds = 0;
+	this->sendPayload();
+}
+
+void H26xPacketizer::sendPayload()
+{
+	m_departure = 0;
+	m_endsBurst = false;
+	if (m_rate == 0)
+	{
+		afterGetting(this);
+		return;
+	}
+
+	unsigned long long now = LatencyHistogram::now();
+	if (now > m_tokenTime)
+	{
+		// the time of the bytes not credited yet is kept for the next call
+		unsigned long long refill = (now - m_tokenTime) * m_rate / 1000000;
+		m_tokens += refill;
+		m_tokenTime += refill * 1000000 / m_rate;
+	}
+	if (m_tokens > (long long)s_pacingBurst)
+	{
+		m_tokens = s_pacingBurst;
+		m_tokenTime = now;
+	}
+	m_tokens -= fFrameSize;
+	// a full payload after this one would wait: without SO_TXTIME the groupsock
+	// has to send what it holds now, not when the held payload comes
+	m_endsBurst = !m_txTime && (m_tokens < (long long)m_maxPayloadSize);
+	if (m_tokens >= 0)
+	{
+		afterGetting(this);
+		return;
+	}
+
+	// the payload leaves once the bucket is back to zero
+	unsigned long long wait = (unsigned long long)(-m_tokens) * 1000000 / m_rate;
+	m_departure = now + wait;
+	if (m_txTime || (wait == 0))
+	{
+		afterGetting(this);
+	}
+	else
+	{
+		m_pacingTask = envir().taskScheduler().scheduleDelayedTask(wait, pacingTask, this);
+	}
+}
+
+// ---------------------------------
+//   H264/H265 RTP sink
+// ---------------------------------
+H26xRTPSink::~H26xRTPSink()
+{
+	if (m_packetizer != NULL)
+	{
+		// stop with the payloader as source, it is gone when the base class stops
+		fSource = m_packetizer;
+		this->stopPlaying();
+		Medium::close(m_packetizer);
+		fSource = NULL;
+	}
+}
+
+Boolean H26xRTPSink::continuePlaying()
+{
+	m_payloadSource = dynamic_cast<H26xPayloadSource *>(fSource);
+	if (m_payloadSource == NULL)
+	{
+		if (m_packetizer == NULL)
+		{
+			m_packetizer = H26xPacketizer::createNew(envir(), fSource, m_hNumber, ourMaxPacketSize() - 12 /* RTP header */);
+		}
+		else
+		{
+			m_packetizer->reassignInputSource(fSource);
+		}
+		fSource = m_packetizer;
+		m_payloadSource = m_packetizer;
+	}
+	m_payloadSource->configure(ourMaxPacketSize() - 12 /* RTP header */, this->groupsockTxTime());
+	return MultiFramedRTPSink::continuePlaying();
+}
+
+void H26xRTPSink::doSpecialFrameHandling(unsigned /*fragmentationOffset*/, unsigned char * /*frameStart*/, unsigned /*numBytesInFrame*/, struct timeval framePresentationTime, unsigned /*numRemainingBytes*/)
+{
+	if ((m_payloadSource != NULL) && m_payloadSource->lastPayloadEndsAccessUnit())
+	{
+		setMarkerBit();
+	}
+	setTimestamp(framePresentationTime);
+#if LIVEMEDIA_LIBRARY_VERSION_INT >= 1611187200
+	BatchGroupsock *groupsock = dynamic_cast<BatchGroupsock *>(&groupsockBeingUsed());
+	if ((groupsock != NULL) && (m_payloadSource != NULL))
+	{
+		groupsock->setDeparture(m_payloadSource->lastPayloadDeparture());
+		if (m_payloadSource->lastPayloadEndsBurst())
+		{
+			groupsock->endBurst();
+		}
+	}
+#endif
+}
+
+// the kernel holds the packets up to their departure time, only for UDP destinations
+bool H26xRTPSink::groupsockTxTime()
+{
+#if LIVEMEDIA_LIBRARY_VERSION_INT >= 1611187200
+	BatchGroupsock *groupsock = dynamic_cast<BatchGroupsock *>(&groupsockBeingUsed());
+	return (groupsock != NULL) && groupsock->sendsAtDeparture();
+#else
+	return false;
+#endif
+}
+
+// one payload per packet, the payloader does the aggregation
+Boolean H26xRTPSink::frameCanAppearAfterPacketStart(unsigned char const * /*frameStart*/, unsigned /*numBytesInFrame*/) const
+{
+	return False;
+}
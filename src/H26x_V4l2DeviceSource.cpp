@@ -18,65 +18,81 @@
 #include "logger.h"
 #include "H26x_V4l2DeviceSource.h"
 
-// extract a frame
-unsigned char *H26X_V4L2DeviceSource::extractFrame(unsigned char *frame, size_t &size, size_t &outsize, int &frameType)
+// NAL units of an access unit, start codes kept or stripped as configured
+const std::vector<StartCodeScanner::NalUnit> &H26X_V4L2DeviceSource::extractFrames(unsigned char *frame, size_t size)
 {
-	unsigned char *outFrame = NULL;
-	outsize = 0;
-	unsigned int markerlength = 0;
-	frameType = 0;
-
-	unsigned char *startFrame = (unsigned char *)memmem(frame, size, H264marker, sizeof(H264marker));
-	if (startFrame != NULL)
+	StartCodeScanner::scan(frame, size, m_nalUnits);
+	if (m_nalUnits.empty() && (size >= sizeof(H264shortmarker)))
 	{
-		markerlength = sizeof(H264marker);
+		LOG(INFO) << "No marker found";
 	}
-	else
+	if (!m_keepMarker)
 	{
-		startFrame = (unsigned char *)memmem(frame, size, H264shortmarker, sizeof(H264shortmarker));
-		if (startFrame != NULL)
+		for (std::vector<StartCodeScanner::NalUnit>::iterator it = m_nalUnits.begin(); it != m_nalUnits.end(); ++it)
 		{
-			markerlength = sizeof(H264shortmarker);
+			it->m_buffer += it->m_markerSize;
+			it->m_size -= it->m_markerSize;
+			it->m_markerSize = 0;
 		}
 	}
-	if (startFrame != NULL)
-	{
-		frameType = startFrame[markerlength];
+	return m_nalUnits;
+}
 
-		int remainingSize = size - (startFrame - frame + markerlength);
-		unsigned char *endFrame = (unsigned char *)memmem(&startFrame[markerlength], remainingSize, H264marker, sizeof(H264marker));
-		if (endFrame == NULL)
-		{
-			endFrame = (unsigned char *)memmem(&startFrame[markerlength], remainingSize, H264shortmarker, sizeof(H264shortmarker));
-		}
+// The SEI buffers are recycled after as many access units as the capture
+// buffers, by then the access unit that used it has been released.
+void H26X_V4L2DeviceSource::addCaptureTime(std::list<std::pair<unsigned char *, size_t>> &frameList, const timeval &ref)
+{
+	if (!m_captureTimeSei.load())
+	{
+		return;
+	}
+	timeval captureTime = ref;
+	m_device->getCaptureTime(captureTime);
+	unsigned long long time = captureTime.tv_sec * 1000000ULL + captureTime.tv_usec;
 
-		if (m_keepMarker)
-		{
-			size -= startFrame - frame;
-			outFrame = startFrame;
-		}
-		else
-		{
-			size -= startFrame - frame + markerlength;
-			outFrame = &startFrame[markerlength];
-		}
+	// payload type 5, payload size 24
+	std::string payload;
+	payload.push_back(5);
+	payload.push_back(sizeof(CaptureTimeUUID) + 8);
+	payload.append((const char *)CaptureTimeUUID, sizeof(CaptureTimeUUID));
+	for (int shift = 56; shift >= 0; shift -= 8)
+	{
+		payload.push_back((char)((time >> shift) & 0xFF));
+	}
+	payload.push_back((char)0x80);
 
-		if (endFrame != NULL)
-		{
-			outsize = endFrame - outFrame;
-		}
-		else
+	if (m_captureSei.empty())
+	{
+		m_captureSei.resize(m_queueSize + 2);
+	}
+	std::string &sei = m_captureSei[m_captureSeiIndex];
+	m_captureSeiIndex = (m_captureSeiIndex + 1) % m_captureSei.size();
+	sei.clear();
+	if (m_keepMarker)
+	{
+		sei.append(H264marker, sizeof(H264marker));
+	}
+	sei.append(this->getSeiHeader());
+	int zeros = 0;
+	for (size_t i = 0; i < payload.size(); ++i)
+	{
+		unsigned char byte = payload[i];
+		if ((zeros >= 2) && (byte <= 3))
 		{
-			outsize = size;
+			// emulation prevention
+			sei.push_back(3);
+			zeros = 0;
 		}
-		size -= outsize;
+		sei.push_back(byte);
+		zeros = (byte == 0) ? zeros + 1 : 0;
 	}
-	else if (size >= sizeof(H264shortmarker))
+
+	std::list<std::pair<unsigned char *, size_t>>::iterator it = frameList.begin();
+	while ((it != frameList.end()) && this->precedesSei(it->first, it->second))
 	{
-		LOG(INFO) << "No marker found";
+		++it;
 	}
-
-	return outFrame;
+	frameList.insert(it, std::pair<unsigned char *, size_t>((unsigned char *)sei.c_str(), sei.size()));
 }
 
 std::string H26X_V4L2DeviceSource::getFrameWithMarker(const std::string &frame)
@@ -86,3 +102,33 @@ std::string H26X_V4L2DeviceSource::getFrameWithMarker(const std::string &frame)
 	frameWithMarker.append(frame);
 	return frameWithMarker;
 }
+
+const unsigned char *H26X_V4L2DeviceSource::getNalHeader(const unsigned char *frame, size_t size, size_t headerSize)
+{
+	if ((size >= sizeof(H264marker)) && (memcmp(frame, H264marker, sizeof(H264marker)) == 0))
+	{
+		frame += sizeof(H264marker);
+		size -= sizeof(H264marker);
+	}
+	else if ((size >= sizeof(H264shortmarker)) && (memcmp(frame, H264shortmarker, sizeof(H264shortmarker)) == 0))
+	{
+		frame += sizeof(H264shortmarker);
+		size -= sizeof(H264shortmarker);
+	}
+	return (size >= headerSize) ? frame : NULL;
+}
+
+std::string H26X_V4L2DeviceSource::getBase64(ParameterSetCache::Slot slot)
+{
+	std::string encoded;
+	const std::string &paramSet = m_paramSets.get(slot);
+	const unsigned char *nal = this->getNalHeader((const unsigned char *)paramSet.data(), paramSet.size(), 1);
+	if (nal != NULL)
+	{
+		size_t size = paramSet.size() - (nal - (const unsigned char *)paramSet.data());
+		char *base64 = base64Encode((const char *)nal, size);
+		encoded.assign(base64);
+		delete[] base64;
+	}
+	return encoded;
+}
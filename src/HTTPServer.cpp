@@ -21,20 +21,22 @@
 #include "HTTPServer.h"
 
 #include "BaseServerMediaSubsession.h"
+#include "UnicastServerMediaSubsession.h"
 
 u_int32_t HTTPServer::HTTPClientConnection::m_ClientSessionId = 0;
 
-void HTTPServer::HTTPClientConnection::sendHeader(const char *contentType, unsigned int contentLength)
+void HTTPServer::HTTPClientConnection::sendHeader(const char *contentType, unsigned int contentLength, const char *status)
 {
 	// Construct our response:
 	snprintf((char *)fResponseBuffer, sizeof fResponseBuffer,
-			 "HTTP/1.1 200 OK\r\n"
+			 "HTTP/1.1 %s\r\n"
 			 "%s"
 			 "Server: LIVE555 Streaming Media v%s\r\n"
 			 "Access-Control-Allow-Origin: *\r\n"
 			 "Content-Type: %s\r\n"
 			 "Content-Length: %d\r\n"
 			 "\r\n",
+			 status,
 			 dateHeader(),
 			 LIVEMEDIA_LIBRARY_VERSION_STRING,
 			 contentType,
@@ -52,6 +54,14 @@ void HTTPServer::HTTPClientConnection::streamSource(const std::string &content)
 	this->streamSource(ByteStreamMemoryBufferSource::createNew(envir(), buffer, content.size()));
 }
 
+void HTTPServer::HTTPClientConnection::streamSource(const std::shared_ptr<const std::string> &content)
+{
+	// the buffer stays owned by content, held until the source is replaced
+	std::shared_ptr<const std::string> held(content);
+	this->streamSource(ByteStreamMemoryBufferSource::createNew(envir(), (u_int8_t *)held->data(), held->size(), False));
+	m_Content = held;
+}
+
 void HTTPServer::HTTPClientConnection::streamSource(FramedSource *source)
 {
 	if (m_TCPSink != NULL)
@@ -62,7 +72,9 @@ void HTTPServer::HTTPClientConnection::streamSource(FramedSource *source)
 	if (m_Source != NULL)
 	{
 		Medium::close(m_Source);
+		m_Source = NULL;
 	}
+	m_Content.reset();
 	if (source != NULL)
 	{
 		m_TCPSink = new TCPSink(envir(), fClientOutputSocket);
@@ -302,8 +314,12 @@ void HTTPServer::HTTPClientConnection::handleHTTPCmd_StreamingGET(char const *ur
 			{
 				format.replace(pos, 5, "image");
 			}
-			std::string content = baseSubsession->getLastFrame();
-			this->sendHeader(format.c_str(), content.size());
+			std::shared_ptr<const std::string> content = baseSubsession->getLastFrame();
+			if (!content)
+			{
+				content = std::make_shared<const std::string>();
+			}
+			this->sendHeader(format.c_str(), content->size());
 			this->streamSource(content);
 		}
 		else
@@ -347,6 +363,114 @@ void HTTPServer::HTTPClientConnection::handleHTTPCmd_StreamingGET(char const *ur
 		this->sendHeader("text/plain", content.size());
 		this->streamSource(content);
 	}
+	else if (strncmp(urlSuffix, "stats", strlen("stats")) == 0)
+	{
+		std::ostringstream os;
+		os << "{\n";
+		bool first = true;
+		ServerMediaSessionIterator it(fOurServer);
+		ServerMediaSession *serverSession = NULL;
+		while ((serverSession = it.next()) != NULL)
+		{
+			if (!first)
+			{
+				os << ",\n";
+			}
+			first = false;
+			os << " \"" << serverSession->streamName() << "\": [";
+			ServerMediaSubsessionIterator subIt(*serverSession);
+			ServerMediaSubsession *subsession = NULL;
+			bool firstSub = true;
+			while ((subsession = subIt.next()) != NULL)
+			{
+				BaseServerMediaSubsession *baseSubsession = dynamic_cast<BaseServerMediaSubsession *>(subsession);
+				if (baseSubsession)
+				{
+					if (!firstSub)
+					{
+						os << ",";
+					}
+					firstSub = false;
+					os << "{\"format\":\"" << baseSubsession->getFormat() << "\",\"source\":" << baseSubsession->getStats();
+#if LIVEMEDIA_LIBRARY_VERSION_INT >= 1642723200
+					UnicastServerMediaSubsession *unicastSubsession = dynamic_cast<UnicastServerMediaSubsession *>(subsession);
+					if (unicastSubsession)
+					{
+						os << ",\"udp\":" << unicastSubsession->getSendStats();
+					}
+#endif
+					os << "}";
+				}
+			}
+			os << "]";
+		}
+		os << "\n}\n";
+		std::string content(os.str());
+		this->sendHeader("application/json", content.size());
+		this->streamSource(content);
+	}
+	else if (strncmp(urlSuffix, "encoder", strlen("encoder")) == 0)
+	{
+		// encoder?stream=<name>&bitrate=<bit/s>&fps=<fps>&gop=<frames>, missing values are kept
+		std::string streamName;
+		unsigned int bitrate = 0;
+		unsigned int fps = 0;
+		unsigned int gop = 0;
+		if (questionMarkPos != NULL)
+		{
+			std::istringstream is(questionMarkPos + 1);
+			std::string param;
+			while (std::getline(is, param, '&'))
+			{
+				size_t pos = param.find('=');
+				std::string key(param.substr(0, pos));
+				std::string value((pos != std::string::npos) ? param.substr(pos + 1) : "");
+				if (key == "stream")
+				{
+					streamName = value;
+				}
+				else if (key == "bitrate")
+				{
+					bitrate = strtoul(value.c_str(), NULL, 10);
+				}
+				else if (key == "fps")
+				{
+					fps = strtoul(value.c_str(), NULL, 10);
+				}
+				else if (key == "gop")
+				{
+					gop = strtoul(value.c_str(), NULL, 10);
+				}
+			}
+		}
+		if (streamName.empty())
+		{
+			ServerMediaSessionIterator it(fOurServer);
+			ServerMediaSession *serverSession = it.next();
+			if (serverSession != NULL)
+			{
+				streamName = serverSession->streamName();
+			}
+		}
+
+		BaseServerMediaSubsession *baseSubsession = dynamic_cast<BaseServerMediaSubsession *>(this->getSubsesion(streamName.c_str()));
+		std::string content;
+		if (baseSubsession)
+		{
+			content = baseSubsession->setEncoderParams(bitrate, fps, gop);
+		}
+		if (content.empty())
+		{
+			handleHTTPCmd_notSupported();
+			fIsActive = False;
+			return;
+		}
+		content.append("\n");
+		// a change is applied later by the encoder thread
+		bool changed = (bitrate || fps || gop);
+		this->sendHeader("application/json", content.size(), changed ? "202 Accepted" : "200 OK");
+		this->streamSource(content);
+	}
 	else if (questionMarkPos == NULL)
 	{
 		std::string streamName(urlSuffix);
@@ -0,0 +1,90 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** KeyFrameBroker.cpp
+**
+** Coalesce and rate-limit key frame requests of one stream
+**
+** -------------------------------------------------------------------------*/
+
+#include <sstream>
+
+#include "logger.h"
+#include "LatencyHistogram.h"
+#include "KeyFrameBroker.h"
+
+KeyFrameBroker::KeyFrameBroker(DeviceInterface *device, unsigned int intervalMs)
+	: m_device(device), m_interval(intervalMs * 1000ULL), m_lastSent(0), m_served(true), m_deferred(false), m_sent(0), m_coalesced(0), m_keyFrames(0)
+{
+	for (int reason = 0; reason < REASON_COUNT; ++reason)
+	{
+		m_requests[reason] = 0;
+	}
+}
+
+bool KeyFrameBroker::request(Reason reason)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_requests[reason]++;
+	unsigned long long now = LatencyHistogram::now();
+	if ((m_lastSent == 0) || (now - m_lastSent >= m_interval))
+	{
+		return this->send(now);
+	}
+	if (m_served)
+	{
+		// the last key frame already went out, ask again at the end of the interval
+		m_deferred = true;
+	}
+	m_coalesced++;
+	return false;
+}
+
+void KeyFrameBroker::notifyFrame(bool keyFrame)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (keyFrame)
+	{
+		m_keyFrames++;
+		m_served = true;
+		m_deferred = false;
+	}
+	else if (m_deferred)
+	{
+		unsigned long long now = LatencyHistogram::now();
+		if (now - m_lastSent >= m_interval)
+		{
+			this->send(now);
+		}
+	}
+}
+
+void KeyFrameBroker::setInterval(unsigned int ms)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_interval = ms * 1000ULL;
+}
+
+// called with the mutex held
+bool KeyFrameBroker::send(unsigned long long now)
+{
+	m_lastSent = now;
+	m_served = false;
+	m_deferred = false;
+	m_sent++;
+	LOG(DEBUG) << "Request key frame";
+	return m_device && m_device->requestKeyFrame();
+}
+
+std::string KeyFrameBroker::toJSON()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::ostringstream os;
+	os << "{\"join\":" << m_requests[REASON_JOIN] << ",\"feedback\":" << m_requests[REASON_FEEDBACK];
+	os << ",\"segment\":" << m_requests[REASON_SEGMENT] << ",\"recovery\":" << m_requests[REASON_RECOVERY];
+	os << ",\"snapshot\":" << m_requests[REASON_SNAPSHOT];
+	os << ",\"sent\":" << m_sent << ",\"coalesced\":" << m_coalesced << ",\"keyframes\":" << m_keyFrames << "}";
+	return os.str();
+}
@@ -12,7 +12,7 @@
 // -----------------------------------------
 //    MemoryBufferSink
 // -----------------------------------------
-MemoryBufferSink::MemoryBufferSink(UsageEnvironment &env, unsigned bufferSize, unsigned int sliceDuration, unsigned int nbSlices) : MediaSink(env), m_bufferSize(bufferSize), m_refTime(0), m_sliceDuration(sliceDuration), m_nbSlices(nbSlices)
+MemoryBufferSink::MemoryBufferSink(UsageEnvironment &env, unsigned bufferSize, unsigned int sliceDuration, unsigned int nbSlices) : MediaSink(env), m_bufferSize(bufferSize), m_sliceDuration(sliceDuration), m_nbSlices(nbSlices), m_sliceHandler(NULL), m_sliceHandlerData(NULL), m_slice(0), m_sliceStart(0), m_keyFrameCut(false), m_keyFrame(false), m_sliceRequested(false)
 {
 	m_buffer = new unsigned char[m_bufferSize];
 }
@@ -47,13 +47,31 @@ void MemoryBufferSink::afterGettingFrame(unsigned frameSize, unsigned numTruncat
 	}
 	else
 	{
-		// append buffer to slice buffer
-		if (m_refTime == 0)
+		unsigned long long time = (unsigned long long)presentationTime.tv_sec * 1000000 + presentationTime.tv_usec;
+		if (m_outputBuffers.empty())
+		{
+			m_sliceStart = time;
+		}
+		// the next slice starts with the first key frame once the current one is over
+		bool keyFrame = !m_keyFrameCut || m_keyFrame;
+		m_keyFrame = false;
+		if (time >= m_sliceStart + (unsigned long long)m_sliceDuration * 1000000)
 		{
-			m_refTime = presentationTime.tv_sec;
+			if (keyFrame)
+			{
+				m_slice++;
+				m_sliceStart = time;
+				m_sliceRequested = false;
+			}
+			else if ((m_sliceHandler != NULL) && !m_sliceRequested)
+			{
+				m_sliceRequested = true;
+				m_sliceHandler(m_sliceHandlerData, m_slice + 1);
+			}
 		}
-		unsigned int slice = (presentationTime.tv_sec - m_refTime) / m_sliceDuration;
-		std::string &outputBuffer = m_outputBuffers[slice];
+
+		// append buffer to slice buffer
+		std::string &outputBuffer = m_outputBuffers[m_slice];
 		outputBuffer.append((const char *)m_buffer, frameSize);
 
 		// remove old buffers
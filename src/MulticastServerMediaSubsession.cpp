@@ -8,6 +8,8 @@
 ** -------------------------------------------------------------------------*/
 
 #include "MulticastServerMediaSubsession.h"
+#include "FeedbackGroupsock.h"
+#include "ReplicaQueue.h"
 
 // -----------------------------------------
 //    ServerMediaSubsession for Multicast
@@ -20,8 +22,9 @@ MulticastServerMediaSubsession *MulticastServerMediaSubsession::createNew(UsageE
 RTPSink *MulticastServerMediaSubsession::createRtpSink(UsageEnvironment &env, struct in_addr destinationAddress, Port rtpPortNum, Port rtcpPortNum, int ttl, StreamReplicator *replicator)
 {
 	// Create a source
-	FramedSource *source = replicator->createStreamReplica();
-	FramedSource *videoSource = createSource(env, source, m_format);
+	V4L2DeviceSource *deviceSource = dynamic_cast<V4L2DeviceSource *>(replicator->inputSource());
+	FramedSource *source = ReplicaQueue::createNew(env, replicator->createStreamReplica(), deviceSource, "multicast");
+	FramedSource *videoSource = createSource(env, source, m_format, deviceSource);
 
 	// Create RTP/RTCP groupsock
 #if LIVEMEDIA_LIBRARY_VERSION_INT < 1607644800
@@ -41,7 +44,12 @@ RTPSink *MulticastServerMediaSubsession::createRtpSink(UsageEnvironment &env, st
 	unsigned char CNAME[maxCNAMElen + 1];
 	gethostname((char *)CNAME, maxCNAMElen);
 	CNAME[maxCNAMElen] = '\0';
+#if LIVEMEDIA_LIBRARY_VERSION_INT < 1611187200
 	Groupsock *rtcpGroupsock = new Groupsock(env, groupAddress, rtcpPortNum, ttl);
+#else
+	FeedbackGroupsock *rtcpGroupsock = new FeedbackGroupsock(env, groupAddress, rtcpPortNum, ttl);
+	rtcpGroupsock->setFeedbackSource(dynamic_cast<V4L2DeviceSource *>(replicator->inputSource()));
+#endif
 	m_rtcpInstance = RTCPInstance::createNew(env, rtcpGroupsock, 500, CNAME, m_rtpSink, NULL);
 
 	// Start Playing the Sink
@@ -58,8 +66,10 @@ char const *MulticastServerMediaSubsession::sdpLines()
 char const *MulticastServerMediaSubsession::sdpLines(int addressFamily)
 {
 #endif
-	if (m_SDPLines[addressFamily].empty())
+	unsigned int auxVersion = this->getAuxLineVersion();
+	if (m_SDPLines[addressFamily].empty() || (m_SDPVersions[addressFamily] != auxVersion))
 	{
+		m_SDPVersions[addressFamily] = auxVersion;
 		// Ugly workaround to give SPS/PPS that are get from the RTPSink
 #if LIVEMEDIA_LIBRARY_VERSION_INT < 1610928000
 		m_SDPLines[addressFamily].assign(PassiveServerMediaSubsession::sdpLines());
@@ -75,3 +85,10 @@ char const *MulticastServerMediaSubsession::getAuxSDPLine(RTPSink *rtpSink, Fram
 {
 	return this->getAuxLine(dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource()), rtpSink);
 }
+
+void MulticastServerMediaSubsession::startStream(unsigned clientSessionId, void *streamToken, TaskFunc *rtcpRRHandler, void *rtcpRRHandlerClientData, unsigned short &rtpSeqNum, unsigned &rtpTimestamp, ServerRequestAlternativeByteHandler *serverRequestAlternativeByteHandler, void *serverRequestAlternativeByteHandlerClientData)
+{
+	// the stream is already flowing, the new receiver needs a key frame to start
+	this->requestKeyFrame(KeyFrameBroker::REASON_JOIN);
+	PassiveServerMediaSubsession::startStream(clientSessionId, streamToken, rtcpRRHandler, rtcpRRHandlerClientData, rtpSeqNum, rtpTimestamp, serverRequestAlternativeByteHandler, serverRequestAlternativeByteHandlerClientData);
+}
@@ -0,0 +1,414 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** PacketFanout.cpp
+**
+** H264/H265 payloads packetized once and queued for each unicast client
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <termios.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include "logger.h"
+#include "LatencyHistogram.h"
+#include "PacketFanout.h"
+
+// ---------------------------------
+//   Payloads shared by the clients
+// ---------------------------------
+PacketFanout::PacketFanout(UsageEnvironment &env, int hNumber, V4L2DeviceSource *deviceSource)
+	: m_env(env), m_hNumber(hNumber), m_deviceSource(deviceSource), m_source(NULL), m_packetizer(NULL), m_reading(false), m_readTask(NULL)
+{
+}
+
+PacketFanout::~PacketFanout()
+{
+	this->closeSource();
+}
+
+void PacketFanout::setSource(FramedSource *source)
+{
+	this->closeSource();
+	m_source = source;
+}
+
+void PacketFanout::configure(unsigned int maxPayloadSize, bool txTime)
+{
+	if ((m_packetizer == NULL) && (m_source != NULL))
+	{
+		m_packetizer = H26xPacketizer::createNew(m_env, m_source, m_hNumber, maxPayloadSize);
+		m_buffer.resize(maxPayloadSize);
+	}
+	if (m_packetizer != NULL)
+	{
+		m_packetizer->configure(maxPayloadSize, txTime);
+	}
+}
+
+void PacketFanout::addClient(PacketQueue *client)
+{
+	m_clients.push_back(client);
+}
+
+void PacketFanout::removeClient(PacketQueue *client)
+{
+	m_clients.remove(client);
+	if (m_clients.empty())
+	{
+		this->closeSource();
+	}
+}
+
+void PacketFanout::start()
+{
+	if ((m_packetizer != NULL) && !m_reading && (m_readTask == NULL))
+	{
+		this->readNext();
+	}
+}
+
+void PacketFanout::readNext()
+{
+	if ((m_packetizer == NULL) || !this->playing())
+	{
+		return;
+	}
+	m_reading = true;
+	m_packetizer->getNextFrame((unsigned char *)&m_buffer[0], m_buffer.size(), afterGettingPayload, this, onClosure, this);
+}
+
+void PacketFanout::afterGettingPayload(unsigned frameSize, struct timeval presentationTime)
+{
+	m_reading = false;
+	std::shared_ptr<Payload> payload = this->newPayload();
+	payload->m_data.assign(m_buffer.data(), frameSize);
+	payload->m_presentationTime = presentationTime;
+	payload->m_departure = m_packetizer->lastPayloadDeparture();
+	payload->m_endsAccessUnit = m_packetizer->lastPayloadEndsAccessUnit();
+	payload->m_endsBurst = m_packetizer->lastPayloadEndsBurst();
+	payload->m_class = this->classify((const unsigned char *)m_buffer.data(), frameSize);
+	payload->m_queued = LatencyHistogram::now();
+
+	// a client may leave while its sink sends
+	std::list<PacketQueue *>::iterator it = m_clients.begin();
+	while (it != m_clients.end())
+	{
+		PacketQueue *client = *it++;
+		client->push(payload);
+	}
+
+	// the next payload from the event loop, as a sink does
+	m_readTask = m_env.taskScheduler().scheduleDelayedTask(0, readTask, this);
+}
+
+void PacketFanout::onClosure(void *clientData)
+{
+	PacketFanout *fanout = (PacketFanout *)clientData;
+	fanout->m_reading = false;
+	std::list<PacketQueue *>::iterator it = fanout->m_clients.begin();
+	while (it != fanout->m_clients.end())
+	{
+		FramedSource::handleClosure(*it++);
+	}
+}
+
+bool PacketFanout::playing() const
+{
+	for (std::list<PacketQueue *>::const_iterator it = m_clients.begin(); it != m_clients.end(); ++it)
+	{
+		if ((*it)->isPlaying())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// highest class of the NAL units a payload starts, fragments after the first one are not key frames
+V4L2DeviceSource::FrameClass PacketFanout::classify(const unsigned char *payload, unsigned int size) const
+{
+	unsigned int headerSize = (m_hNumber == 264) ? 1 : 2;
+	if ((m_deviceSource == NULL) || (size <= headerSize))
+	{
+		return V4L2DeviceSource::FRAME_INDEPENDENT;
+	}
+	unsigned int type = (m_hNumber == 264) ? (payload[0] & 0x1F) : ((payload[0] & 0x7E) >> 1);
+	unsigned char header[2];
+	if (((m_hNumber == 264) && (type == 28)) || ((m_hNumber != 264) && (type == 49)))
+	{
+		// FU-A / FU
+		const unsigned char fuHeader = payload[headerSize];
+		if ((fuHeader & 0x80) == 0)
+		{
+			return V4L2DeviceSource::FRAME_REFERENCE;
+		}
+		if (m_hNumber == 264)
+		{
+			header[0] = (payload[0] & 0xE0) | (fuHeader & 0x1F);
+		}
+		else
+		{
+			header[0] = (payload[0] & 0x81) | ((fuHeader & 0x3F) << 1);
+			header[1] = payload[1];
+		}
+		return m_deviceSource->classifyFrame(header, headerSize);
+	}
+	if (((m_hNumber == 264) && (type == 24)) || ((m_hNumber != 264) && (type == 48)))
+	{
+		// STAP-A / AP, 16 bits size followed by the NAL unit
+		V4L2DeviceSource::FrameClass frameClass = V4L2DeviceSource::FRAME_DISPOSABLE;
+		unsigned int pos = headerSize;
+		while (pos + 2 + headerSize <= size)
+		{
+			unsigned int nalSize = (payload[pos] << 8) | payload[pos + 1];
+			frameClass = std::max(frameClass, m_deviceSource->classifyFrame(payload + pos + 2, std::min(nalSize, size - pos - 2)));
+			pos += 2 + nalSize;
+		}
+		return frameClass;
+	}
+	return m_deviceSource->classifyFrame(payload, size);
+}
+
+// a payload no client holds anymore, or a new one
+std::shared_ptr<PacketFanout::Payload> PacketFanout::newPayload()
+{
+	std::shared_ptr<Payload> payload;
+	if (!m_payloads.empty() && (m_payloads.front().use_count() == 1))
+	{
+		payload = m_payloads.front();
+		m_payloads.pop_front();
+	}
+	else
+	{
+		payload = std::make_shared<Payload>();
+		if (m_payloads.size() >= MAX_SPARE)
+		{
+			// held by a slow client, freed with its queue
+			m_payloads.pop_front();
+		}
+	}
+	m_payloads.push_back(payload);
+	return payload;
+}
+
+void PacketFanout::closeSource()
+{
+	m_env.taskScheduler().unscheduleDelayedTask(m_readTask);
+	m_reading = false;
+	if (m_packetizer != NULL)
+	{
+		// the payloader leaves the framer to be closed here
+		m_packetizer->stopGettingFrames();
+		Medium::close(m_packetizer);
+		m_packetizer = NULL;
+	}
+	Medium::close(m_source);
+	m_source = NULL;
+	m_payloads.clear();
+}
+
+// ---------------------------------
+//   Payloads of a client
+// ---------------------------------
+PacketQueue::PacketQueue(UsageEnvironment &env, PacketFanout *fanout, V4L2DeviceSource *source, const std::string &name, unsigned int maxBytes)
+	: FramedSource(env), m_fanout(fanout), m_source(source), m_name(name), m_maxBytes(maxBytes), m_queuedBytes(0), m_active(false), m_waitKeyFrame(true),
+	  m_tcpSocket(-1), m_retryTask(NULL), m_endsAccessUnit(false), m_departure(0), m_endsBurst(false),
+	  m_delivered(0), m_dropped(0), m_overflows(0), m_congested(0), m_sendErrors(0), m_maxQueued(0), m_maxLag(0)
+{
+	m_fanout->addClient(this);
+	if (m_source)
+	{
+		m_source->addConsumer(this);
+	}
+}
+
+PacketQueue::~PacketQueue()
+{
+	envir().taskScheduler().unscheduleDelayedTask(m_retryTask);
+	if (m_source)
+	{
+		m_source->removeConsumer(this);
+	}
+	m_fanout->removeClient(this);
+}
+
+void PacketQueue::doGetNextFrame()
+{
+	m_active = true;
+	if (!m_queue.empty())
+	{
+		this->tryDeliver();
+	}
+	else
+	{
+		m_fanout->start();
+	}
+}
+
+void PacketQueue::doStopGettingFrames()
+{
+	m_active = false;
+	m_waitKeyFrame = true;
+	envir().taskScheduler().unscheduleDelayedTask(m_retryTask);
+	this->clear();
+}
+
+void PacketQueue::push(const std::shared_ptr<PacketFanout::Payload> &payload)
+{
+	if (!m_active)
+	{
+		return;
+	}
+	unsigned int size = payload->m_data.size();
+	if (!m_queue.empty() && (m_queuedBytes + size > m_maxBytes))
+	{
+		// the client is too slow, give up its backlog up to the next key frame
+		LOG(DEBUG) << "Packet queue " << m_name << " full, dropped " << m_queue.size() << " payloads";
+		m_dropped += m_queue.size();
+		this->clear();
+		m_overflows++;
+		m_waitKeyFrame = true;
+		if (m_source)
+		{
+			m_source->requestKeyFrame(KeyFrameBroker::REASON_RECOVERY);
+		}
+	}
+	if (!this->accept(*payload))
+	{
+		m_dropped++;
+		return;
+	}
+	m_queue.push_back(payload);
+	m_queuedBytes += size;
+	if (m_queue.size() > m_maxQueued)
+	{
+		m_maxQueued = m_queue.size();
+	}
+	if (isCurrentlyAwaitingData() && (m_retryTask == NULL))
+	{
+		this->tryDeliver();
+	}
+}
+
+void PacketQueue::sendFailed()
+{
+	m_sendErrors++;
+	if (m_tcpSocket < 0)
+	{
+		// counted by the groupsock, the next packets do not wait for this one
+		return;
+	}
+	// the TCP connection lost a packet, start again from a key frame
+	m_dropped += m_queue.size();
+	this->clear();
+	m_waitKeyFrame = true;
+	if (m_source)
+	{
+		m_source->requestKeyFrame(KeyFrameBroker::REASON_RECOVERY);
+	}
+}
+
+bool PacketQueue::congested(unsigned int size)
+{
+	if (m_tcpSocket < 0)
+	{
+		return false;
+	}
+	int pending = 0;
+	int bufferSize = 0;
+	socklen_t length = sizeof(bufferSize);
+	if ((ioctl(m_tcpSocket, TIOCOUTQ, &pending) != 0) || (getsockopt(m_tcpSocket, SOL_SOCKET, SO_SNDBUF, &bufferSize, &length) != 0))
+	{
+		return false;
+	}
+	// the kernel reports twice the room it gives to data, the 4 bytes are the interleaving header
+	return (unsigned int)pending + size + 12 + 4 > (unsigned int)bufferSize / 2;
+}
+
+void PacketQueue::tryDeliver()
+{
+	if (this->congested(m_queue.front()->m_data.size()))
+	{
+		m_congested++;
+		m_retryTask = envir().taskScheduler().scheduleDelayedTask(RETRY_DELAY, retryTask, this);
+		return;
+	}
+	this->deliver();
+}
+
+// while waiting for a key frame, only parameter sets and the start of a key frame go through
+bool PacketQueue::accept(const PacketFanout::Payload &payload)
+{
+	if (!m_waitKeyFrame)
+	{
+		return true;
+	}
+	if ((payload.m_class == V4L2DeviceSource::FRAME_KEY) || (payload.m_class == V4L2DeviceSource::FRAME_INDEPENDENT))
+	{
+		m_waitKeyFrame = false;
+		return true;
+	}
+	return (payload.m_class == V4L2DeviceSource::FRAME_PARAMSET);
+}
+
+void PacketQueue::deliver()
+{
+	std::shared_ptr<PacketFanout::Payload> payload = m_queue.front();
+	m_queue.pop_front();
+	unsigned int size = payload->m_data.size();
+	m_queuedBytes -= size;
+	if (size > fMaxSize)
+	{
+		fFrameSize = fMaxSize;
+		fNumTruncatedBytes = size - fMaxSize;
+	}
+	else
+	{
+		fFrameSize = size;
+		fNumTruncatedBytes = 0;
+	}
+	memcpy(fTo, payload->m_data.data(), fFrameSize);
+	fPresentationTime = payload->m_presentationTime;
+	fDurationInMicroseconds = 0;
+	m_endsAccessUnit = payload->m_endsAccessUnit;
+	m_departure = payload->m_departure;
+	m_endsBurst = payload->m_endsBurst;
+
+	unsigned long long now = LatencyHistogram::now();
+	if (now > payload->m_queued + m_maxLag)
+	{
+		m_maxLag = now - payload->m_queued;
+	}
+	m_delivered++;
+	afterGetting(this);
+}
+
+void PacketQueue::clear()
+{
+	m_queue.clear();
+	m_queuedBytes = 0;
+}
+
+std::string PacketQueue::toJSON()
+{
+	// lag: how long the oldest queued payload has been waiting (ms)
+	unsigned long long lag = 0;
+	if (!m_queue.empty())
+	{
+		lag = (LatencyHistogram::now() - m_queue.front()->m_queued) / 1000;
+	}
+	std::ostringstream os;
+	os << "{\"name\":\"" << m_name << "\",\"transport\":\"" << ((m_tcpSocket < 0) ? "udp" : "tcp") << "\",\"queued\":" << m_queue.size() << ",\"bytes\":" << m_queuedBytes;
+	os << ",\"maxQueued\":" << m_maxQueued << ",\"lag\":" << lag << ",\"maxLag\":" << (m_maxLag / 1000);
+	os << ",\"delivered\":" << m_delivered << ",\"dropped\":" << m_dropped << ",\"overflows\":" << m_overflows;
+	os << ",\"congested\":" << m_congested << ",\"sendErrors\":" << m_sendErrors << "}";
+	return os.str();
+}
@@ -0,0 +1,39 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** ParameterSetCache.cpp
+**
+** H264/H265 parameter sets seen on the stream
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "ParameterSetCache.h"
+
+bool ParameterSetCache::update(Slot slot, const unsigned char *data, size_t size)
+{
+	const std::string &current = m_current->m_sets[slot];
+	if ((current.size() == size) && (memcmp(current.data(), data, size) == 0))
+	{
+		return false;
+	}
+	if (!m_changed)
+	{
+		// first change since the last takeChange: start a new generation, the
+		// previous one lives on as long as a queued frame holds it
+		m_current = std::make_shared<Generation>(*m_current);
+		m_changed = true;
+	}
+	m_current->m_sets[slot].assign((const char *)data, size);
+	return true;
+}
+
+bool ParameterSetCache::takeChange()
+{
+	bool changed = m_changed;
+	m_changed = false;
+	return changed;
+}
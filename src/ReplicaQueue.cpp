@@ -0,0 +1,236 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** ReplicaQueue.cpp
+**
+** Bounded queue decoupling a consumer from the stream replicator
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include <sstream>
+
+#include "logger.h"
+#include "LatencyHistogram.h"
+#include "ReplicaQueue.h"
+
+ReplicaQueue::ReplicaQueue(UsageEnvironment &env, FramedSource *inputSource, V4L2DeviceSource *source, const std::string &name, unsigned int maxBytes)
+	: FramedFilter(env, inputSource), m_source(source), m_auSource(AccessUnitSource::find(inputSource)), m_name(name), m_maxBytes(maxBytes), m_queuedBytes(0),
+	  m_readBuffer(NULL), m_readBufferSize(0), m_active(false), m_reading(false), m_readingDirect(false), m_waitKeyFrame(false), m_endsAccessUnit(false),
+	  m_delivered(0), m_dropped(0), m_overflows(0), m_maxQueued(0), m_maxLag(0)
+{
+	if (m_auSource == NULL)
+	{
+		// a stream replica, it delivers the frames of the device source as they come
+		m_auSource = m_source;
+	}
+	if (m_source)
+	{
+		m_source->addConsumer(this);
+	}
+}
+
+ReplicaQueue::~ReplicaQueue()
+{
+	if (m_source)
+	{
+		m_source->removeConsumer(this);
+	}
+	delete[] m_readBuffer;
+}
+
+void ReplicaQueue::doGetNextFrame()
+{
+	if (m_readBuffer == NULL)
+	{
+		m_readBufferSize = fMaxSize;
+		m_readBuffer = new unsigned char[m_readBufferSize];
+	}
+	m_active = true;
+	if (!m_queue.empty())
+	{
+		this->deliverQueued();
+	}
+	else if (!m_reading)
+	{
+		this->readNext();
+	}
+}
+
+void ReplicaQueue::doStopGettingFrames()
+{
+	m_active = false;
+	m_reading = false;
+	m_waitKeyFrame = false;
+	m_queue.clear();
+	m_queuedBytes = 0;
+	FramedFilter::doStopGettingFrames();
+}
+
+void ReplicaQueue::readNext()
+{
+	// straight to the consumer when it is waiting for it
+	m_readingDirect = isCurrentlyAwaitingData() && m_queue.empty();
+	m_reading = true;
+	if (m_readingDirect)
+	{
+		fInputSource->getNextFrame(fTo, fMaxSize, afterGettingFrame, this, handleClosure, this);
+	}
+	else
+	{
+		fInputSource->getNextFrame(m_readBuffer, m_readBufferSize, afterGettingFrame, this, handleClosure, this);
+	}
+}
+
+void ReplicaQueue::afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime, unsigned durationInMicroseconds)
+{
+	m_reading = false;
+	bool endsAccessUnit = (m_auSource != NULL) && m_auSource->lastFrameEndsAccessUnit();
+	if (m_readingDirect)
+	{
+		if (this->accept(fTo, frameSize))
+		{
+			fFrameSize = frameSize;
+			fNumTruncatedBytes = numTruncatedBytes;
+			fPresentationTime = presentationTime;
+			fDurationInMicroseconds = durationInMicroseconds;
+			m_endsAccessUnit = endsAccessUnit;
+			m_delivered++;
+			afterGetting(this);
+		}
+		else
+		{
+			m_dropped++;
+		}
+	}
+	else
+	{
+		if (!m_queue.empty() && (m_queuedBytes + frameSize > m_maxBytes))
+		{
+			// the consumer is too slow, give up its backlog up to the next key frame
+			LOG(DEBUG) << "Replica queue " << m_name << " full, dropped " << m_queue.size() << " frames";
+			m_dropped += m_queue.size();
+			while (!m_queue.empty())
+			{
+				this->recycle(m_queue.front().m_data);
+				m_queue.pop_front();
+			}
+			m_queuedBytes = 0;
+			m_overflows++;
+			m_waitKeyFrame = true;
+			if (m_source)
+			{
+				m_source->requestKeyFrame(KeyFrameBroker::REASON_RECOVERY);
+			}
+		}
+		if (this->accept(m_readBuffer, frameSize))
+		{
+			m_queue.push_back(Frame());
+			Frame &frame = m_queue.back();
+			if (!m_spare.empty())
+			{
+				frame.m_data.swap(m_spare.front());
+				m_spare.pop_front();
+			}
+			frame.m_data.assign((const char *)m_readBuffer, frameSize);
+			frame.m_presentationTime = presentationTime;
+			frame.m_duration = durationInMicroseconds;
+			frame.m_truncated = numTruncatedBytes;
+			frame.m_endsAccessUnit = endsAccessUnit;
+			frame.m_queued = LatencyHistogram::now();
+			m_queuedBytes += frameSize;
+			if (m_queue.size() > m_maxQueued)
+			{
+				m_maxQueued = m_queue.size();
+			}
+		}
+		else
+		{
+			m_dropped++;
+		}
+		if (isCurrentlyAwaitingData() && !m_queue.empty())
+		{
+			this->deliverQueued();
+		}
+	}
+
+	// the consumer may have asked for the next frame meanwhile
+	if (m_active && !m_reading)
+	{
+		this->readNext();
+	}
+}
+
+// while waiting for a key frame, only parameter sets and key frames go through
+bool ReplicaQueue::accept(const unsigned char *frame, unsigned int frameSize)
+{
+	if (!m_waitKeyFrame)
+	{
+		return true;
+	}
+	V4L2DeviceSource::FrameClass frameClass = m_source ? m_source->classifyFrame(frame, frameSize) : V4L2DeviceSource::FRAME_INDEPENDENT;
+	if ((frameClass == V4L2DeviceSource::FRAME_KEY) || (frameClass == V4L2DeviceSource::FRAME_INDEPENDENT))
+	{
+		m_waitKeyFrame = false;
+		return true;
+	}
+	return (frameClass == V4L2DeviceSource::FRAME_PARAMSET);
+}
+
+void ReplicaQueue::deliverQueued()
+{
+	Frame &frame = m_queue.front();
+	unsigned int size = frame.m_data.size();
+	if (size > fMaxSize)
+	{
+		fFrameSize = fMaxSize;
+		fNumTruncatedBytes = frame.m_truncated + size - fMaxSize;
+	}
+	else
+	{
+		fFrameSize = size;
+		fNumTruncatedBytes = frame.m_truncated;
+	}
+	memcpy(fTo, frame.m_data.data(), fFrameSize);
+	fPresentationTime = frame.m_presentationTime;
+	fDurationInMicroseconds = frame.m_duration;
+	m_endsAccessUnit = frame.m_endsAccessUnit;
+
+	unsigned long long now = LatencyHistogram::now();
+	if (now > frame.m_queued + m_maxLag)
+	{
+		m_maxLag = now - frame.m_queued;
+	}
+	m_queuedBytes -= size;
+	this->recycle(frame.m_data);
+	m_queue.pop_front();
+	m_delivered++;
+	afterGetting(this);
+}
+
+void ReplicaQueue::recycle(std::string &data)
+{
+	if (m_spare.size() < MAX_SPARE)
+	{
+		m_spare.push_back(std::string());
+		m_spare.back().swap(data);
+	}
+}
+
+std::string ReplicaQueue::toJSON()
+{
+	// lag: how long the oldest queued frame has been waiting (ms)
+	unsigned long long lag = 0;
+	if (!m_queue.empty())
+	{
+		lag = (LatencyHistogram::now() - m_queue.front().m_queued) / 1000;
+	}
+	std::ostringstream os;
+	os << "{\"name\":\"" << m_name << "\",\"queued\":" << m_queue.size() << ",\"bytes\":" << m_queuedBytes;
+	os << ",\"maxQueued\":" << m_maxQueued << ",\"lag\":" << lag << ",\"maxLag\":" << (m_maxLag / 1000);
+	os << ",\"delivered\":" << m_delivered << ",\"dropped\":" << m_dropped << ",\"overflows\":" << m_overflows << "}";
+	return os.str();
+}
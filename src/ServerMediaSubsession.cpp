@@ -14,13 +14,20 @@
 // project
 #include "BaseServerMediaSubsession.h"
 #include "MJPEGVideoSource.h"
+#include "LatencyProbe.h"
+#include "H26xRTPSink.h"
 
 // ---------------------------------
 //   BaseServerMediaSubsession
 // ---------------------------------
-FramedSource *BaseServerMediaSubsession::createSource(UsageEnvironment &env, FramedSource *videoES, const std::string &format)
+FramedSource *BaseServerMediaSubsession::createSource(UsageEnvironment &env, FramedSource *videoES, const std::string &format, V4L2DeviceSource *deviceSource)
 {
 	FramedSource *source = NULL;
+	if (deviceSource && ((format == "video/H264") || (format == "video/H265") || (format == "video/JPEG")))
+	{
+		// time framer and send stages
+		videoES = LatencyProbe::createNew(env, videoES, deviceSource);
+	}
 	if (format == "video/MP2T")
 	{
 		source = MPEG2TransportStreamFramer::createNew(env, videoES);
@@ -55,7 +62,7 @@ RTPSink *BaseServerMediaSubsession::createSink(UsageEnvironment &env, Groupsock
 	}
 	else if (format == "video/H264")
 	{
-		videoSink = H264VideoRTPSink::createNew(env, rtpGroupsock, rtpPayloadTypeIfDynamic);
+		videoSink = H26xRTPSink::createNew(env, rtpGroupsock, rtpPayloadTypeIfDynamic, 264);
 	}
 	else if (format == "video/VP8")
 	{
@@ -68,7 +75,7 @@ RTPSink *BaseServerMediaSubsession::createSink(UsageEnvironment &env, Groupsock
 	}
 	else if (format == "video/H265")
 	{
-		videoSink = H265VideoRTPSink::createNew(env, rtpGroupsock, rtpPayloadTypeIfDynamic);
+		videoSink = H26xRTPSink::createNew(env, rtpGroupsock, rtpPayloadTypeIfDynamic, 265);
 	}
 #endif
 	else if (format == "video/JPEG")
@@ -161,7 +168,8 @@ char const *BaseServerMediaSubsession::getAuxLine(V4L2DeviceSource *source, RTPS
 				os << "a=x-dimensions:" << width << "," << height << "\r\n";
 			}
 		}
-		auxLine = strdup(os.str().c_str());
+		m_auxSDPLine.assign(os.str());
+		auxLine = m_auxSDPLine.c_str();
 	}
 	return auxLine;
 }
@@ -0,0 +1,157 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** StartCodeScanner.cpp
+**
+** Annex-B start code scanner
+**
+** -------------------------------------------------------------------------*/
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "StartCodeScanner.h"
+
+// byte by byte, for the unaligned head and the tail of the buffer
+static const unsigned char *findBytes(const unsigned char *p, const unsigned char *end)
+{
+	for (; p + 2 < end; ++p)
+	{
+		if ((p[2] <= 1) && (p[0] == 0) && (p[1] == 0) && (p[2] == 1))
+		{
+			return p;
+		}
+	}
+	return end;
+}
+
+#if defined(__AVX2__)
+
+static const unsigned char *findVector(const unsigned char *p, const unsigned char *end)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi8(1);
+	// each block looks 2 bytes ahead
+	for (; p + 34 <= end; p += 32)
+	{
+		__m256i b0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), zero);
+		__m256i b1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 1)), zero);
+		__m256i b2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 2)), one);
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(b0, b1), b2));
+		if (mask)
+		{
+			return p + __builtin_ctz(mask);
+		}
+	}
+	return findBytes(p, end);
+}
+
+#elif defined(__SSE2__)
+
+static const unsigned char *findVector(const unsigned char *p, const unsigned char *end)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi8(1);
+	// each block looks 2 bytes ahead
+	for (; p + 18 <= end; p += 16)
+	{
+		__m128i b0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), zero);
+		__m128i b1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 1)), zero);
+		__m128i b2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 2)), one);
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(_mm_and_si128(b0, b1), b2));
+		if (mask)
+		{
+			return p + __builtin_ctz(mask);
+		}
+	}
+	return findBytes(p, end);
+}
+
+#else
+
+// A start code has two consecutive zero bytes, so one of them is at an odd
+// offset of an aligned word. Words without a zero byte are skipped.
+static const unsigned char *findVector(const unsigned char *p, const unsigned char *end)
+{
+	const unsigned char *aligned = p + ((sizeof(uint32_t) - ((uintptr_t)p & (sizeof(uint32_t) - 1))) & (sizeof(uint32_t) - 1));
+	if (aligned > end)
+	{
+		aligned = end;
+	}
+	const unsigned char *found = findBytes(p, (aligned + 2 < end) ? aligned + 2 : end);
+	if (found < aligned)
+	{
+		return found;
+	}
+	// each word looks 2 bytes ahead
+	for (p = aligned; p + 6 <= end; p += 4)
+	{
+		uint32_t word;
+		memcpy(&word, p, sizeof(word));
+		if ((word - 0x01010101U) & ~word & 0x80808080U)
+		{
+			if (p[1] == 0)
+			{
+				if ((p[0] == 0) && (p[2] == 1))
+					return p;
+				if ((p[2] == 0) && (p[3] == 1))
+					return p + 1;
+			}
+			if (p[3] == 0)
+			{
+				if ((p[2] == 0) && (p[4] == 1))
+					return p + 2;
+				if ((p[4] == 0) && (p[5] == 1))
+					return p + 3;
+			}
+		}
+	}
+	return findBytes(p, end);
+}
+
+#endif
+
+size_t StartCodeScanner::find(const unsigned char *data, size_t size)
+{
+	return findVector(data, data + size) - data;
+}
+
+void StartCodeScanner::scan(unsigned char *data, size_t size, std::vector<NalUnit> &nalUnits)
+{
+	nalUnits.clear();
+	size_t pos = find(data, size);
+	while (pos < size)
+	{
+		// the byte before 00 00 01 can not belong to the previous start code, it ends with 01
+		size_t start = ((pos > 0) && (data[pos - 1] == 0)) ? pos - 1 : pos;
+		size_t payload = pos + 3;
+		size_t next = payload + find(data + payload, size - payload);
+		size_t end = next;
+		if ((next < size) && (next > payload) && (data[next - 1] == 0))
+		{
+			end = next - 1;
+		}
+		if (end > payload)
+		{
+			nalUnits.push_back(NalUnit(data + start, end - start, payload - start));
+		}
+		pos = next;
+	}
+}
+
+const char *StartCodeScanner::implementation()
+{
+#if defined(__AVX2__)
+	return "avx2";
+#elif defined(__SSE2__)
+	return "sse2";
+#else
+	return "scalar";
+#endif
+}
@@ -9,25 +9,28 @@
 
 #include "TSServerMediaSubsession.h"
 #include "AddH26xMarkerFilter.h"
+#include "ReplicaQueue.h"
 
 TSServerMediaSubsession::TSServerMediaSubsession(UsageEnvironment &env, StreamReplicator *videoreplicator, StreamReplicator *audioreplicator, unsigned int sliceDuration)
 	: UnicastServerMediaSubsession(env, videoreplicator), m_slice(0)
 {
 	// Create a source
-	FramedSource *source = videoreplicator->createStreamReplica();
+	V4L2DeviceSource *deviceSource = dynamic_cast<V4L2DeviceSource *>(videoreplicator->inputSource());
+	FramedSource *source = ReplicaQueue::createNew(env, videoreplicator->createStreamReplica(), deviceSource, "hls");
 	MPEG2TransportStreamFromESSource *muxer = MPEG2TransportStreamFromESSource::createNew(env);
 
+	AddH26xMarkerFilter *filter = NULL;
 	if (m_format == "video/H264")
 	{
 		// add marker
-		FramedSource *filter = new AddH26xMarkerFilter(env, source);
+		filter = new AddH26xMarkerFilter(env, source, deviceSource);
 		// mux to TS
 		muxer->addNewVideoSource(filter, 5);
 	}
 	else if (m_format == "video/H265")
 	{
 		// add marker
-		FramedSource *filter = new AddH26xMarkerFilter(env, source);
+		filter = new AddH26xMarkerFilter(env, source, deviceSource);
 		// mux to TS
 		muxer->addNewVideoSource(filter, 6);
 	}
@@ -38,10 +41,17 @@ TSServerMediaSubsession::TSServerMediaSubsession(UsageEnvironment &env, StreamRe
 		muxer->addNewAudioSource(source, 1);
 	}
 
-	FramedSource *tsSource = createSource(env, muxer, "video/MP2T");
+	FramedSource *tsSource = createSource(env, muxer, "video/MP2T", NULL);
 
 	// Start Playing the HLS Sink
 	m_hlsSink = MemoryBufferSink::createNew(env, OutPacketBuffer::maxSize, sliceDuration);
+	// start each segment with a key frame, ask for one when it is due
+	if (filter != NULL)
+	{
+		filter->setKeyFrameHandler(MemoryBufferSink::keyFrameHandler, m_hlsSink);
+		m_hlsSink->setKeyFrameCut(true);
+	}
+	m_hlsSink->setSliceHandler(TSServerMediaSubsession::sliceHandler, this);
 	m_hlsSink->startPlaying(*tsSource, NULL, NULL);
 }
 
@@ -8,20 +8,79 @@
 ** -------------------------------------------------------------------------*/
 
 #include "UnicastServerMediaSubsession.h"
+#include "FeedbackGroupsock.h"
+#include "KeyFrameFilter.h"
+#include "FrameRateFilter.h"
+#include "ReplicaQueue.h"
 
 // -----------------------------------------
 //    ServerMediaSubsession for Unicast
 // -----------------------------------------
-UnicastServerMediaSubsession *UnicastServerMediaSubsession::createNew(UsageEnvironment &env, StreamReplicator *replicator)
+UnicastServerMediaSubsession *UnicastServerMediaSubsession::createNew(UsageEnvironment &env, StreamReplicator *replicator, bool keyFramesOnly, unsigned int fps)
 {
-	return new UnicastServerMediaSubsession(env, replicator);
+	return new UnicastServerMediaSubsession(env, replicator, keyFramesOnly, fps, false);
+}
+
+UnicastServerMediaSubsession::~UnicastServerMediaSubsession()
+{
+	delete m_fanout;
+}
+
+std::string UnicastServerMediaSubsession::getName() const
+{
+	std::ostringstream name;
+	name << "unicast";
+	if (m_keyFramesOnly)
+	{
+		name << "/keyframes";
+	}
+	else if (m_fps != 0)
+	{
+		name << "@" << m_fps << "fps";
+	}
+	return name.str();
+}
+
+FramedSource *UnicastServerMediaSubsession::createReplicaSource()
+{
+	FramedSource *source = m_replicator->createStreamReplica();
+	V4L2DeviceSource *deviceSource = dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource());
+	if (m_keyFramesOnly && deviceSource)
+	{
+		source = KeyFrameFilter::createNew(envir(), source, deviceSource);
+	}
+	else if ((m_fps != 0) && deviceSource)
+	{
+		source = FrameRateFilter::createNew(envir(), source, deviceSource, m_fps);
+	}
+	// a slow client does not hold the replicator back
+	source = ReplicaQueue::createNew(envir(), source, deviceSource, this->getName());
+	return createSource(envir(), source, m_format, deviceSource);
 }
 
 FramedSource *UnicastServerMediaSubsession::createNewStreamSource(unsigned clientSessionId, unsigned &estBitrate)
 {
 	estBitrate = 500;
-	FramedSource *source = m_replicator->createStreamReplica();
-	return createSource(envir(), source, m_format);
+	V4L2DeviceSource *deviceSource = dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource());
+	if ((m_format != "video/H264") && (m_format != "video/H265"))
+	{
+		return this->createReplicaSource();
+	}
+
+	// one chain up to the payloader for all the clients
+	if (m_fanout == NULL)
+	{
+		m_fanout = new PacketFanout(envir(), (m_format == "video/H264") ? 264 : 265, deviceSource);
+	}
+	if (!m_fanout->hasSource())
+	{
+		m_fanout->setSource(this->createReplicaSource());
+	}
+	std::ostringstream clientName;
+	clientName << this->getName() << " client " << ++m_clients;
+	PacketQueue *queue = PacketQueue::createNew(envir(), m_fanout, deviceSource, clientName.str());
+	queue->setTcpSocket(m_tcpSocket);
+	return queue;
 }
 
 RTPSink *UnicastServerMediaSubsession::createNewRTPSink(Groupsock *rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic, FramedSource *inputSource)
@@ -29,7 +88,61 @@ RTPSink *UnicastServerMediaSubsession::createNewRTPSink(Groupsock *rtpGroupsock,
 	return createSink(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic, m_format, dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource()));
 }
 
+#if LIVEMEDIA_LIBRARY_VERSION_INT < 1610928000
+char const *UnicastServerMediaSubsession::sdpLines()
+{
+#else
+char const *UnicastServerMediaSubsession::sdpLines(int addressFamily)
+{
+#endif
+	unsigned int auxVersion = this->getAuxLineVersion();
+	if (auxVersion != m_SDPVersion)
+	{
+		// parameter sets changed, let live555 build the SDP again
+		delete[] fSDPLines;
+		fSDPLines = NULL;
+		m_SDPVersion = auxVersion;
+	}
+#if LIVEMEDIA_LIBRARY_VERSION_INT < 1610928000
+	return OnDemandServerMediaSubsession::sdpLines();
+#else
+	return OnDemandServerMediaSubsession::sdpLines(addressFamily);
+#endif
+}
+
 char const *UnicastServerMediaSubsession::getAuxSDPLine(RTPSink *rtpSink, FramedSource *inputSource)
 {
 	return this->getAuxLine(dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource()), rtpSink);
 }
+
+void UnicastServerMediaSubsession::startStream(unsigned clientSessionId, void *streamToken, TaskFunc *rtcpRRHandler, void *rtcpRRHandlerClientData, unsigned short &rtpSeqNum, unsigned &rtpTimestamp, ServerRequestAlternativeByteHandler *serverRequestAlternativeByteHandler, void *serverRequestAlternativeByteHandlerClientData)
+{
+	// do not make the new client wait for the next GOP
+	this->requestKeyFrame(KeyFrameBroker::REASON_JOIN);
+	OnDemandServerMediaSubsession::startStream(clientSessionId, streamToken, rtcpRRHandler, rtcpRRHandlerClientData, rtpSeqNum, rtpTimestamp, serverRequestAlternativeByteHandler, serverRequestAlternativeByteHandlerClientData);
+}
+
+#if LIVEMEDIA_LIBRARY_VERSION_INT >= 1642723200
+void UnicastServerMediaSubsession::getStreamParameters(unsigned clientSessionId, struct sockaddr_storage const &clientAddress, Port const &clientRTPPort, Port const &clientRTCPPort, int tcpSocketNum, unsigned char rtpChannelId, unsigned char rtcpChannelId, TLSState *tlsState, struct sockaddr_storage &destinationAddress, u_int8_t &destinationTTL, Boolean &isMulticast, Port &serverRTPPort, Port &serverRTCPPort, void *&streamToken)
+{
+	// the source of the client is created from there
+	m_tcpSocket = tcpSocketNum;
+	OnDemandServerMediaSubsession::getStreamParameters(clientSessionId, clientAddress, clientRTPPort, clientRTCPPort, tcpSocketNum, rtpChannelId, rtcpChannelId, tlsState, destinationAddress, destinationTTL, isMulticast, serverRTPPort, serverRTCPPort, streamToken);
+	m_tcpSocket = -1;
+}
+
+Groupsock *UnicastServerMediaSubsession::createGroupsock(struct sockaddr_storage const &addr, Port port)
+{
+	return new FeedbackGroupsock(envir(), addr, port, 255, &m_sendStats);
+}
+
+RTCPInstance *UnicastServerMediaSubsession::createRTCP(Groupsock *RTCPgs, unsigned totSessionBW, unsigned char const *cname, RTPSink *sink)
+{
+	FeedbackGroupsock *feedbackGroupsock = dynamic_cast<FeedbackGroupsock *>(RTCPgs);
+	if (feedbackGroupsock)
+	{
+		feedbackGroupsock->setFeedbackSource(dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource()));
+	}
+	return OnDemandServerMediaSubsession::createRTCP(RTCPgs, totSessionBW, cname, sink);
+}
+#endif
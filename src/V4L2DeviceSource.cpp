@@ -17,6 +17,11 @@
 #include "logger.h"
 #include "V4L2DeviceSource.h"
 
+// a lent key frame is copied for snapshots while they were read this recently (us)
+static const unsigned long long SnapshotReaderUs = 10 * 1000000ULL;
+// frames are borrowed only while the live555 thread took one this recently (us)
+static const unsigned long long BorrowConsumerUs = 100000ULL;
+
 // ---------------------------------
 // V4L2 FramedSource Stats
 // ---------------------------------
@@ -50,19 +55,50 @@ V4L2DeviceSource *V4L2DeviceSource::createNew(UsageEnvironment &env, DeviceInter
 // Constructor
 V4L2DeviceSource::V4L2DeviceSource(UsageEnvironment &env, DeviceInterface *device, int outputFd, unsigned int queueSize, CaptureMode captureMode)
 	: FramedSource(env),
+	  m_captureQueue(queueSize),
 	  m_in("in"),
 	  m_out("out"),
 	  m_outfd(outputFd),
 	  m_device(device),
 	  m_queueSize(queueSize),
+	  m_pool(NULL),
+	  m_deviceReleaser(*this),
+	  m_waitKeyFrame(false),
+	  m_keyFrames(device),
+	  m_skipped(0),
+	  m_skips(0),
+	  m_lastLatency(0),
+	  m_deliveryTicket(0),
+	  m_deliveryIndex(0),
+	  m_lastEndsAccessUnit(false),
+	  m_frameInterval(0),
 	  m_firstFrame(true)
 {
 	m_stop.store(false);
+	m_borrowed.store(false);
+	m_lastDelivery.store(0);
+	m_borrowedFrames.store(0);
+	m_copiedFrames.store(0);
+	m_snapshotRead.store(0);
+	m_auxVersion.store(0);
+	m_dropped.store(0);
+	m_flushes.store(0);
+	m_latencyBudget.store(0);
+	m_pacing.store(0);
+	m_keyFrameWanted.store(false);
+	m_wakeups.store(0);
+	m_idleWakeups.store(0);
+	m_timeouts.store(0);
 	m_lastPresentationTime.tv_sec = 0;
 	m_lastPresentationTime.tv_usec = 0;
 	m_eventTriggerId = envir().taskScheduler().createEventTrigger(V4L2DeviceSource::deliverFrameStub);
 	if (m_device)
 	{
+		// queued frames + the one being captured + the one being delivered + the
+		// last key frame; without capture thread frames are posted from outside. A
+		// device lending its own buffers reads into ours while the queue is not empty
+		unsigned int poolCount = (captureMode != NOCAPTURE) ? m_queueSize + 3 : 0;
+		m_pool = new FramePool(poolCount, m_device->getMaxFrameSize());
 		switch (captureMode)
 		{
 		case CAPTURE_INTERNAL_THREAD:
@@ -104,6 +140,16 @@ V4L2DeviceSource::~V4L2DeviceSource()
 	{
 		m_thread.join();
 	}
+	AccessUnit au;
+	while (m_captureQueue.pop(au))
+	{
+		au.release();
+	}
+	this->releaseDropped();
+	// the key frame gives its buffer back to the pool
+	m_pendingKeyFrame.reset();
+	m_lastKeyFrame.reset();
+	delete m_pool;
 	delete m_device;
 }
 
@@ -114,6 +160,11 @@ void *V4L2DeviceSource::thread()
 	fd_set fdset;
 	FD_ZERO(&fdset);
 	timeval tv;
+	// readiness without data in a row, to avoid spinning on a broken fd
+	const int maxIdleWakeups = 100;
+	int idleWakeups = 0;
+	// a borrowed frame nobody takes stalls the device: give it back after this delay
+	const int borrowTimeoutMs = 200;
 
 	LOG(NOTICE) << "begin thread";
 	while (!stop && !m_stop.load())
@@ -122,33 +173,67 @@ void *V4L2DeviceSource::thread()
 		if (fd >= 0)
 		{
 			FD_ZERO(&fdset);
-		FD_SET(fd, &fdset);
-		tv.tv_sec = 1;
-		tv.tv_usec = 0;
-		int ret = select(fd + 1, &fdset, NULL, NULL, &tv);
-		if (ret == 1)
-		{
-			LOG(DEBUG) << "waitingFrame\tdelay:" << (1000 - (tv.tv_usec / 1000)) << "ms";
-			if (this->getNextFrame() <= 0)
+			FD_SET(fd, &fdset);
+			bool borrowed = m_borrowed.load();
+			tv.tv_sec = borrowed ? 0 : 1;
+			tv.tv_usec = borrowed ? borrowTimeoutMs * 1000 : 0;
+			int ret = select(fd + 1, &fdset, NULL, NULL, &tv);
+			if (ret == 1)
 			{
-				if (errno == EAGAIN)
+				m_wakeups++;
+				LOG(DEBUG) << "waitingFrame\tdelay:" << (1000 - (tv.tv_usec / 1000)) << "ms";
+				if (this->getNextFrame() <= 0)
 				{
-					LOG(DEBUG) << "Retrying getNextFrame";
-				}
+					if (errno == EAGAIN)
+					{
+						LOG(DEBUG) << "Retrying getNextFrame";
+						m_idleWakeups++;
+						if (++idleWakeups >= maxIdleWakeups)
+						{
+							LOG(WARN) << "fd:" << fd << " ready without data, backing off";
+							idleWakeups = 0;
+							tv.tv_sec = 0;
+							tv.tv_usec = 10000; // 10ms
+							select(0, NULL, NULL, NULL, &tv);
+						}
+					}
 					else if (!m_stop.load())
+					{
+						LOG(ERROR) << "error:" << strerror(errno);
+						stop = 1;
+					}
+				}
+				else
 				{
-					LOG(ERROR) << "error:" << strerror(errno);
-					stop = 1;
+					idleWakeups = 0;
 				}
+			}
+			else if ((ret == 0) && borrowed && m_borrowed.load())
+			{
+				// no consumer: drop the frame, and the frames that depend on it
+				AccessUnit head;
+				unsigned int ticket = 0;
+				bool chain = m_captureQueue.peek(head, ticket) && (head.m_class >= FRAME_REFERENCE);
+				LOG(DEBUG) << "Borrowed frame not delivered in " << borrowTimeoutMs << "ms, releasing it";
+				this->flushQueue();
+				if (chain)
+				{
+					m_waitKeyFrame = true;
 				}
 			}
+			else if (ret == 0)
+			{
+				m_timeouts++;
+			}
 		}
 		else
 		{
 			// No valid fd: poll by calling getNextFrame then sleep briefly to avoid busy loop
+			m_wakeups++;
 			int r = this->getNextFrame();
 			if (r <= 0)
 			{
+				m_idleWakeups++;
 				tv.tv_sec = 0;
 				tv.tv_usec = 10000; // 10ms
 				select(0, NULL, NULL, NULL, &tv);
@@ -173,32 +258,68 @@ void V4L2DeviceSource::deliverFrame()
 		fDurationInMicroseconds = 0;
 		fFrameSize = 0;
 
-		m_mutex.lock();
-		if (m_captureQueue.empty())
+		this->skipStaleFrames();
+
+		// copy the next NAL unit of the oldest access unit while it is still
+		// queued, retry if the capture thread dropped it meanwhile: a dropped
+		// access unit is released by releaseDropped(), never during the copy
+		AccessUnit au;
+		unsigned int ticket = 0;
+		bool delivered = false;
+		bool completed = false;
+		while (!delivered && m_captureQueue.peek(au, ticket))
+		{
+			if (ticket != m_deliveryTicket)
+			{
+				// previous access unit done or dropped
+				m_deliveryTicket = ticket;
+				m_deliveryIndex = 0;
+			}
+			const AccessUnit::Nal &nal = au.m_nals[m_deliveryIndex];
+			fNumTruncatedBytes = 0;
+			if (nal.m_size > fMaxSize)
+			{
+				fFrameSize = fMaxSize;
+				fNumTruncatedBytes = nal.m_size - fMaxSize;
+			}
+			else
+			{
+				fFrameSize = nal.m_size;
+			}
+			unsigned long long copyStart = LatencyHistogram::now();
+			memcpy(fTo, nal.m_buffer, fFrameSize);
+			m_lastDelivery.store(copyStart);
+			// the last NAL unit takes the access unit out of the queue
+			completed = (m_deliveryIndex + 1 >= au.m_count);
+			delivered = completed ? m_captureQueue.retire(ticket) : m_captureQueue.holds(ticket);
+			if (delivered)
+			{
+				m_latency[STAGE_COPY].addSince(copyStart);
+				if (m_deliveryIndex == 0)
+				{
+					m_latency[STAGE_QUEUE].add((copyStart > au.m_queued) ? (unsigned long)(copyStart - au.m_queued) : 0);
+				}
+				m_deliveryIndex++;
+				m_lastEndsAccessUnit = completed && !au.m_followed;
+			}
+		}
+
+		if (!delivered)
 		{
 			LOG(DEBUG) << "Queue is empty";
+			fFrameSize = 0;
+			fNumTruncatedBytes = 0;
 		}
 		else
 		{
 			timeval curTime;
 			gettimeofday(&curTime, NULL);
-			Frame *frame = m_captureQueue.front();
-			m_captureQueue.pop_front();
 
-			m_out.notify(curTime.tv_sec, frame->m_size);
-			if (frame->m_size > fMaxSize)
-			{
-				fFrameSize = fMaxSize;
-				fNumTruncatedBytes = frame->m_size - fMaxSize;
-			}
-			else
-			{
-				fFrameSize = frame->m_size;
-			}
 			timeval diff;
-			timersub(&curTime, &(frame->m_timestamp), &diff);
+			timersub(&curTime, &(au.m_timestamp), &diff);
+			m_lastLatency = diff.tv_sec * 1000 + diff.tv_usec / 1000;
 
-			LOG(DEBUG) << "deliverFrame\ttimestamp:" << curTime.tv_sec << "." << curTime.tv_usec << "\tsize:" << fFrameSize << "\tdiff:" << (diff.tv_sec * 1000 + diff.tv_usec / 1000) << "ms\tqueue:" << m_captureQueue.size();
+			LOG(DEBUG) << "deliverFrame\ttimestamp:" << curTime.tv_sec << "." << curTime.tv_usec << "\tsize:" << fFrameSize << "\tnal:" << m_deliveryIndex << "/" << au.m_count << "\tdiff:" << (diff.tv_sec * 1000 + diff.tv_usec / 1000) << "ms\tqueue:" << m_captureQueue.size();
 
 			// CRITICAL: Must use frame intervals from codec, not wall-clock delivery time!
 			// The codec produces frames at codec_fps (e.g., 5fps), but we might deliver faster.
@@ -213,7 +334,11 @@ void V4L2DeviceSource::deliverFrame()
 			{
 				// Subsequent frames: increment by ACTUAL frame interval (preserves codec frame rate)
 				timeval frameInterval;
-				timersub(&frame->m_timestamp, &m_lastPresentationTime, &frameInterval);
+				timersub(&au.m_timestamp, &m_lastPresentationTime, &frameInterval);
+				if ((frameInterval.tv_sec == 0) && (frameInterval.tv_usec > 0))
+				{
+					m_frameInterval = frameInterval.tv_usec;
+				}
 				
 				// Add interval to last presentation time
 				unsigned long uSeconds = fPresentationTime.tv_usec + frameInterval.tv_usec;
@@ -222,17 +347,26 @@ void V4L2DeviceSource::deliverFrame()
 			}
 			
 			// Remember this frame's capture timestamp for next interval calculation
-			m_lastPresentationTime = frame->m_timestamp;
-			
-			memcpy(fTo, frame->m_buffer, fFrameSize);
-			delete frame;
+			m_lastPresentationTime = au.m_timestamp;
+
+			// pacing window of the NAL unit, its share of the window of the access unit
+			unsigned int pacing = m_pacing.load();
+			if ((pacing != 0) && (au.m_size != 0))
+			{
+				fDurationInMicroseconds = (unsigned int)((unsigned long long)m_frameInterval * pacing / 100 * fFrameSize / au.m_size);
+			}
+
+			if (completed)
+			{
+				m_out.notify(curTime.tv_sec, au.m_size);
+				au.release();
+			}
 
 			if (!m_captureQueue.empty())
 			{
 				envir().taskScheduler().triggerEvent(m_eventTriggerId, this);
 			}
 		}
-		m_mutex.unlock();
 
 		if (fFrameSize > 0)
 		{
@@ -242,6 +376,89 @@ void V4L2DeviceSource::deliverFrame()
 	}
 }
 
+// latency budget: when the oldest frame is too old, skip to the newest
+// access unit that can be decoded on its own
+void V4L2DeviceSource::skipStaleFrames()
+{
+	unsigned int budget = m_latencyBudget.load();
+	AccessUnit au;
+	unsigned int head = 0;
+	if ((budget == 0) || !m_captureQueue.peek(au, head))
+	{
+		return;
+	}
+	timeval curTime;
+	gettimeofday(&curTime, NULL);
+	timeval diff;
+	timersub(&curTime, &au.m_timestamp, &diff);
+	unsigned long age = diff.tv_sec * 1000 + diff.tv_usec / 1000;
+	if (age <= budget)
+	{
+		return;
+	}
+
+	// parameter sets just before a key frame stay with it
+	unsigned int target = head;
+	unsigned int paramSetStart = head;
+	bool paramSetBefore = false;
+	AccessUnit item;
+	for (unsigned int ticket = head + 1; m_captureQueue.at(ticket, item); ++ticket)
+	{
+		if (item.m_continued)
+		{
+			continue;
+		}
+		if (item.isKeyFrame())
+		{
+			target = paramSetBefore ? paramSetStart : ticket;
+		}
+		paramSetBefore = (item.m_class == FRAME_PARAMSET);
+		if (paramSetBefore)
+		{
+			paramSetStart = ticket;
+		}
+	}
+
+	if (target == head)
+	{
+		// nothing to jump to yet
+		if ((au.m_class == FRAME_DISPOSABLE) || (au.m_class == FRAME_REFERENCE))
+		{
+			m_keyFrameWanted.store(true);
+		}
+		return;
+	}
+
+	unsigned int count = 0;
+	while (m_captureQueue.peek(au, head) && ((int)(target - head) > 0))
+	{
+		if (m_captureQueue.retire(head))
+		{
+			au.release();
+			if (!au.m_continued)
+			{
+				count++;
+			}
+		}
+	}
+	if (count)
+	{
+		LOG(DEBUG) << "Latency " << age << "ms over budget " << budget << "ms, skipped " << count << " access units";
+		m_skipped += count;
+		m_skips++;
+	}
+}
+
+// give a borrowed frame back to the device, from whichever thread drops it
+void V4L2DeviceSource::DeviceReleaser::release(char *buffer)
+{
+	if (buffer != NULL)
+	{
+		m_source.m_device->releaseFrame(buffer);
+		m_source.m_borrowed.store(false);
+	}
+}
+
 // FrameSource callback on read event
 void V4L2DeviceSource::incomingPacketHandler()
 {
@@ -258,8 +475,38 @@ int V4L2DeviceSource::getNextFrame()
 		// During shutdown, quietly indicate no frame without spamming logs
 		return 0;
 	}
-	char *buffer = new char[m_device->getBufferSize()];
-	int frameSize = m_device->read(buffer, m_device->getBufferSize());
+	FrameReleaser *owner = m_pool;
+	char *buffer = NULL;
+	unsigned long long readStart = LatencyHistogram::now();
+	int frameSize = 0;
+	// a lent buffer is only given back once the frame is delivered: borrow it
+	// while the consumers keep up, copy it while frames are queued (the queue
+	// policies then apply) or nobody reads them, so the device is never held
+	bool consumerActive = (readStart - m_lastDelivery.load() < BorrowConsumerUs);
+	if (m_device->canBorrowFrames() && !m_borrowed.load() && m_captureQueue.empty() && consumerActive)
+	{
+		// zero-copy: frames point into the device buffer until the last one is released
+		owner = &m_deviceReleaser;
+		frameSize = m_device->borrowFrame(buffer);
+		if (frameSize > 0)
+		{
+			m_borrowed.store(true);
+			m_borrowedFrames++;
+		}
+	}
+	else
+	{
+		buffer = m_pool->acquire();
+		frameSize = m_device->read(buffer, m_pool->getBufferSize());
+		if ((frameSize > 0) && m_device->canBorrowFrames())
+		{
+			m_copiedFrames++;
+		}
+	}
+	if (frameSize > 0)
+	{
+		m_latency[STAGE_READ].addSince(readStart);
+	}
 	
 	// Take timestamp AFTER read() completes, not before
 	// SNX driver blocks in read() for rate limiting, so timestamp before read
@@ -272,24 +519,24 @@ int V4L2DeviceSource::getNextFrame()
 		if (!m_stop.load()) {
 		LOG(NOTICE) << "V4L2DeviceSource::getNextFrame errno:" << errno << " " << strerror(errno);
 		}
-		delete[] buffer;
+		owner->release(buffer);
 	}
 	else if (frameSize == 0)
 	{
 		if (!m_stop.load()) {
 		LOG(DEBUG) << "V4L2DeviceSource::getNextFrame no data errno:" << errno << " " << strerror(errno);
 		}
-		delete[] buffer;
+		owner->release(buffer);
 	}
 	else
 	{
-		this->postFrame(buffer, frameSize, ref);
+		this->postFrame(buffer, frameSize, ref, owner);
 	}
 	return frameSize;
 }
 
 // post frame to queue
-void V4L2DeviceSource::postFrame(char *frame, int frameSize, const timeval &ref)
+void V4L2DeviceSource::postFrame(char *frame, int frameSize, const timeval &ref, FrameReleaser *owner)
 {
 	timeval tv;
 	gettimeofday(&tv, NULL);
@@ -298,7 +545,7 @@ void V4L2DeviceSource::postFrame(char *frame, int frameSize, const timeval &ref)
 	m_in.notify(tv.tv_sec, frameSize);
 	LOG(DEBUG) << "postFrame\ttimestamp:" << ref.tv_sec << "." << ref.tv_usec << "\tsize:" << frameSize << "\tdiff:" << (diff.tv_sec * 1000 + diff.tv_usec / 1000) << "ms";
 
-	processFrame(frame, frameSize, ref);
+	// write before queuing: once queued the buffer may be recycled by the consumer
 	if (m_outfd != -1)
 	{
 		int written = write(m_outfd, frame, frameSize);
@@ -307,50 +554,269 @@ void V4L2DeviceSource::postFrame(char *frame, int frameSize, const timeval &ref)
 			LOG(NOTICE) << "error writing output " << written << "/" << frameSize << " err:" << strerror(errno);
 		}
 	}
+	processFrame(frame, frameSize, ref, owner ? owner : m_pool);
 }
 
-void V4L2DeviceSource::processFrame(char *frame, int frameSize, const timeval &ref)
+void V4L2DeviceSource::processFrame(char *frame, int frameSize, const timeval &ref, FrameReleaser *owner)
 {
 	timeval tv;
 	gettimeofday(&tv, NULL);
 	timeval diff;
 	timersub(&tv, &ref, &diff);
 
+	m_pendingKeyFrame.reset();
 	std::list<std::pair<unsigned char *, size_t>> frameList = this->splitFrames((unsigned char *)frame, frameSize);
-	while (!frameList.empty())
+	if (frameList.empty())
 	{
-		std::pair<unsigned char *, size_t> &item = frameList.front();
-		size_t size = item.second;
-		char *allocatedBuffer = NULL;
-		if (frameList.size() == 1)
+		// nothing queued owns the buffer
+		owner->release(frame);
+		return;
+	}
+
+	// one capture buffer is one access unit, its class is the highest of its frames
+	FrameClass auClass = FRAME_INDEPENDENT;
+	bool hasParamSet = false;
+	for (std::list<std::pair<unsigned char *, size_t>>::iterator it = frameList.begin(); it != frameList.end(); ++it)
+	{
+		FrameClass frameClass = this->classifyFrame(it->first, it->second);
+		if (frameClass == FRAME_PARAMSET)
+		{
+			hasParamSet = true;
+		}
+		if (frameClass > auClass)
 		{
-			// last frame will release buffer
-			allocatedBuffer = frame;
+			auClass = frameClass;
 		}
-		queueFrame((char *)item.first, size, ref, allocatedBuffer);
-		frameList.pop_front();
+	}
+
+	m_keyFrames.notifyFrame((auClass == FRAME_KEY) || (auClass == FRAME_INDEPENDENT));
+	if (m_keyFrameWanted.exchange(false) && (auClass != FRAME_KEY))
+	{
+		m_keyFrames.request(KeyFrameBroker::REASON_RECOVERY);
+	}
 
-		LOG(DEBUG) << "queueFrame\ttimestamp:" << ref.tv_sec << "." << ref.tv_usec << "\tsize:" << size << "\tdiff:" << (diff.tv_sec * 1000 + diff.tv_usec / 1000) << "ms";
+	if (auClass == FRAME_KEY)
+	{
+		// a key frame makes the backlog useless: jump to it
+		bool restart = m_waitKeyFrame;
+		if (m_captureQueue.size() > m_captureQueue.limit() / 2)
+		{
+			this->flushQueue();
+			restart = true;
+		}
+		if (restart && !hasParamSet)
+		{
+			// parameter sets may have gone with the dropped frames
+			std::list<std::pair<unsigned char *, size_t>> paramSets = this->getParameterSets();
+			frameList.splice(frameList.begin(), paramSets);
+		}
+		m_waitKeyFrame = false;
+	}
+	else if (m_waitKeyFrame)
+	{
+		// its references are gone
+		LOG(DEBUG) << "Waiting key frame drop frame size:" << frameSize;
+		m_dropped++;
+		owner->release(frame);
+		return;
+	}
+	else if ((auClass == FRAME_DISPOSABLE) && m_captureQueue.full())
+	{
+		// nothing depends on it, cheapest to drop
+		LOG(DEBUG) << "Queue full drop disposable frame size:" << frameSize;
+		m_dropped++;
+		owner->release(frame);
+		return;
+	}
+
+	this->addCaptureTime(frameList, ref);
+
+	// one queue entry per MAX_NALS NAL units, the last one owns the buffer
+	unsigned int entries = (frameList.size() + AccessUnit::MAX_NALS - 1) / AccessUnit::MAX_NALS;
+
+	// make room for the whole access unit
+	while (!m_captureQueue.empty() && (m_captureQueue.size() + entries > m_captureQueue.limit()))
+	{
+		this->evictAccessUnit();
+		if (m_waitKeyFrame && (auClass != FRAME_KEY))
+		{
+			// the chain this frame belongs to was dropped
+			LOG(DEBUG) << "Waiting key frame drop frame size:" << frameSize;
+			m_dropped++;
+			owner->release(frame);
+			return;
+		}
+	}
+	if (auClass == FRAME_KEY)
+	{
+		m_waitKeyFrame = false;
+	}
+
+	AccessUnit au(ref, auClass);
+	au.m_queued = LatencyHistogram::now();
+	for (std::list<std::pair<unsigned char *, size_t>>::iterator it = frameList.begin(); it != frameList.end(); ++it)
+	{
+		if (!au.append((char *)it->first, it->second))
+		{
+			au.m_followed = true;
+			this->queueAccessUnit(au);
+			au = AccessUnit(ref, auClass);
+			au.m_queued = LatencyHistogram::now();
+			au.m_continued = true;
+			au.append((char *)it->first, it->second);
+		}
+	}
+	au.m_allocatedBuffer = frame;
+	au.m_owner = owner;
+	std::shared_ptr<const void> hold;
+	if (m_pendingKeyFrame)
+	{
+		hold = this->keepKeyFrame(au, frame, frameSize, owner);
+	}
+	else if (auClass >= FRAME_PARAMSET)
+	{
+		// only these carry cached parameter sets, whatever changes until they are sent
+		hold = this->holdParameterSets();
+	}
+	if (hold)
+	{
+		au.m_hold = new std::shared_ptr<const void>(hold);
 	}
+	this->queueAccessUnit(au);
+
+	LOG(DEBUG) << "queueAccessUnit\ttimestamp:" << ref.tv_sec << "." << ref.tv_usec << "\tsize:" << frameSize << "\tnal:" << frameList.size() << "\tdiff:" << (diff.tv_sec * 1000 + diff.tv_usec / 1000) << "ms";
 }
 
-// post a frame to fifo
-void V4L2DeviceSource::queueFrame(char *frame, int frameSize, const timeval &tv, char *allocatedBuffer)
+// post an access unit to fifo
+void V4L2DeviceSource::queueAccessUnit(const AccessUnit &au)
 {
-	m_mutex.lock();
-	while (m_captureQueue.size() >= m_queueSize)
+	while (!m_captureQueue.push(au))
 	{
-		LOG(DEBUG) << "Queue full size drop frame size:" << (int)m_captureQueue.size();
-		delete m_captureQueue.front();
-		m_captureQueue.pop_front();
+		// access unit larger than the queue
+		LOG(DEBUG) << "Queue full size drop access unit size:" << (int)m_captureQueue.size();
+		AccessUnit oldest;
+		if (m_captureQueue.evict(oldest))
+		{
+			this->deferRelease(oldest);
+			m_dropped++;
+		}
 	}
-	m_captureQueue.push_back(new Frame(frame, frameSize, tv, allocatedBuffer));
-	m_mutex.unlock();
 
 	// post an event to ask to deliver the frame
 	envir().taskScheduler().triggerEvent(m_eventTriggerId, this);
 }
 
+// drop the oldest access unit; if later access units refer to it they are
+// dropped too, up to the next key frame or parameter sets
+void V4L2DeviceSource::evictAccessUnit()
+{
+	AccessUnit au;
+	if (!m_captureQueue.evict(au))
+	{
+		return;
+	}
+	bool chain = (au.m_class >= FRAME_REFERENCE);
+	LOG(DEBUG) << "Queue full drop access unit class:" << au.m_class << " chain:" << chain;
+	this->deferRelease(au);
+	m_dropped++;
+
+	AccessUnit next;
+	unsigned int ticket = 0;
+	while (m_captureQueue.peek(next, ticket))
+	{
+		if (!next.m_continued && (!chain || (next.m_class >= FRAME_PARAMSET)))
+		{
+			return;
+		}
+		if (!m_captureQueue.evict(next))
+		{
+			break;
+		}
+		this->deferRelease(next);
+		if (!next.m_continued)
+		{
+			m_dropped++;
+		}
+	}
+
+	if (chain)
+	{
+		// nothing left to decode from, skip until the next key frame
+		LOG(DEBUG) << "Queue drained, waiting key frame";
+		m_waitKeyFrame = true;
+		m_keyFrames.request(KeyFrameBroker::REASON_RECOVERY);
+	}
+}
+
+// the live555 thread may be copying from an access unit the capture thread
+// drops: it gets the buffer back on its next event
+void V4L2DeviceSource::deferRelease(AccessUnit &au)
+{
+	if ((au.m_allocatedBuffer == NULL) && (au.m_hold == NULL))
+	{
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_droppedMutex);
+		m_droppedUnits.push_back(au);
+	}
+	// the list owns them now
+	au.m_allocatedBuffer = NULL;
+	au.m_hold = NULL;
+	envir().taskScheduler().triggerEvent(m_eventTriggerId, this);
+}
+
+// live555 thread, outside of any copy from the capture queue
+void V4L2DeviceSource::releaseDropped()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_droppedMutex);
+		if (m_droppedUnits.empty())
+		{
+			return;
+		}
+		m_releasing.swap(m_droppedUnits);
+	}
+	for (std::vector<AccessUnit>::iterator it = m_releasing.begin(); it != m_releasing.end(); ++it)
+	{
+		it->release();
+	}
+	m_releasing.clear();
+}
+
+// drop everything queued
+void V4L2DeviceSource::flushQueue()
+{
+	AccessUnit au;
+	unsigned int count = 0;
+	while (m_captureQueue.evict(au))
+	{
+		this->deferRelease(au);
+		if (!au.m_continued)
+		{
+			count++;
+		}
+	}
+	if (count)
+	{
+		LOG(DEBUG) << "Queue flushed " << count << " access units";
+		m_dropped += count;
+		m_flushes++;
+	}
+}
+
+// publish a new aux SDP line, capture thread
+void V4L2DeviceSource::setAuxLine(const std::string &auxLine)
+{
+	std::lock_guard<std::mutex> lock(m_auxMutex);
+	if (auxLine != m_auxLine)
+	{
+		m_auxLine = auxLine;
+		m_auxVersion++;
+		LOG(NOTICE) << "SDP parameters version:" << m_auxVersion.load() << " " << m_auxLine;
+	}
+}
+
 // split packet in frames
 std::list<std::pair<unsigned char *, size_t>> V4L2DeviceSource::splitFrames(unsigned char *frame, unsigned frameSize)
 {
@@ -358,9 +824,151 @@ std::list<std::pair<unsigned char *, size_t>> V4L2DeviceSource::splitFrames(unsi
 	if (frame != NULL)
 	{
 		frameList.push_back(std::pair<unsigned char *, size_t>(frame, frameSize));
+		this->startKeyFrame().add(frame, frameSize);
+	}
+	return frameList;
+}
+
+V4L2DeviceSource::KeyFrame &V4L2DeviceSource::startKeyFrame()
+{
+	m_pendingKeyFrame = std::make_shared<KeyFrame>();
+	return *m_pendingKeyFrame;
+}
+
+// a buffer of our own is kept as it is, the access unit holds the key frame
+// that gives it back; a lent one is copied, and only while snapshots are read
+std::shared_ptr<const void> V4L2DeviceSource::keepKeyFrame(AccessUnit &au, char *frame, int frameSize, FrameReleaser *owner)
+{
+	std::shared_ptr<KeyFrame> keyFrame;
+	keyFrame.swap(m_pendingKeyFrame);
+	std::shared_ptr<const void> paramSets = this->holdParameterSets();
+	std::shared_ptr<const void> hold = paramSets;
+	if (owner == &m_deviceReleaser)
+	{
+		if (LatencyHistogram::now() - m_snapshotRead.load() > SnapshotReaderUs)
+		{
+			return hold;
+		}
+		keyFrame->copy(frame, frameSize, paramSets);
+	}
+	else
+	{
+		keyFrame->keep(frame, owner, paramSets);
+		au.m_allocatedBuffer = NULL;
+		au.m_owner = NULL;
+		hold = keyFrame;
+	}
+	// the previous one goes outside of the lock
+	std::shared_ptr<KeyFrame> previous(keyFrame);
+	{
+		std::lock_guard<std::mutex> lock(m_lastFrameMutex);
+		m_lastKeyFrame.swap(previous);
+	}
+	return hold;
+}
 
+std::shared_ptr<const std::string> V4L2DeviceSource::getLastFrame()
+{
+	unsigned long long now = LatencyHistogram::now();
+	unsigned long long lastRead = m_snapshotRead.exchange(now);
+	if (m_device && m_device->canBorrowFrames() && (now - lastRead > SnapshotReaderUs))
+	{
+		// key frames were not kept meanwhile, the next one will be
+		m_keyFrames.request(KeyFrameBroker::REASON_SNAPSHOT);
+	}
+	std::shared_ptr<KeyFrame> keyFrame;
+	{
 		std::lock_guard<std::mutex> lock(m_lastFrameMutex);
-		m_lastFrame.assign((char *)frame, frameSize);
+		keyFrame = m_lastKeyFrame;
 	}
-	return frameList;
+	return keyFrame ? keyFrame->image() : std::shared_ptr<const std::string>();
+}
+
+void V4L2DeviceSource::KeyFrame::keep(char *buffer, FrameReleaser *owner, const std::shared_ptr<const void> &paramSets)
+{
+	m_buffer = buffer;
+	m_owner = owner;
+	m_paramSets = paramSets;
+}
+
+void V4L2DeviceSource::KeyFrame::copy(const char *buffer, size_t size, const std::shared_ptr<const void> &paramSets)
+{
+	m_paramSets = paramSets;
+	size_t copied = 0;
+	for (std::vector<std::pair<const char *, size_t>>::iterator it = m_parts.begin(); it != m_parts.end(); ++it)
+	{
+		if ((it->first >= buffer) && (it->first < buffer + size))
+		{
+			copied += it->second;
+		}
+	}
+	// reserved up front so that the parts can point into it
+	m_copy.reserve(copied);
+	for (std::vector<std::pair<const char *, size_t>>::iterator it = m_parts.begin(); it != m_parts.end(); ++it)
+	{
+		if ((it->first >= buffer) && (it->first < buffer + size))
+		{
+			size_t offset = m_copy.size();
+			m_copy.append(it->first, it->second);
+			it->first = m_copy.data() + offset;
+		}
+	}
+}
+
+std::shared_ptr<const std::string> V4L2DeviceSource::KeyFrame::image()
+{
+	if (!m_image)
+	{
+		size_t size = 0;
+		for (std::vector<std::pair<const char *, size_t>>::const_iterator it = m_parts.begin(); it != m_parts.end(); ++it)
+		{
+			size += it->second;
+		}
+		std::shared_ptr<std::string> image = std::make_shared<std::string>();
+		image->reserve(size);
+		for (std::vector<std::pair<const char *, size_t>>::const_iterator it = m_parts.begin(); it != m_parts.end(); ++it)
+		{
+			image->append(it->first, it->second);
+		}
+		m_image = image;
+	}
+	return m_image;
+}
+
+// runtime counters
+std::string V4L2DeviceSource::getStats()
+{
+	std::ostringstream os;
+	os << "{\"queue\":{\"size\":" << m_queueSize << ",\"depth\":" << m_captureQueue.size();
+	os << ",\"dropped\":" << m_dropped.load() << ",\"flushes\":" << m_flushes.load() << "}";
+	os << ",\"latency\":{\"budget\":" << m_latencyBudget.load() << ",\"last\":" << m_lastLatency;
+	os << ",\"skips\":" << m_skips << ",\"skipped\":" << m_skipped << "}";
+	os << ",\"capture\":{\"wakeups\":" << m_wakeups.load() << ",\"idle\":" << m_idleWakeups.load() << ",\"timeouts\":" << m_timeouts.load();
+	os << ",\"truncated\":" << (m_device ? m_device->getTruncatedFrames() : 0);
+	if (m_device && m_device->canBorrowFrames())
+	{
+		os << ",\"borrowed\":" << m_borrowedFrames.load() << ",\"copied\":" << m_copiedFrames.load();
+	}
+	os << "}";
+	const char *stages[STAGE_COUNT] = {"read", "queue", "copy", "framer", "send"};
+	os << ",\"stages\":{";
+	for (int stage = 0; stage < STAGE_COUNT; ++stage)
+	{
+		os << (stage ? "," : "") << "\"" << stages[stage] << "\":" << m_latency[stage].toJSON();
+	}
+	os << "}";
+	os << ",\"keyframes\":" << m_keyFrames.toJSON();
+	if (m_pool)
+	{
+		os << ",\"pool\":{\"count\":" << m_pool->getCount() << ",\"bufferSize\":" << m_pool->getBufferSize();
+		os << ",\"available\":" << m_pool->getAvailable() << ",\"hits\":" << m_pool->getHits() << ",\"misses\":" << m_pool->getMisses() << "}";
+	}
+	os << ",\"consumers\":[";
+	for (std::list<Consumer *>::iterator it = m_consumers.begin(); it != m_consumers.end(); ++it)
+	{
+		os << ((it != m_consumers.begin()) ? "," : "") << (*it)->toJSON();
+	}
+	os << "]";
+	os << "}";
+	return os.str();
 }
@@ -7,7 +7,13 @@
 #include <cstring>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/ioctl.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
 
 #include "logger.h"
 
@@ -88,18 +94,21 @@ bool copyDeviceName(char *dest, size_t destSize, const std::string &name)
 
 struct SnxCodecController::Impl
 {
-    bool running;
+    std::atomic<bool> running;
 #ifdef HAVE_SNX_SDK
     struct Session
     {
         snx_m2m ctx;
         snx_rc rc;      // Rate control state for CBR
         bool isM2M;
-        bool active;
+        std::atomic<bool> active;  // also read by requestIDR() callers
         bool codecInitialized;
         bool codecStarted;
         bool ispInitialized;
         bool ispStarted;
+        bool held;      // codec buffer lent out, not reset yet
+        // length of the capture buffers, the largest access unit the codec hands out
+        std::atomic<size_t> capacity;
         Session()
             : isM2M(false)
             , active(false)
@@ -107,11 +116,36 @@ struct SnxCodecController::Impl
             , codecStarted(false)
             , ispInitialized(false)
             , ispStarted(false)
+            , held(false)
         {
             std::memset(&ctx, 0, sizeof(ctx));
             std::memset(&rc, 0, sizeof(rc));
+            capacity.store(0);
         }
-    // single-threaded usage; no mutex to support older toolchains
+    // only touched by the pump thread once started
+    };
+
+    struct Frame
+    {
+        const unsigned char *data;
+        size_t size;
+        timeval presentation;
+        bool key;
+    };
+
+    // Access unit lent from the pump to a source. It points into the codec
+    // buffer, which goes back to the driver (snx_codec_reset) only once the
+    // source releases it, so a stream has at most one. wakeFd[0] is readable
+    // exactly when ready is set.
+    struct StreamQueue
+    {
+        std::mutex mutex;
+        Frame frame;
+        bool ready;                     // read by the pump, not borrowed yet
+        bool lent;                      // borrowed, not released yet
+        std::atomic<bool> released;     // the pump has to reset the codec buffer
+        int wakeFd[2];
+        StreamQueue() : ready(false), lent(false), released(false) { wakeFd[0] = wakeFd[1] = -1; }
     };
 
     StreamParams highParams;
@@ -119,7 +153,36 @@ struct SnxCodecController::Impl
     DeviceConfig deviceConfig;
     Session highSession;
     Session lowSession;
-    // single-threaded usage; no mutex to support older toolchains
+
+    // The SDK is not thread safe: once started, sessions are only used from
+    // the pump thread. Other threads post commands through controlFd.
+    std::thread pumpThread;
+    std::atomic<bool> pumping;
+    int controlFd[2];
+    std::atomic<bool> idrRequested[2];
+    std::atomic<bool> restartRequested[2];
+    // params a session runs with until its restart, back to them if it fails
+    StreamParams restartFrom[2];
+    // the CAP (low) session attaches again once the restarted M2M one settled
+    bool lowReopenPending;
+    std::chrono::steady_clock::time_point lowReopenAt;
+    StreamQueue highQueue;
+    StreamQueue lowQueue;
+
+    // reconfigure() requests, one per stream, applied by the pump. The mutex
+    // also guards the params the pump changes and other threads read
+    std::mutex reconfigMutex;
+    std::atomic<bool> reconfigPending;
+    bool reconfigQueued[2];
+    StreamParams reconfigParams[2];
+    ChangeStatus reconfigStatus[2];
+
+    Impl();
+    ~Impl();
+
+    Session &session(StreamKind stream) { return (stream == StreamKind::High) ? highSession : lowSession; }
+    StreamQueue &queue(StreamKind stream) { return (stream == StreamKind::High) ? highQueue : lowQueue; }
+    StreamParams &params(StreamKind stream) { return (stream == StreamKind::High) ? highParams : lowParams; }
 
     bool configureSession(Session &session,
                           const StreamParams &params,
@@ -128,12 +191,92 @@ struct SnxCodecController::Impl
                           bool isM2M,
                           unsigned int scale);
 
+    void initRateControl(Session &session);
     void cleanupSession(Session &session);
     void cleanupSessionLocked(Session &session);
 
+    void startPump();
+    void stopPump();
+    void pump();
+    void wakePump();
+    void readSession(StreamKind stream);
+    void resetSession(StreamKind stream);
+    bool forceIDR(StreamKind stream);
+    bool applyParams(StreamKind stream, const StreamParams &params, ChangeReport &report);
+    void applyRequests();
+    bool restartsWithLow(StreamKind stream) const { return (stream == StreamKind::High) && (lowSession.active || lowReopenPending); }
+    bool withdrawFrames(StreamKind stream, bool withLow);
+    bool reopenSession(Session &session, const StreamParams &params);
+    bool restartSession(StreamKind stream);
+    void reopenLowSession();
+    int pollTimeout() const;
+    void clearQueue(StreamQueue &queue);
+#else
+    Impl() : running(false) {}
 #endif // HAVE_SNX_SDK
 };
 
+#ifdef HAVE_SNX_SDK
+static bool openPipe(int fds[2])
+{
+    if (pipe(fds) != 0)
+    {
+        LOG(ERROR) << "pipe failed (" << strerror(errno) << ")";
+        fds[0] = fds[1] = -1;
+        return false;
+    }
+    for (int i = 0; i < 2; ++i)
+    {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    return true;
+}
+
+static void closePipe(int fds[2])
+{
+    for (int i = 0; i < 2; ++i)
+    {
+        if (fds[i] >= 0)
+        {
+            close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+}
+
+static void drainPipe(int fd)
+{
+    char buf[64];
+    while (read(fd, buf, sizeof(buf)) > 0)
+    {
+    }
+}
+
+SnxCodecController::Impl::Impl()
+    : running(false), pumping(false), lowReopenPending(false), reconfigPending(false)
+{
+    idrRequested[0] = false;
+    idrRequested[1] = false;
+    restartRequested[0] = false;
+    restartRequested[1] = false;
+    reconfigQueued[0] = false;
+    reconfigQueued[1] = false;
+    // pipes live as long as the controller: sources keep waiting on them
+    openPipe(controlFd);
+    openPipe(highQueue.wakeFd);
+    openPipe(lowQueue.wakeFd);
+}
+
+SnxCodecController::Impl::~Impl()
+{
+    stopPump();
+    closePipe(controlFd);
+    closePipe(highQueue.wakeFd);
+    closePipe(lowQueue.wakeFd);
+}
+#endif // HAVE_SNX_SDK
+
 #ifdef HAVE_SNX_SDK
 bool SnxCodecController::Impl::configureSession(Session &session,
                           const StreamParams &params,
@@ -149,6 +292,7 @@ bool SnxCodecController::Impl::configureSession(Session &session,
     session.codecStarted = false;
     session.ispInitialized = false;
     session.ispStarted = false;
+    session.held = false;
 
     if (codecDevice.empty())
     {
@@ -411,32 +555,7 @@ bool SnxCodecController::Impl::configureSession(Session &session,
 codec_init_ok:
     session.codecInitialized = true;
 
-    // Initialize Rate Control for H.264 CBR
-    if (session.ctx.codec_fmt == V4L2_PIX_FMT_H264 && session.ctx.bit_rate > 0)
-    {
-        // Initialize RC struct for CBR (per SDK documentation)
-        session.rc.width = session.ctx.width / session.ctx.scale;
-        session.rc.height = session.ctx.height / session.ctx.scale;
-        session.rc.codec_fd = session.ctx.codec_fd;
-        session.rc.Targetbitrate = session.ctx.bit_rate;
-        session.rc.framerate = session.ctx.codec_fps;  // CRITICAL: Use codec_fps, not isp_fps
-        session.rc.gop = session.ctx.gop;              // Use GOP setting from ctx
-
-        // Seed initial QP from rate control (required for CBR loop)
-        // NOTE: snx_codec_rc_init() loads defaults and OVERWRITES snx_rc_ext values
-        LOG(INFO) << "RC: targetBitrate=" << session.rc.Targetbitrate 
-                  << " fps=" << session.rc.framerate << " gop=" << session.rc.gop;
-        session.ctx.qp = snx_codec_rc_init(&session.rc, SNX_RC_INIT);
-        LOG(INFO) << "RC initialized with QP=" << session.ctx.qp;
-
-        // Disable motion detection features AFTER rc_init (which loads defaults)
-        // These features dynamically adjust FPS/bitrate, causing stuttering
-        session.rc.snx_rc_ext.mdrc_en = 0;        // Disable motion detection rate control
-        session.rc.snx_rc_ext.md_cnt_en = 0;      // Disable motion detection low bitrate mode
-        session.rc.snx_rc_ext.rc_update = 0;      // Prevent dynamic RC parameter updates
-        snx_rc_ext_set(&session.rc.snx_rc_ext);
-        LOG(DEBUG) << "Motion detection disabled (mdrc=0, md_cnt=0)";
-    }
+    initRateControl(session);
 
     if (isM2M)
     {
@@ -502,10 +621,47 @@ codec_init_ok:
         LOG(WARN) << "snx_codec_set_gop failed";
     }
 
+    // capture buffers are mapped once the codec is started
+    if (session.ctx.cap_buffers != NULL && session.ctx.cap_buffers[0].length > 0)
+    {
+        session.capacity.store(session.ctx.cap_buffers[0].length);
+        LOG(INFO) << "Codec capture buffer size " << session.ctx.cap_buffers[0].length;
+    }
+
     session.active = true;
     return true;
 }
 
+// Initialize Rate Control for H.264 CBR, also when the bitrate or GOP changes
+void SnxCodecController::Impl::initRateControl(Session &session)
+{
+    if (session.ctx.codec_fmt == V4L2_PIX_FMT_H264 && session.ctx.bit_rate > 0)
+    {
+        // Initialize RC struct for CBR (per SDK documentation)
+        session.rc.width = session.ctx.width / session.ctx.scale;
+        session.rc.height = session.ctx.height / session.ctx.scale;
+        session.rc.codec_fd = session.ctx.codec_fd;
+        session.rc.Targetbitrate = session.ctx.bit_rate;
+        session.rc.framerate = session.ctx.codec_fps;  // CRITICAL: Use codec_fps, not isp_fps
+        session.rc.gop = session.ctx.gop;              // Use GOP setting from ctx
+
+        // Seed initial QP from rate control (required for CBR loop)
+        // NOTE: snx_codec_rc_init() loads defaults and OVERWRITES snx_rc_ext values
+        LOG(INFO) << "RC: targetBitrate=" << session.rc.Targetbitrate 
+                  << " fps=" << session.rc.framerate << " gop=" << session.rc.gop;
+        session.ctx.qp = snx_codec_rc_init(&session.rc, SNX_RC_INIT);
+        LOG(INFO) << "RC initialized with QP=" << session.ctx.qp;
+
+        // Disable motion detection features AFTER rc_init (which loads defaults)
+        // These features dynamically adjust FPS/bitrate, causing stuttering
+        session.rc.snx_rc_ext.mdrc_en = 0;        // Disable motion detection rate control
+        session.rc.snx_rc_ext.md_cnt_en = 0;      // Disable motion detection low bitrate mode
+        session.rc.snx_rc_ext.rc_update = 0;      // Prevent dynamic RC parameter updates
+        snx_rc_ext_set(&session.rc.snx_rc_ext);
+        LOG(DEBUG) << "Motion detection disabled (mdrc=0, md_cnt=0)";
+    }
+}
+
 void SnxCodecController::Impl::cleanupSession(Session &session)
 {
     cleanupSessionLocked(session);
@@ -568,14 +724,429 @@ void SnxCodecController::Impl::cleanupSessionLocked(Session &session)
     session.ctx.cap_bytesused = 0;
     session.ctx.flags = 0;
 
+    session.held = false;
     session.active = false;
 }
+
+void SnxCodecController::Impl::startPump()
+{
+    if (pumpThread.joinable())
+    {
+        return;
+    }
+    pumping = true;
+    pumpThread = std::thread(&SnxCodecController::Impl::pump, this);
+}
+
+void SnxCodecController::Impl::stopPump()
+{
+    if (!pumpThread.joinable())
+    {
+        return;
+    }
+    pumping = false;
+    wakePump();
+    pumpThread.join();
+}
+
+void SnxCodecController::Impl::wakePump()
+{
+    if (controlFd[1] >= 0)
+    {
+        char c = 0;
+        if (write(controlFd[1], &c, 1) < 0 && errno != EAGAIN)
+        {
+            LOG(WARN) << "SNX pump wakeup failed (" << strerror(errno) << ")";
+        }
+    }
+}
+
+// single thread owning the SDK: waits on both codec fds and reads whichever is ready
+void SnxCodecController::Impl::pump()
+{
+    LOG(NOTICE) << "SNX pump begin";
+    while (pumping)
+    {
+        struct pollfd fds[3];
+        StreamKind streams[3];
+        nfds_t nfds = 0;
+        fds[nfds].fd = controlFd[0];
+        fds[nfds].events = POLLIN;
+        fds[nfds].revents = 0;
+        nfds++;
+        const StreamKind kinds[2] = {StreamKind::High, StreamKind::Low};
+        for (int i = 0; i < 2; ++i)
+        {
+            Session &s = session(kinds[i]);
+            // while its buffer is lent the session waits for releaseFrame()
+            if (s.active && s.ctx.codec_fd >= 0 && !s.held)
+            {
+                fds[nfds].fd = s.ctx.codec_fd;
+                fds[nfds].events = POLLIN;
+                fds[nfds].revents = 0;
+                streams[nfds] = kinds[i];
+                nfds++;
+            }
+        }
+
+        int ret = poll(fds, nfds, pollTimeout());
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            LOG(ERROR) << "SNX pump poll failed (" << strerror(errno) << ")";
+            break;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            drainPipe(controlFd[0]);
+        }
+        for (int i = 0; i < 2; ++i)
+        {
+            if (idrRequested[i].exchange(false))
+            {
+                forceIDR(kinds[i]);
+            }
+            if (queue(kinds[i]).released.exchange(false))
+            {
+                resetSession(kinds[i]);
+            }
+        }
+        if (reconfigPending.exchange(false))
+        {
+            applyRequests();
+        }
+        for (int i = 0; i < 2; ++i)
+        {
+            // retried on each wakeup until no frame of the session is lent,
+            // the low session waits for its scheduled reopen
+            if (!restartRequested[i] || ((kinds[i] == StreamKind::Low) && lowReopenPending)
+                || !withdrawFrames(kinds[i], restartsWithLow(kinds[i])))
+            {
+                continue;
+            }
+            restartRequested[i] = false;
+            const bool restarted = restartSession(kinds[i]);
+            std::lock_guard<std::mutex> lock(reconfigMutex);
+            reconfigStatus[i].pending = reconfigQueued[i];
+            reconfigStatus[i].report.fps = restarted ? Restart : Failed;
+        }
+        if (lowReopenPending && (std::chrono::steady_clock::now() >= lowReopenAt))
+        {
+            reopenLowSession();
+        }
+
+        bool failed = false;
+        for (nfds_t i = 1; i < nfds; ++i)
+        {
+            if (fds[i].revents & POLLIN)
+            {
+                readSession(streams[i]);
+            }
+            else if (fds[i].revents & (POLLERR | POLLNVAL))
+            {
+                failed = true;
+            }
+        }
+        if (failed)
+        {
+            // e.g. no buffer queued on the codec: do not spin on it
+            usleep(10000);
+        }
+    }
+    LOG(NOTICE) << "SNX pump end";
+}
+
+// read one access unit and lend it to the stream queue
+void SnxCodecController::Impl::readSession(StreamKind stream)
+{
+    Session &session = this->session(stream);
+    StreamQueue &queue = this->queue(stream);
+
+    int ret = snx_codec_read(&session.ctx);
+    if (ret != 0)
+    {
+        if (ret != -EAGAIN && ret != -EINTR)
+        {
+            LOG(WARN) << "snx_codec_read returned " << ret;
+        }
+        return;
+    }
+
+    if (session.ctx.cap_index < 0 || session.ctx.cap_buffers == NULL)
+    {
+        LOG(WARN) << "SNX codec returned invalid buffer index";
+        snx_codec_reset(&session.ctx);
+        return;
+    }
+
+    const unsigned char *raw = static_cast<const unsigned char *>(session.ctx.cap_buffers[session.ctx.cap_index].start);
+    size_t payload = static_cast<size_t>(std::max(0, session.ctx.cap_bytesused));
+    const size_t capacity = session.ctx.cap_buffers[session.ctx.cap_index].length;
+    if (payload > capacity)
+    {
+        payload = capacity;
+    }
+
+    // Per-frame bitrate feedback for CBR (H.264 only)
+    if (session.ctx.cap_bytesused > 0 && session.ctx.codec_fmt == V4L2_PIX_FMT_H264 && session.ctx.bit_rate > 0)
+    {
+        // Update QP based on actual frame size to maintain target bitrate
+        session.ctx.qp = snx_codec_rc_update(&session.ctx, &session.rc);
+    }
+
+    if (payload == 0)
+    {
+        if (snx_codec_reset(&session.ctx) != 0)
+        {
+            LOG(WARN) << "snx_codec_reset failed";
+        }
+        return;
+    }
+
+    // the buffer stays out of the driver until the source is done with it
+    session.held = true;
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.frame.data = raw;
+    queue.frame.size = payload;
+    queue.frame.presentation = session.ctx.timestamp;
+    queue.frame.key = (session.ctx.flags & V4L2_BUF_FLAG_KEYFRAME) != 0;
+    queue.ready = true;
+    char c = 0;
+    if (write(queue.wakeFd[1], &c, 1) < 0 && errno != EAGAIN)
+    {
+        LOG(WARN) << "SNX stream wakeup failed (" << strerror(errno) << ")";
+    }
+}
+
+// give the lent codec buffer back to the driver
+void SnxCodecController::Impl::resetSession(StreamKind stream)
+{
+    Session &session = this->session(stream);
+    if (!session.held)
+    {
+        return;
+    }
+    session.held = false;
+    if (session.active && snx_codec_reset(&session.ctx) != 0)
+    {
+        LOG(WARN) << "snx_codec_reset failed";
+    }
+}
+
+// forget the lent frame; called with the queue mutex held
+void SnxCodecController::Impl::clearQueue(StreamQueue &queue)
+{
+    queue.ready = false;
+    queue.lent = false;
+    queue.released = false;
+    if (queue.wakeFd[0] >= 0)
+    {
+        drainPipe(queue.wakeFd[0]);
+    }
+}
+
+// retune a running session in place where the SDK allows it
+bool SnxCodecController::Impl::applyParams(StreamKind stream, const StreamParams &requested, ChangeReport &report)
+{
+    Session &session = this->session(stream);
+    const int index = (stream == StreamKind::High) ? 0 : 1;
+    // only the pump writes the params, it publishes them under the mutex
+    StreamParams current = params(stream);
+    report = ChangeReport();
+    if (!session.active)
+    {
+        return false;
+    }
+
+    bool rateControl = false;
+    if (requested.bitrate && requested.bitrate != current.bitrate)
+    {
+        current.bitrate = requested.bitrate;
+        session.ctx.bit_rate = static_cast<int>(requested.bitrate);
+        rateControl = true;
+        report.bitrate = Live;
+    }
+    if (requested.gop && requested.gop != current.gop)
+    {
+        current.gop = requested.gop;
+        session.ctx.gop = static_cast<int>(requested.gop);
+        rateControl = true;
+        report.gop = (snx_codec_set_gop(&session.ctx) == 0) ? Live : Failed;
+    }
+    if (requested.fps && requested.fps != current.fps)
+    {
+        // codec_fps (and isp_fps for M2M) only apply at snx_codec_init, the
+        // report tells the outcome once the pump restarted the session
+        if (!restartRequested[index])
+        {
+            restartFrom[index] = current;
+        }
+        current.fps = requested.fps;
+        restartRequested[index] = true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(reconfigMutex);
+        params(stream) = current;
+    }
+    if (rateControl && !restartRequested[index])
+    {
+        initRateControl(session);
+    }
+    LOG(NOTICE) << "SNX " << ((stream == StreamKind::High) ? "high" : "low") << " stream bitrate=" << current.bitrate
+                << " fps=" << current.fps << " gop=" << current.gop << (restartRequested[index] ? " (restart pending)" : "");
+    return true;
+}
+
+// apply the queued reconfigure() requests and keep their outcome for getChangeStatus()
+void SnxCodecController::Impl::applyRequests()
+{
+    const StreamKind kinds[2] = {StreamKind::High, StreamKind::Low};
+    for (int i = 0; i < 2; ++i)
+    {
+        StreamParams requested;
+        {
+            std::lock_guard<std::mutex> lock(reconfigMutex);
+            if (!reconfigQueued[i])
+            {
+                continue;
+            }
+            requested = reconfigParams[i];
+            reconfigQueued[i] = false;
+        }
+        ChangeReport report;
+        bool applied = applyParams(kinds[i], requested, report);
+        std::lock_guard<std::mutex> lock(reconfigMutex);
+        // a request queued meanwhile, or a restart, is still pending
+        reconfigStatus[i].pending = reconfigQueued[i] || restartRequested[i];
+        reconfigStatus[i].applied = applied;
+        reconfigStatus[i].report = report;
+    }
+}
+
+// take back frames the sources have not borrowed yet; false while one is lent
+bool SnxCodecController::Impl::withdrawFrames(StreamKind stream, bool withLow)
+{
+    StreamQueue &first = queue(stream);
+    std::lock_guard<std::mutex> firstLock(first.mutex);
+    if (first.lent)
+    {
+        return false;
+    }
+    if (withLow)
+    {
+        std::lock_guard<std::mutex> lowLock(lowQueue.mutex);
+        if (lowQueue.lent)
+        {
+            return false;
+        }
+        clearQueue(lowQueue);
+        lowSession.held = false;
+    }
+    clearQueue(first);
+    session(stream).held = false;
+    return true;
+}
+
+// configure a session again with the devices and scale it runs with
+bool SnxCodecController::Impl::reopenSession(Session &session, const StreamParams &params)
+{
+    const std::string codecDevice(session.ctx.codec_dev);
+    const std::string ispDevice(session.ctx.isp_dev);
+    const unsigned int scale = session.ctx.scale;
+    const bool isM2M = session.isM2M;
+    cleanupSession(session);
+    return configureSession(session, params, codecDevice, ispDevice, isM2M, scale);
+}
+
+// restart a session with its current parameters once withdrawFrames() took its
+// frames back; false if they failed and the session went back to the previous
+// ones. The CAP (low) session is attached to the M2M (high) one so it restarts
+// with it, after the same settle window as in start()
+bool SnxCodecController::Impl::restartSession(StreamKind stream)
+{
+    const bool withLow = restartsWithLow(stream);
+    const int index = (stream == StreamKind::High) ? 0 : 1;
+    Session &session = this->session(stream);
+
+    LOG(NOTICE) << "SNX restarting " << ((stream == StreamKind::High) ? "high" : "low") << " session";
+    if (withLow)
+    {
+        cleanupSession(lowSession);
+        lowReopenPending = false;
+    }
+    const bool restarted = reopenSession(session, params(stream));
+    if (!restarted)
+    {
+        LOG(ERROR) << "SNX session restart failed, back to fps=" << restartFrom[index].fps;
+        if (!reopenSession(session, restartFrom[index]))
+        {
+            LOG(ERROR) << "SNX session reopen failed";
+        }
+        std::lock_guard<std::mutex> lock(reconfigMutex);
+        params(stream) = restartFrom[index];
+    }
+    if (withLow && session.active)
+    {
+        lowReopenAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+        lowReopenPending = true;
+    }
+    return restarted;
+}
+
+void SnxCodecController::Impl::reopenLowSession()
+{
+    lowReopenPending = false;
+    if (!reopenSession(lowSession, lowParams))
+    {
+        LOG(ERROR) << "SNX low session restart failed";
+    }
+}
+
+// wake up for the scheduled low session reopen, the other events come from the fds
+int SnxCodecController::Impl::pollTimeout() const
+{
+    if (!lowReopenPending)
+    {
+        return 1000;
+    }
+    const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(lowReopenAt - std::chrono::steady_clock::now()).count();
+    return static_cast<int>(std::max<long long>(0, std::min<long long>(1000, left + 1)));
+}
+
+bool SnxCodecController::Impl::forceIDR(StreamKind stream)
+{
+    Session &session = this->session(stream);
+    if (!session.active || session.ctx.codec_fd < 0) return false;
+    // Try using V4L2 force keyframe control if available
+#ifdef V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME
+    struct v4l2_control ctrl;
+    std::memset(&ctrl, 0, sizeof(ctrl));
+    ctrl.id = V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME;
+    ctrl.value = 1;
+    if (ioctl(session.ctx.codec_fd, VIDIOC_S_CTRL, &ctrl) == 0)
+    {
+        return true;
+    }
+#endif
+    // Some SDKs expose a helper in the middleware; try snx_codec_set_gop as a nudge (set same gop)
+    if (session.ctx.gop > 0)
+    {
+        if (snx_codec_set_gop(&session.ctx) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
 #endif // HAVE_SNX_SDK
 
 SnxCodecController::SnxCodecController()
     : m_impl(new Impl())
 {
-    m_impl->running = false;
 }
 
 SnxCodecController::~SnxCodecController()
@@ -588,8 +1159,11 @@ bool SnxCodecController::start(const StreamParams &high, const StreamParams &low
 #ifdef HAVE_SNX_SDK
     stop();
 
-    m_impl->highParams = high;
-    m_impl->lowParams = low;
+    {
+        std::lock_guard<std::mutex> lock(m_impl->reconfigMutex);
+        m_impl->highParams = high;
+        m_impl->lowParams = low;
+    }
     m_impl->deviceConfig = devices;
 
     // CRITICAL FIX FOR DUAL STREAM:
@@ -662,6 +1236,8 @@ bool SnxCodecController::start(const StreamParams &high, const StreamParams &low
     // Best-effort: request an early IDR on both streams to prime clients
     (void)requestIDR(StreamKind::High);
     (void)requestIDR(StreamKind::Low);
+    // from now on the SDK is only used by the pump thread
+    m_impl->startPump();
     return true;
 #else
     LOG(ERROR) << "SNX SDK support is not enabled at build time.";
@@ -676,8 +1252,29 @@ void SnxCodecController::stop()
 {
 #ifdef HAVE_SNX_SDK
     m_impl->running = false;
+    m_impl->stopPump();
+    m_impl->restartRequested[0] = false;
+    m_impl->restartRequested[1] = false;
+    m_impl->lowReopenPending = false;
+    m_impl->reconfigPending = false;
+    {
+        std::lock_guard<std::mutex> lock(m_impl->reconfigMutex);
+        for (int i = 0; i < 2; ++i)
+        {
+            m_impl->reconfigQueued[i] = false;
+            m_impl->reconfigStatus[i] = ChangeStatus();
+        }
+    }
     m_impl->cleanupSession(m_impl->lowSession);
     m_impl->cleanupSession(m_impl->highSession);
+    {
+        std::lock_guard<std::mutex> lock(m_impl->highQueue.mutex);
+        m_impl->clearQueue(m_impl->highQueue);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_impl->lowQueue.mutex);
+        m_impl->clearQueue(m_impl->lowQueue);
+    }
 #endif
 }
 
@@ -691,6 +1288,19 @@ bool SnxCodecController::isRunning() const
 }
 
 bool SnxCodecController::readFrame(StreamKind stream, std::vector<unsigned char> &buffer, timeval &presentation, bool &isKeyFrame)
+{
+    const unsigned char *data = NULL;
+    std::size_t size = 0;
+    if (!borrowFrame(stream, data, size, presentation, isKeyFrame))
+    {
+        return false;
+    }
+    buffer.assign(data, data + size);
+    releaseFrame(stream);
+    return !buffer.empty();
+}
+
+bool SnxCodecController::borrowFrame(StreamKind stream, const unsigned char *&data, std::size_t &size, timeval &presentation, bool &isKeyFrame)
 {
 #ifdef HAVE_SNX_SDK
     if (!isRunning())
@@ -698,112 +1308,147 @@ bool SnxCodecController::readFrame(StreamKind stream, std::vector<unsigned char>
         return false;
     }
 
-    Impl::Session &session = (stream == StreamKind::High) ? m_impl->highSession : m_impl->lowSession;
-
-    if (!session.active)
+    Impl::StreamQueue &queue = m_impl->queue(stream);
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.ready)
     {
         return false;
     }
+    data = queue.frame.data;
+    size = queue.frame.size;
+    presentation = queue.frame.presentation;
+    isKeyFrame = queue.frame.key;
+    queue.ready = false;
+    queue.lent = true;
+    drainPipe(queue.wakeFd[0]);
+    return true;
+#else
+    (void)stream;
+    (void)data;
+    (void)size;
+    (void)presentation;
+    (void)isKeyFrame;
+    return false;
+#endif
+}
 
-    int ret = snx_codec_read(&session.ctx);
-    if (ret != 0)
+void SnxCodecController::releaseFrame(StreamKind stream)
+{
+#ifdef HAVE_SNX_SDK
+    Impl::StreamQueue &queue = m_impl->queue(stream);
     {
-        if (ret == -EAGAIN || ret == -EINTR)
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.lent)
         {
-            return false;
+            return;
         }
-        LOG(WARN) << "snx_codec_read returned " << ret;
-        return false;
+        queue.lent = false;
     }
+    // the reset is issued by the pump thread
+    queue.released = true;
+    m_impl->wakePump();
+#else
+    (void)stream;
+#endif
+}
 
-    if (session.ctx.cap_index < 0 || session.ctx.cap_buffers == NULL)
-    {
-        LOG(WARN) << "SNX codec returned invalid buffer index";
-        snx_codec_reset(&session.ctx);
-        return false;
-    }
+int SnxCodecController::getPollFd(StreamKind stream) const
+{
+#ifdef HAVE_SNX_SDK
+    // readable when borrowFrame() has a frame for this stream
+    return m_impl->queue(stream).wakeFd[0];
+#else
+    (void)stream;
+    return -1;
+#endif
+}
 
-    auto *raw = static_cast<unsigned char *>(session.ctx.cap_buffers[session.ctx.cap_index].start);
-    size_t payload = static_cast<size_t>(std::max(0, session.ctx.cap_bytesused));
-    const size_t capacity = session.ctx.cap_buffers[session.ctx.cap_index].length;
-    if (payload > capacity)
+std::size_t SnxCodecController::getMaxFrameSize(StreamKind stream) const
+{
+#ifdef HAVE_SNX_SDK
+    // the capture buffer length once the codec is started, an estimate before
+    const Impl::Session &session = (stream == StreamKind::High) ? m_impl->highSession : m_impl->lowSession;
+    size_t capacity = session.capacity.load();
+    if (capacity != 0)
     {
-        payload = capacity;
+        return capacity;
     }
+    std::lock_guard<std::mutex> lock(m_impl->reconfigMutex);
+    return estimateFrameBudget(m_impl->params(stream));
+#else
+    (void)stream;
+    return static_cast<size_t>(kDefaultFrameSizeBytes);
+#endif
+}
 
-    buffer.assign(raw, raw + payload);
-    presentation = session.ctx.timestamp;
-    isKeyFrame = (session.ctx.flags & V4L2_BUF_FLAG_KEYFRAME) != 0;
-
-    // Per-frame bitrate feedback for CBR (H.264 only)
-    if (session.ctx.cap_bytesused > 0 && session.ctx.codec_fmt == V4L2_PIX_FMT_H264 && session.ctx.bit_rate > 0)
+bool SnxCodecController::reconfigure(StreamKind stream, const StreamParams &params)
+{
+#ifdef HAVE_SNX_SDK
+    if (!isRunning() || !m_impl->pumpThread.joinable())
     {
-        // Update QP based on actual frame size to maintain target bitrate
-        session.ctx.qp = snx_codec_rc_update(&session.ctx, &session.rc);
+        return false;
     }
-
-    if (snx_codec_reset(&session.ctx) != 0)
     {
-        LOG(WARN) << "snx_codec_reset failed";
+        std::lock_guard<std::mutex> lock(m_impl->reconfigMutex);
+        const int index = (stream == StreamKind::High) ? 0 : 1;
+        // a request the pump has not taken yet is merged with this one
+        StreamParams &queued = m_impl->reconfigParams[index];
+        if (!m_impl->reconfigQueued[index])
+        {
+            queued = StreamParams();
+        }
+        if (params.bitrate) queued.bitrate = params.bitrate;
+        if (params.fps) queued.fps = params.fps;
+        if (params.gop) queued.gop = params.gop;
+        m_impl->reconfigQueued[index] = true;
+        m_impl->reconfigStatus[index].pending = true;
+        m_impl->reconfigStatus[index].requested = queued;
     }
-
-    return !buffer.empty();
+    m_impl->reconfigPending = true;
+    m_impl->wakePump();
+    return true;
 #else
     (void)stream;
-    (void)buffer;
-    (void)presentation;
-    (void)isKeyFrame;
+    (void)params;
     return false;
 #endif
 }
 
-int SnxCodecController::getPollFd(StreamKind stream) const
+SnxCodecController::ChangeStatus SnxCodecController::getChangeStatus(StreamKind stream) const
 {
 #ifdef HAVE_SNX_SDK
-    const Impl::Session &session = (stream == StreamKind::High) ? m_impl->highSession : m_impl->lowSession;
-    return session.ctx.codec_fd;
+    std::lock_guard<std::mutex> lock(m_impl->reconfigMutex);
+    return m_impl->reconfigStatus[(stream == StreamKind::High) ? 0 : 1];
 #else
     (void)stream;
-    return -1;
+    return ChangeStatus();
 #endif
 }
 
-std::size_t SnxCodecController::getMaxFrameSize(StreamKind stream) const
+SnxCodecController::StreamParams SnxCodecController::getParams(StreamKind stream) const
 {
 #ifdef HAVE_SNX_SDK
-    const StreamParams &params = (stream == StreamKind::High) ? m_impl->highParams : m_impl->lowParams;
-    return estimateFrameBudget(params);
+    std::lock_guard<std::mutex> lock(m_impl->reconfigMutex);
+    return m_impl->params(stream);
 #else
     (void)stream;
-    return static_cast<size_t>(kDefaultFrameSizeBytes);
+    return StreamParams();
 #endif
 }
 
 bool SnxCodecController::requestIDR(StreamKind stream)
 {
 #ifdef HAVE_SNX_SDK
-    Impl::Session &session = (stream == StreamKind::High) ? m_impl->highSession : m_impl->lowSession;
-    if (!session.active || session.ctx.codec_fd < 0) return false;
-    // Try using V4L2 force keyframe control if available
-#ifdef V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME
-    struct v4l2_control ctrl;
-    std::memset(&ctrl, 0, sizeof(ctrl));
-    ctrl.id = V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME;
-    ctrl.value = 1;
-    if (ioctl(session.ctx.codec_fd, VIDIOC_S_CTRL, &ctrl) == 0)
+    if (!m_impl->pumpThread.joinable() || std::this_thread::get_id() == m_impl->pumpThread.get_id())
     {
-        return true;
-    }
-#endif
-    // Some SDKs expose a helper in the middleware; try snx_codec_set_gop as a nudge (set same gop)
-    if (session.ctx.gop > 0)
-    {
-        if (snx_codec_set_gop(&session.ctx) == 0)
-        {
-            return true;
-        }
+        return m_impl->forceIDR(stream);
     }
-    return false;
+    Impl::Session &session = m_impl->session(stream);
+    if (!session.active) return false;
+    // issued by the pump thread
+    m_impl->idrRequested[(stream == StreamKind::High) ? 0 : 1] = true;
+    m_impl->wakePump();
+    return true;
 #else
     (void)stream;
     return false;
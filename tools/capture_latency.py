@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+# ---------------------------------------------------------------------------
+# This software is in the public domain, furnished "as is", without technical
+# support, and with no warranty, express or implied, as to its usefulness for
+# any purpose.
+#
+# capture_latency.py
+#
+# Latency from capture to reception of a stream served with --capture-time
+#
+# usage: capture_latency.py rtsp://host:8554/high [h264|h265]
+#
+# The stream is read through ffmpeg, each frame carries a user data SEI with
+# the capture time, latency is the reception time minus the capture time.
+# The clocks of the camera and of this host must be synchronized (NTP).
+# ---------------------------------------------------------------------------
+
+import subprocess
+import sys
+import time
+
+CAPTURE_TIME_UUID = bytes.fromhex('9a21f3be31f04b78b0bec7f7dbb97236')
+
+
+def unescape(data):
+    # remove the emulation prevention bytes
+    out = bytearray()
+    zeros = 0
+    for byte in data:
+        if zeros >= 2 and byte == 3:
+            zeros = 0
+            continue
+        zeros = zeros + 1 if byte == 0 else 0
+        out.append(byte)
+    return bytes(out)
+
+
+def capture_time(nal, hevc):
+    # capture time in microseconds of a user data unregistered SEI, None otherwise
+    if hevc:
+        if len(nal) < 2 or (nal[0] >> 1) & 0x3F != 39:
+            return None
+        payload = nal[2:]
+    else:
+        if len(nal) < 1 or nal[0] & 0x1F != 6:
+            return None
+        payload = nal[1:]
+    payload = unescape(payload)
+    if len(payload) < 2 + 16 + 8 or payload[0] != 5 or payload[1] != 24:
+        return None
+    if payload[2:18] != CAPTURE_TIME_UUID:
+        return None
+    return int.from_bytes(payload[18:26], 'big')
+
+
+def percentile(values, p):
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def report(latencies):
+    if not latencies:
+        print('no capture time received')
+        return
+    values = sorted(latencies)
+    print('frames:%d p50:%.1fms p90:%.1fms p99:%.1fms max:%.1fms' % (
+        len(values), percentile(values, 50) / 1000, percentile(values, 90) / 1000,
+        percentile(values, 99) / 1000, values[-1] / 1000))
+
+
+def main():
+    if len(sys.argv) < 2:
+        print('usage: %s <rtsp url> [h264|h265]' % sys.argv[0])
+        return 1
+    codec = sys.argv[2] if len(sys.argv) > 2 else 'h264'
+    hevc = (codec == 'h265')
+    ffmpeg = subprocess.Popen(['ffmpeg', '-loglevel', 'error', '-rtsp_transport', 'tcp',
+                               '-i', sys.argv[1], '-an', '-c:v', 'copy',
+                               '-f', 'hevc' if hevc else 'h264', '-'],
+                              stdout=subprocess.PIPE)
+    latencies = []
+    window = []
+    buffer = b''
+    last_report = time.time()
+    try:
+        while True:
+            data = ffmpeg.stdout.read1(65536)
+            if not data:
+                break
+            received = int(time.time() * 1000000)
+            buffer += data
+            # complete NAL units are followed by the next start code
+            start = buffer.find(b'\x00\x00\x01')
+            while start >= 0:
+                end = buffer.find(b'\x00\x00\x01', start + 3)
+                if end < 0:
+                    break
+                nal = buffer[start + 3:end].rstrip(b'\x00')
+                captured = capture_time(nal, hevc)
+                if captured is not None:
+                    latencies.append(received - captured)
+                    window.append(received - captured)
+                start = end
+            buffer = buffer[start:] if start >= 0 else b''
+            if time.time() - last_report >= 10:
+                report(window)
+                window = []
+                last_report = time.time()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        ffmpeg.terminate()
+    print('total:')
+    report(latencies)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
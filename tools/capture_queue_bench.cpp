@@ -0,0 +1,207 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** capture_queue_bench.cpp
+**
+** CaptureQueue against the former std::list<Frame*> + mutex queue
+**
+** usage: capture_queue_bench [items] [limit] [interval us]
+**
+** A producer thread pushes items (dropping the oldest when the queue is
+** full, as the capture thread does) and a consumer thread pops them. Each
+** item carries the time it was pushed, the consumer measures the time it
+** waited. Run once with interval 0 for the throughput, and with the frame
+** interval of a camera (33333) for the latency at the real rate.
+** -------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "CaptureQueue.h"
+
+// about the size of an access unit descriptor
+struct Item
+{
+	unsigned long long m_pushed;
+	char m_nals[256];
+};
+
+static unsigned long long now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void wait(unsigned long long until)
+{
+	while (now() < until)
+	{
+		std::this_thread::yield();
+	}
+}
+
+// ---------------------------------
+// Queue of the capture thread before the ring: one allocation per frame
+// and one list node, both sides under the mutex
+// ---------------------------------
+class ListQueue
+{
+public:
+	explicit ListQueue(unsigned int limit) : m_limit(limit) {}
+	~ListQueue()
+	{
+		while (!m_list.empty())
+		{
+			delete m_list.front();
+			m_list.pop_front();
+		}
+	}
+
+	bool push(const Item &item, unsigned long &dropped)
+	{
+		Item *frame = new Item(item);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		while (m_list.size() >= m_limit)
+		{
+			delete m_list.front();
+			m_list.pop_front();
+			dropped++;
+		}
+		m_list.push_back(frame);
+		return true;
+	}
+
+	bool pop(Item &item)
+	{
+		Item *frame = NULL;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_list.empty())
+			{
+				return false;
+			}
+			frame = m_list.front();
+			m_list.pop_front();
+		}
+		item = *frame;
+		delete frame;
+		return true;
+	}
+
+private:
+	unsigned int m_limit;
+	std::mutex m_mutex;
+	std::list<Item *> m_list;
+};
+
+// ---------------------------------
+// CaptureQueue used as V4L2DeviceSource does
+// ---------------------------------
+class RingQueue
+{
+public:
+	explicit RingQueue(unsigned int limit) : m_queue(limit) {}
+
+	bool push(const Item &item, unsigned long &dropped)
+	{
+		while (!m_queue.push(item))
+		{
+			Item oldest;
+			if (m_queue.evict(oldest))
+			{
+				dropped++;
+			}
+		}
+		return true;
+	}
+
+	bool pop(Item &item) { return m_queue.pop(item); }
+
+private:
+	CaptureQueue<Item> m_queue;
+};
+
+template <typename Queue>
+void run(const char *name, unsigned int count, unsigned int limit, unsigned int interval)
+{
+	Queue queue(limit);
+	std::atomic<bool> done(false);
+	unsigned long dropped = 0;
+	std::vector<unsigned long long> latencies;
+	latencies.reserve(count);
+
+	unsigned long long start = now();
+	std::thread producer([&]()
+	{
+		Item item;
+		memset(&item, 0, sizeof(item));
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			if (interval)
+			{
+				wait(start + (unsigned long long)i * interval * 1000);
+			}
+			item.m_pushed = now();
+			queue.push(item, dropped);
+		}
+		done.store(true);
+	});
+
+	Item item;
+	while (true)
+	{
+		if (queue.pop(item))
+		{
+			latencies.push_back(now() - item.m_pushed);
+		}
+		else if (done.load())
+		{
+			if (!queue.pop(item))
+			{
+				break;
+			}
+			latencies.push_back(now() - item.m_pushed);
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+	producer.join();
+	unsigned long long elapsed = now() - start;
+
+	std::sort(latencies.begin(), latencies.end());
+	size_t n = latencies.size();
+	printf("%-6s %10.0f ops/s  popped:%zu dropped:%lu", name, count * 1e9 / elapsed, n, dropped);
+	if (n)
+	{
+		printf("  latency us p50:%.1f p99:%.1f p99.9:%.1f max:%.1f",
+			   latencies[n / 2] / 1e3, latencies[n * 99 / 100] / 1e3, latencies[n * 999 / 1000] / 1e3, latencies[n - 1] / 1e3);
+	}
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int count = (argc > 1) ? atoi(argv[1]) : 1000000;
+	unsigned int limit = (argc > 2) ? atoi(argv[2]) : 10;
+	unsigned int interval = (argc > 3) ? atoi(argv[3]) : 0;
+
+	printf("items:%u limit:%u interval:%uus\n", count, limit, interval);
+	for (int round = 0; round < 3; ++round)
+	{
+		run<ListQueue>("list", count, limit, interval);
+		run<RingQueue>("ring", count, limit, interval);
+	}
+	return 0;
+}
@@ -0,0 +1,222 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** capture_wakeup_bench.cpp
+**
+** Capture thread waiting on the encoder fd against the former 10 ms polling
+**
+** usage: capture_wakeup_bench [seconds] [fps]
+**
+** An encoder thread makes a frame ready at the given rate and signals it on
+** a pipe, as the SNX pump does on the poll fd of a stream. The capture loop
+** takes it either as V4L2DeviceSource did when SnxDeviceInterface had no fd
+** (try to read, sleep 10 ms when there was nothing) or by waiting in
+** select() on the pipe. Each run prints the wakeups, idle wakeups and
+** select timeouts per second (the counters under "capture" in /stats), the
+** CPU time of the capture thread and the delay from a frame being ready to
+** its read. A run with fps 0 gives the idle cost, with no frame at all.
+** -------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static unsigned long long now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static unsigned long long threadCpu()
+{
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// ---------------------------------
+// Encoder output of one stream: a frame is ready until it is read, the
+// pipe is readable exactly while one is
+// ---------------------------------
+class Encoder
+{
+public:
+	Encoder() : m_ready(0)
+	{
+		if (pipe(m_fd) == 0)
+		{
+			fcntl(m_fd[0], F_SETFL, fcntl(m_fd[0], F_GETFL) | O_NONBLOCK);
+			fcntl(m_fd[1], F_SETFL, fcntl(m_fd[1], F_GETFL) | O_NONBLOCK);
+		}
+	}
+	~Encoder()
+	{
+		close(m_fd[0]);
+		close(m_fd[1]);
+	}
+
+	int getFd() const { return m_fd[0]; }
+
+	void produce()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_ready = now();
+		char c = 0;
+		if (write(m_fd[1], &c, 1) < 0)
+		{
+			perror("write");
+		}
+	}
+
+	// time the frame was ready, 0 with errno EAGAIN when there is none
+	unsigned long long read()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		unsigned long long ready = m_ready;
+		m_ready = 0;
+		char buf[16];
+		while (::read(m_fd[0], buf, sizeof(buf)) > 0)
+		{
+		}
+		if (ready == 0)
+		{
+			errno = EAGAIN;
+		}
+		return ready;
+	}
+
+private:
+	std::mutex m_mutex;
+	unsigned long long m_ready;
+	int m_fd[2];
+};
+
+struct Counters
+{
+	unsigned long m_wakeups;
+	unsigned long m_idleWakeups;
+	unsigned long m_timeouts;
+	unsigned long long m_cpu;
+	std::vector<unsigned long long> m_delays;
+};
+
+// capture loop without fd: the former SnxDeviceInterface path
+static void pollLoop(Encoder &encoder, std::atomic<bool> &stop, Counters &counters)
+{
+	unsigned long long cpu = threadCpu();
+	while (!stop.load())
+	{
+		counters.m_wakeups++;
+		unsigned long long ready = encoder.read();
+		if (ready == 0)
+		{
+			counters.m_idleWakeups++;
+			timeval tv;
+			tv.tv_sec = 0;
+			tv.tv_usec = 10000; // 10ms
+			select(0, NULL, NULL, NULL, &tv);
+		}
+		else if (!stop.load())
+		{
+			counters.m_delays.push_back(now() - ready);
+		}
+	}
+	counters.m_cpu = threadCpu() - cpu;
+}
+
+// capture loop waiting on the fd, as V4L2DeviceSource::thread() does now
+static void selectLoop(Encoder &encoder, std::atomic<bool> &stop, Counters &counters)
+{
+	unsigned long long cpu = threadCpu();
+	int fd = encoder.getFd();
+	while (!stop.load())
+	{
+		fd_set fdset;
+		FD_ZERO(&fdset);
+		FD_SET(fd, &fdset);
+		timeval tv;
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		int ret = select(fd + 1, &fdset, NULL, NULL, &tv);
+		if (ret == 1)
+		{
+			counters.m_wakeups++;
+			unsigned long long ready = encoder.read();
+			if (ready == 0)
+			{
+				counters.m_idleWakeups++;
+			}
+			else if (!stop.load())
+			{
+				counters.m_delays.push_back(now() - ready);
+			}
+		}
+		else if (ret == 0)
+		{
+			counters.m_timeouts++;
+		}
+	}
+	counters.m_cpu = threadCpu() - cpu;
+}
+
+static void run(const char *name, void (*loop)(Encoder &, std::atomic<bool> &, Counters &), unsigned int seconds, unsigned int fps)
+{
+	Encoder encoder;
+	std::atomic<bool> stop(false);
+	Counters counters = Counters();
+	std::thread capture(loop, std::ref(encoder), std::ref(stop), std::ref(counters));
+
+	unsigned long long start = now();
+	unsigned long long end = start + seconds * 1000000000ULL;
+	unsigned long long interval = fps ? 1000000000ULL / fps : 0;
+	for (unsigned long long next = start + interval; interval && (next < end); next += interval)
+	{
+		std::this_thread::sleep_for(std::chrono::nanoseconds(next - now()));
+		encoder.produce();
+	}
+	std::this_thread::sleep_for(std::chrono::nanoseconds(end > now() ? end - now() : 0));
+	stop.store(true);
+	// wake the select loop rather than wait for its 1 s timeout
+	encoder.produce();
+	capture.join();
+
+	std::vector<unsigned long long> &delays = counters.m_delays;
+	std::sort(delays.begin(), delays.end());
+	size_t n = delays.size();
+	printf("%-7s wakeups/s:%6.1f idle/s:%6.1f timeouts/s:%4.1f cpu:%5.2f%%  frames:%zu", name,
+		   (double)counters.m_wakeups / seconds, (double)counters.m_idleWakeups / seconds, (double)counters.m_timeouts / seconds,
+		   counters.m_cpu * 100.0 / (seconds * 1e9), n);
+	if (n)
+	{
+		printf("  delay ms p50:%.2f p99:%.2f max:%.2f", delays[n / 2] / 1e6, delays[n * 99 / 100] / 1e6, delays[n - 1] / 1e6);
+	}
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int seconds = (argc > 1) ? atoi(argv[1]) : 10;
+	unsigned int fps = (argc > 2) ? atoi(argv[2]) : 20;
+	if (seconds == 0)
+	{
+		seconds = 1;
+	}
+
+	printf("seconds:%u fps:%u\n", seconds, fps);
+	run("poll", pollLoop, seconds, fps);
+	run("select", selectLoop, seconds, fps);
+	return 0;
+}
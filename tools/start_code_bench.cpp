@@ -0,0 +1,173 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** start_code_bench.cpp
+**
+** StartCodeScanner against the former memmem split and a byte loop
+**
+** usage: start_code_bench [access units] [IDR bytes] [slices]
+**
+** Builds an H264 IDR access unit the size of a 1080p key frame (SPS, PPS,
+** SEI, then the slices, emulation prevention applied to the random slice
+** data) and splits it over and over. Prints the throughput and the time
+** per access unit of each method, and checks that they find the same NAL
+** units. The scanner runs the loop it was compiled with: build
+** StartCodeScanner.cpp with -mavx2, or with -U__SSE2__ -U__AVX2__ for the
+** word loop of the ARMv5 SoC.
+** -------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include "StartCodeScanner.h"
+
+static const unsigned char H264marker[] = {0, 0, 0, 1};
+static const unsigned char H264shortmarker[] = {0, 0, 1};
+
+static unsigned long long now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// NAL unit with random payload, 00 00 0x (x <= 3) escaped as the encoder does
+static void appendNal(std::vector<unsigned char> &au, bool longMarker, unsigned char header, size_t size)
+{
+	if (longMarker)
+	{
+		au.insert(au.end(), H264marker, H264marker + sizeof(H264marker));
+	}
+	else
+	{
+		au.insert(au.end(), H264shortmarker, H264shortmarker + sizeof(H264shortmarker));
+	}
+	au.push_back(header);
+	unsigned int zeros = 0;
+	for (size_t i = 1; i < size; ++i)
+	{
+		// CABAC output is close to random
+		unsigned char byte = (unsigned char)rand();
+		if ((zeros >= 2) && (byte <= 3))
+		{
+			au.push_back(3);
+			zeros = 0;
+		}
+		au.push_back(byte);
+		zeros = (byte == 0) ? zeros + 1 : 0;
+	}
+	if (au.back() == 0)
+	{
+		// rbsp trailing bits
+		au.back() = 0x80;
+	}
+}
+
+// ---------------------------------
+// Split of extractFrame() before the scanner: memmem for the 4 byte marker,
+// then for the 3 byte one, for the start and the end of each NAL unit
+// ---------------------------------
+static size_t splitMemmem(unsigned char *frame, size_t size)
+{
+	size_t count = 0;
+	while (true)
+	{
+		unsigned int markerlength = sizeof(H264marker);
+		unsigned char *startFrame = (unsigned char *)memmem(frame, size, H264marker, sizeof(H264marker));
+		if (startFrame == NULL)
+		{
+			markerlength = sizeof(H264shortmarker);
+			startFrame = (unsigned char *)memmem(frame, size, H264shortmarker, sizeof(H264shortmarker));
+		}
+		if (startFrame == NULL)
+		{
+			break;
+		}
+		size_t remainingSize = size - (startFrame - frame + markerlength);
+		unsigned char *endFrame = (unsigned char *)memmem(&startFrame[markerlength], remainingSize, H264marker, sizeof(H264marker));
+		if (endFrame == NULL)
+		{
+			endFrame = (unsigned char *)memmem(&startFrame[markerlength], remainingSize, H264shortmarker, sizeof(H264shortmarker));
+		}
+		count++;
+		size -= startFrame - frame + markerlength;
+		frame = &startFrame[markerlength];
+		if (endFrame == NULL)
+		{
+			break;
+		}
+		size -= endFrame - frame;
+		frame = endFrame;
+	}
+	return count;
+}
+
+// one byte at a time, the reference the vector loops were checked against
+static size_t splitBytes(unsigned char *frame, size_t size)
+{
+	size_t count = 0;
+	for (size_t i = 0; i + 2 < size; ++i)
+	{
+		if ((frame[i] == 0) && (frame[i + 1] == 0) && (frame[i + 2] == 1))
+		{
+			count++;
+			i += 2;
+		}
+	}
+	return count;
+}
+
+static size_t splitScanner(unsigned char *frame, size_t size)
+{
+	static std::vector<StartCodeScanner::NalUnit> nalUnits;
+	StartCodeScanner::scan(frame, size, nalUnits);
+	return nalUnits.size();
+}
+
+static void run(const char *name, size_t (*split)(unsigned char *, size_t), std::vector<unsigned char> &au, unsigned int count, size_t expected)
+{
+	size_t found = 0;
+	unsigned long long start = now();
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		found = split(au.data(), au.size());
+	}
+	unsigned long long elapsed = now() - start;
+	printf("%-8s %8.0f MB/s  %8.1f us/AU  nal:%zu%s\n", name, (double)au.size() * count * 1e3 / elapsed, elapsed / 1e3 / count,
+		   found, (found == expected) ? "" : "  MISMATCH");
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int count = (argc > 1) ? atoi(argv[1]) : 2000;
+	size_t idrSize = (argc > 2) ? atoi(argv[2]) : 250000;
+	unsigned int slices = (argc > 3) ? atoi(argv[3]) : 4;
+	if (slices == 0)
+	{
+		slices = 1;
+	}
+
+	srand(1);
+	std::vector<unsigned char> au;
+	appendNal(au, true, 0x67, 24);
+	appendNal(au, true, 0x68, 6);
+	appendNal(au, false, 0x06, 28);
+	for (unsigned int i = 0; i < slices; ++i)
+	{
+		appendNal(au, false, 0x65, idrSize / slices);
+	}
+	size_t expected = 3 + slices;
+
+	printf("access units:%u size:%zu nal:%zu scanner:%s\n", count, au.size(), expected, StartCodeScanner::implementation());
+	for (int round = 0; round < 3; ++round)
+	{
+		run("memmem", splitMemmem, au, count, expected);
+		run("bytes", splitBytes, au, count, expected);
+		run("scanner", splitScanner, au, count, expected);
+	}
+	return 0;
+}
@@ -0,0 +1,226 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** udp_batch_bench.cpp
+**
+** One sendto per RTP packet against sendmmsg batches, over loopback
+**
+** usage: udp_batch_bench [clients] [frames] [packets per frame] [batch]
+**
+** Sends the packets of each frame to every client the way --udp-batch does:
+** each client has its own socket, and its packets of a frame go either one
+** sendto each or in sendmmsg calls of up to [batch] packets. The clients are
+** UDP sockets on 127.0.0.1 drained by a thread. Prints the packets per
+** second, the system calls and the CPU time of the sending thread per
+** packet, and the share of the packets the clients received.
+** -------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// RTP header and a full H264 FU-A payload
+static const unsigned int PACKET_SIZE = 1400;
+
+static unsigned long long now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static unsigned long long threadCpu()
+{
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int sendMultiple(int fd, struct mmsghdr *messages, unsigned int count)
+{
+#ifdef __NR_sendmmsg
+	return syscall(__NR_sendmmsg, fd, messages, count, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+struct Client
+{
+	int m_receiver;
+	int m_sender;
+	struct sockaddr_in m_address;
+	unsigned long m_received;
+};
+
+static bool openClient(Client &client)
+{
+	client.m_received = 0;
+	client.m_receiver = socket(AF_INET, SOCK_DGRAM, 0);
+	client.m_sender = socket(AF_INET, SOCK_DGRAM, 0);
+	if ((client.m_receiver < 0) || (client.m_sender < 0))
+	{
+		perror("socket");
+		return false;
+	}
+	int size = 4 * 1024 * 1024;
+	setsockopt(client.m_receiver, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	memset(&client.m_address, 0, sizeof(client.m_address));
+	client.m_address.sin_family = AF_INET;
+	client.m_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t length = sizeof(client.m_address);
+	if ((bind(client.m_receiver, (struct sockaddr *)&client.m_address, sizeof(client.m_address)) != 0)
+		|| (getsockname(client.m_receiver, (struct sockaddr *)&client.m_address, &length) != 0))
+	{
+		perror("bind");
+		return false;
+	}
+	return true;
+}
+
+static void drain(std::vector<Client> &clients, std::atomic<bool> &stop)
+{
+	std::vector<struct pollfd> fds(clients.size());
+	char buffer[PACKET_SIZE];
+	while (!stop.load())
+	{
+		for (size_t i = 0; i < clients.size(); ++i)
+		{
+			fds[i].fd = clients[i].m_receiver;
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+		}
+		if (poll(fds.data(), fds.size(), 100) <= 0)
+		{
+			continue;
+		}
+		for (size_t i = 0; i < clients.size(); ++i)
+		{
+			while ((fds[i].revents & POLLIN) && (recv(clients[i].m_receiver, buffer, sizeof(buffer), MSG_DONTWAIT) > 0))
+			{
+				clients[i].m_received++;
+			}
+		}
+	}
+}
+
+static void run(const char *name, unsigned int clientCount, unsigned int frames, unsigned int packets, unsigned int batch)
+{
+	std::vector<Client> clients(clientCount);
+	for (size_t i = 0; i < clients.size(); ++i)
+	{
+		if (!openClient(clients[i]))
+		{
+			return;
+		}
+	}
+	std::atomic<bool> stop(false);
+	std::thread receiver(drain, std::ref(clients), std::ref(stop));
+
+	std::vector<unsigned char> payload(PACKET_SIZE * packets, 0x5a);
+	std::vector<struct iovec> iovecs(packets);
+	std::vector<struct mmsghdr> messages(packets);
+	unsigned long calls = 0;
+	unsigned long errors = 0;
+
+	unsigned long long cpu = threadCpu();
+	unsigned long long start = now();
+	for (unsigned int frame = 0; frame < frames; ++frame)
+	{
+		for (size_t c = 0; c < clients.size(); ++c)
+		{
+			Client &client = clients[c];
+			if (batch <= 1)
+			{
+				for (unsigned int p = 0; p < packets; ++p)
+				{
+					calls++;
+					if (sendto(client.m_sender, &payload[p * PACKET_SIZE], PACKET_SIZE, 0, (struct sockaddr *)&client.m_address, sizeof(client.m_address)) < 0)
+					{
+						errors++;
+					}
+				}
+				continue;
+			}
+			for (unsigned int p = 0; p < packets; ++p)
+			{
+				iovecs[p].iov_base = &payload[p * PACKET_SIZE];
+				iovecs[p].iov_len = PACKET_SIZE;
+				memset(&messages[p], 0, sizeof(messages[p]));
+				messages[p].msg_hdr.msg_name = &client.m_address;
+				messages[p].msg_hdr.msg_namelen = sizeof(client.m_address);
+				messages[p].msg_hdr.msg_iov = &iovecs[p];
+				messages[p].msg_hdr.msg_iovlen = 1;
+			}
+			for (unsigned int first = 0; first < packets;)
+			{
+				unsigned int count = std::min(batch, packets - first);
+				calls++;
+				int sent = sendMultiple(client.m_sender, &messages[first], count);
+				if (sent <= 0)
+				{
+					errors++;
+					first += count;
+				}
+				else
+				{
+					first += sent;
+				}
+			}
+		}
+	}
+	unsigned long long elapsed = now() - start;
+	cpu = threadCpu() - cpu;
+
+	// let the receiver catch up
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	stop.store(true);
+	receiver.join();
+
+	unsigned long total = (unsigned long)frames * packets * clients.size();
+	unsigned long received = 0;
+	for (size_t i = 0; i < clients.size(); ++i)
+	{
+		received += clients[i].m_received;
+		close(clients[i].m_receiver);
+		close(clients[i].m_sender);
+	}
+	printf("%-9s %9.0f pkt/s  calls/pkt:%.3f  cpu ns/pkt:%6.0f  errors:%lu  received:%.1f%%\n", name,
+		   total * 1e9 / elapsed, (double)calls / total, (double)cpu / total, errors, received * 100.0 / total);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int clients = (argc > 1) ? atoi(argv[1]) : 4;
+	unsigned int frames = (argc > 2) ? atoi(argv[2]) : 2000;
+	unsigned int packets = (argc > 3) ? atoi(argv[3]) : 40;
+	unsigned int batch = (argc > 4) ? atoi(argv[4]) : 32;
+	if ((clients == 0) || (packets == 0))
+	{
+		return 1;
+	}
+
+	printf("clients:%u frames:%u packets/frame:%u size:%u batch:%u\n", clients, frames, packets, PACKET_SIZE, batch);
+	for (int round = 0; round < 3; ++round)
+	{
+		run("sendto", clients, frames, packets, 1);
+		run("sendmmsg", clients, frames, packets, batch);
+	}
+	return 0;
+}
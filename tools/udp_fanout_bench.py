@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+# ---------------------------------------------------------------------------
+# This software is in the public domain, furnished "as is", without technical
+# support, and with no warranty, express or implied, as to its usefulness for
+# any purpose.
+#
+# udp_fanout_bench.py
+#
+# RTP over UDP fan-out load of the server, run on the camera (loopback)
+#
+# usage: udp_fanout_bench.py rtsp://127.0.0.1:8554/high <viewers> [seconds] [pid]
+#
+# Opens <viewers> RTSP sessions with UDP transport, counts the RTP packets
+# received, and reads the CPU time used by the server meanwhile. Run it once
+# with the server started without --udp-batch and once with it to compare.
+# ---------------------------------------------------------------------------
+
+import os
+import select
+import socket
+import subprocess
+import sys
+import time
+from urllib.parse import urlparse
+
+
+class Viewer:
+    def __init__(self, url):
+        self.url = url
+        self.cseq = 0
+        self.session = None
+        self.packets = 0
+        parsed = urlparse(url)
+        self.rtsp = socket.create_connection((parsed.hostname, parsed.port or 554))
+        self.rtp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.rtp.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1024 * 1024)
+        self.rtp.bind(('', 0))
+        self.rtcp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.rtcp.bind(('', 0))
+
+    def request(self, method, url, headers=''):
+        self.cseq += 1
+        message = '%s %s RTSP/1.0\r\nCSeq: %d\r\n%s' % (method, url, self.cseq, headers)
+        if self.session:
+            message += 'Session: %s\r\n' % self.session
+        self.rtsp.sendall((message + '\r\n').encode())
+        reply = b''
+        while b'\r\n\r\n' not in reply:
+            reply += self.rtsp.recv(4096)
+        header, body = reply.split(b'\r\n\r\n', 1)
+        lines = header.decode().split('\r\n')
+        if lines[0].split()[1:2] != ['200']:
+            raise RuntimeError('%s %s: %s' % (method, url, lines[0]))
+        fields = dict(line.split(':', 1) for line in lines[1:] if ':' in line)
+        fields = dict((k.strip().lower(), v.strip()) for k, v in fields.items())
+        length = int(fields.get('content-length', 0))
+        while len(body) < length:
+            body += self.rtsp.recv(4096)
+        return fields, body.decode()
+
+    def start(self):
+        fields, sdp = self.request('DESCRIBE', self.url, 'Accept: application/sdp\r\n')
+        base = fields.get('content-base', self.url + '/')
+        control = None
+        for line in sdp.split('\r\n'):
+            if line.startswith('m=') and not line.startswith('m=video'):
+                break
+            if line.startswith('a=control:'):
+                control = line[len('a=control:'):]
+        track = control if control and control.startswith('rtsp://') else base.rstrip('/') + '/' + (control or '')
+        transport = 'Transport: RTP/AVP;unicast;client_port=%d-%d\r\n' % (self.rtp.getsockname()[1], self.rtcp.getsockname()[1])
+        fields, _ = self.request('SETUP', track, transport)
+        self.session = fields['session'].split(';')[0]
+        self.request('PLAY', self.url, 'Range: npt=0.000-\r\n')
+
+    def stop(self):
+        try:
+            self.request('TEARDOWN', self.url)
+        except Exception:
+            pass
+        self.rtsp.close()
+
+
+def cpu_time(pid):
+    # user + system time of the process in seconds
+    with open('/proc/%d/stat' % pid) as stat:
+        fields = stat.read().rsplit(')', 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / os.sysconf('SC_CLK_TCK')
+
+
+def main():
+    if len(sys.argv) < 3:
+        print('usage: %s <rtsp url> <viewers> [seconds] [pid]' % sys.argv[0])
+        return 1
+    url = sys.argv[1]
+    count = int(sys.argv[2])
+    duration = float(sys.argv[3]) if len(sys.argv) > 3 else 30
+    if len(sys.argv) > 4:
+        pid = int(sys.argv[4])
+    else:
+        pid = int(subprocess.check_output(['pidof', '-s', 'v4l2rtspserver']).split()[0])
+
+    viewers = [Viewer(url) for _ in range(count)]
+    for viewer in viewers:
+        viewer.start()
+    sockets = dict((viewer.rtp, viewer) for viewer in viewers)
+
+    # let the sessions settle before measuring
+    time.sleep(1)
+    for viewer in viewers:
+        while select.select([viewer.rtp], [], [], 0)[0]:
+            viewer.rtp.recv(65536)
+
+    start_cpu = cpu_time(pid)
+    start = time.time()
+    while time.time() - start < duration:
+        ready, _, _ = select.select(list(sockets), [], [], 0.5)
+        for sock in ready:
+            sock.recv(65536)
+            sockets[sock].packets += 1
+    elapsed = time.time() - start
+    cpu = cpu_time(pid) - start_cpu
+
+    for viewer in viewers:
+        viewer.stop()
+
+    packets = sum(viewer.packets for viewer in viewers)
+    print('viewers:%d duration:%.1fs' % (count, elapsed))
+    print('packets/s:%.0f per viewer:%.0f' % (packets / elapsed, packets / elapsed / count))
+    print('server cpu:%.1f%% per viewer:%.2f%% per 1000 packets:%.2fms' % (
+        100 * cpu / elapsed, 100 * cpu / elapsed / count, 1000000 * cpu / packets if packets else 0))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())